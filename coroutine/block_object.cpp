@@ -1,7 +1,6 @@
 #include "block_object.h"
 #include "scheduler.h"
 #include "error.h"
-#include <unistd.h>
 #include <mutex>
 #include <limits>
 
@@ -18,18 +17,13 @@ BlockObject::~BlockObject()
         ThrowError(eCoErrorCode::ec_block_object_locked);
     }
 
-    if (!wait_queue_.empty()) {
+    if (!wait_queue_.empty() || !thread_wait_queue_.empty()) {
         ThrowError(eCoErrorCode::ec_block_object_waiting);
     }
 }
 
 void BlockObject::CoBlockWait()
 {
-    if (!g_Scheduler.IsCoroutine()) {
-        while (!TryBlockWait()) usleep(10 * 1000);
-        return ;
-    }
-
     std::unique_lock<LFLock> lock(lock_);
     if (wakeup_ > 0) {
         DebugPrint(dbg_syncblock, "wait immedaitely done.");
@@ -37,6 +31,17 @@ void BlockObject::CoBlockWait()
         return ;
     }
 
+    if (!g_Scheduler.IsCoroutine()) {
+        // 协程外的线程排队后休眠在futex上, 由Wakeup直接唤醒.
+        BlockThreadWaiter w;
+        w.park_seq_ = g_Scheduler.GetThreadParkSeq();
+        thread_wait_queue_.push(&w);
+        lock.unlock();
+        DebugPrint(dbg_syncblock, "thread wait.");
+        g_Scheduler.ThreadParkUntil(w.woken_);
+        return ;
+    }
+
     Task* tk = g_Scheduler.GetLocalInfo().current_task;
     tk->block_ = this;
     tk->state_ = TaskState::sys_block;
@@ -59,6 +64,18 @@ bool BlockObject::TryBlockWait()
 bool BlockObject::Wakeup()
 {
     std::unique_lock<LFLock> lock(lock_);
+
+    // 协程外的线程优先: 它们多是与协程交互的桥接线程, 对延迟更敏感.
+    if (BlockThreadWaiter *w = thread_wait_queue_.pop()) {
+        // woken_置位后w随时可能失效, 先取出park_seq_.
+        std::atomic<uint32_t> *park_seq = w->park_seq_;
+        w->woken_.store(1, std::memory_order_release);
+        lock.unlock();
+        g_Scheduler.ThreadUnpark(park_seq);
+        DebugPrint(dbg_syncblock, "wakeup thread.");
+        return true;
+    }
+
     Task* tk = wait_queue_.pop();
     if (!tk) {
         if (wakeup_ >= max_wakeup_) {
@@ -5,6 +5,13 @@
 namespace co
 {
 
+// 协程外等待BlockObject的线程, 分配在线程栈上.
+struct BlockThreadWaiter : public TSQueueHook
+{
+    std::atomic<uint32_t>* park_seq_;           // 线程休眠的futex
+    std::atomic<uint32_t> woken_{0};
+};
+
 class BlockObject
 {
 protected:
@@ -12,7 +19,8 @@ protected:
     std::size_t wakeup_;
     std::size_t max_wakeup_;
     TSQueue<Task, false> wait_queue_;
-    LFLock lock_;
+    TSQueue<BlockThreadWaiter, false> thread_wait_queue_;     // 协程外等待的线程
+    LFLock lock_{eLockSite::block_object};
 
 public:
     explicit BlockObject(std::size_t init_wakeup = 0, std::size_t max_wakeup = -1);
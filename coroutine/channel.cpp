@@ -0,0 +1,195 @@
+#include "channel.h"
+
+namespace co
+{
+
+ChanWaitGroup::ChanWaitGroup()
+    : tk_(g_Scheduler.GetCurrentTask())
+{
+    if (!tk_)
+        park_seq_ = g_Scheduler.GetThreadParkSeq();
+}
+
+bool ChanWaitGroup::TryFire(int index)
+{
+    uint32_t expected = 0;
+    if (!fired_.compare_exchange_strong(expected, 1, std::memory_order_acq_rel,
+                std::memory_order_relaxed))
+        return false;
+
+    fired_index_ = index;
+    return true;
+}
+
+void ChanWaitGroup::Wait()
+{
+    if (!tk_) {
+        g_Scheduler.ThreadParkUntil(notified_);
+        return ;
+    }
+
+    // 至少ParkSwitch一次, 消耗掉Notify中的UnparkTask,
+    // 否则协程可能在唤醒者访问Task之前就已结束.
+    do {
+        g_Scheduler.ParkSwitch();
+    } while (!notified_.load(std::memory_order_acquire));
+}
+
+bool ChanWaitGroup::WaitUntil(CoTimerMgr::TimePoint const& deadline)
+{
+    if (!tk_) {
+        if (g_Scheduler.ThreadParkUntil(notified_, &deadline))
+            return true;
+
+        if (TryFire(kTimeoutIndex))
+            return false;
+
+        // 已被唤醒者选中, 等它完成唤醒.
+        Wait();
+        return true;
+    }
+
+    if (CoTimerMgr::CachedNow() >= deadline && TryFire(kTimeoutIndex))
+        return false;
+
+    // 定时器与唤醒者只有一方能TryFire成功, 因此只会有一次Notify.
+    TimerId timer = g_Scheduler.ExpireAt(deadline, [this]{
+                if (this->TryFire(kTimeoutIndex))
+                    this->Notify();
+            });
+    Wait();
+
+    // 等待正在执行的定时器回调结束, 之后才可以释放此对象.
+    g_Scheduler.BlockCancelTimer(timer);
+    return fired_index_ != kTimeoutIndex;
+}
+
+void ChanWaitGroup::Notify()
+{
+    // notified_置位后等待者随时可能释放此对象, 先取出tk_和park_seq_.
+    Task *tk = tk_;
+    std::atomic<uint32_t> *park_seq = park_seq_;
+    notified_.store(1, std::memory_order_release);
+    if (tk)
+        g_Scheduler.UnparkTask(tk);
+    else
+        g_Scheduler.ThreadUnpark(park_seq);
+}
+
+void ChanWaitQueue::Push(ChanWaiter* w)
+{
+    queue_.push(w);
+    count_.fetch_add(1, std::memory_order_seq_cst);
+}
+
+bool ChanWaitQueue::Erase(ChanWaiter* w)
+{
+    if (!queue_.erase(w))
+        return false;
+
+    count_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+ChanWaiter* ChanWaitQueue::PopFire()
+{
+    while (ChanWaiter *w = queue_.pop()) {
+        count_.fetch_sub(1, std::memory_order_relaxed);
+        if (w->group_->TryFire(w->index_))
+            return w;
+    }
+
+    return NULL;
+}
+
+ChanWaiter* ChanWaitQueue::PopFireN(std::size_t n)
+{
+    ChanWaiter *head = NULL, *tail = NULL;
+    for (std::size_t k = 0; k < n; ++k) {
+        ChanWaiter *w = PopFire();
+        if (!w) break;
+
+        // 已弹出的节点next为NULL, 借用它串成链表.
+        if (tail)
+            tail->next = w;
+        else
+            head = w;
+        tail = w;
+    }
+
+    return head;
+}
+
+void ChanWaitQueue::NotifyChain(ChanWaiter* chain)
+{
+    while (chain) {
+        // 唤醒后等待者随时可能释放节点, 先取出next.
+        ChanWaiter *next = static_cast<ChanWaiter*>(chain->next);
+        chain->next = NULL;
+        chain->group_->Notify();
+        chain = next;
+    }
+}
+
+int Select::TryWait()
+{
+    for (std::size_t i = 0; i < cases_.size(); ++i)
+        if (cases_[i]->Try())
+            return (int)i;
+
+    return -1;
+}
+
+void Select::CancelAll(int selected)
+{
+    for (std::size_t i = 0; i < cases_.size(); ++i)
+        cases_[i]->Cancel((int)i == selected);
+}
+
+int Select::DoWait(CoTimerMgr::TimePoint const* deadline)
+{
+    if (cases_.empty())
+        return -1;
+
+    for (;;) {
+        int index = TryWait();
+        if (index >= 0)
+            return index;
+
+        // 依次登记, 登记过程中就可能被选中.
+        std::unique_ptr<ChanWaitGroup> group(new ChanWaitGroup);
+        eSelectState state = eSelectState::waiting;
+        for (std::size_t i = 0; i < cases_.size(); ++i) {
+            state = cases_[i]->Register(group.get(), (int)i);
+            if (state == eSelectState::done) {
+                CancelAll(-1);
+                return (int)i;
+            }
+
+            if (state != eSelectState::waiting)
+                break;
+        }
+
+        // 自己选中了group, 不会再有唤醒者.
+        if (state == eSelectState::retry) {
+            CancelAll(-1);
+            continue;
+        }
+
+        DebugPrint(dbg_syncblock, "select wait. cases=%d", (int)cases_.size());
+        if (!deadline)
+            group->Wait();
+        else if (!group->WaitUntil(*deadline)) {
+            CancelAll(-1);
+            return -1;
+        }
+
+        index = group->fired_index_;
+        bool ok = cases_[index]->Complete();
+        CancelAll(index);
+        if (ok)
+            return index;
+    }
+}
+
+} //namespace co
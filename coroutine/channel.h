@@ -1,229 +1,761 @@
 #pragma once
 #include <memory>
-#include <queue>
-#include "block_object.h"
-#include "co_mutex.h"
+#include <deque>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include "ts_queue.h"
 #include "scheduler.h"
 
 namespace co
 {
 
+// 一次channel等待
+//   协程等待时以ParkSwitch挂起, 协程外的线程等待时休眠在本线程的futex上(ThreadParkUntil).
+//   唤醒者先以TryFire选中等待者, 成功的一方再调用一次Notify; 等待者也可以TryFire撤销自己.
+//   限时等待的协程另挂一个定时器, 超时时定时器同样以TryFire与唤醒者竞争.
+//   共享栈的协程挂起后其栈上的对象不可访问, 因此等待相关的对象都分配在堆上.
+struct ChanWaitGroup
+{
+    // 超时时选中的位置
+    static const int kTimeoutIndex = -2;
+
+    Task* tk_;                              // 等待的协程, 协程外为NULL
+    std::atomic<uint32_t>* park_seq_ = NULL;    // 协程外等待的线程休眠的futex
+    std::atomic<uint32_t> fired_{0};        // 是否已被选中
+    std::atomic<uint32_t> notified_{0};     // 选中者是否已完成唤醒
+    int fired_index_ = -1;                  // 选中时的位置, 由TryFire的参数指定
+
+    ChanWaitGroup();
+
+    bool TryFire(int index);
+
+    // 等待Notify, 返回后才可以释放.
+    void Wait();
+
+    // 等待Notify直到deadline, 被唤醒者选中返回true, 超时返回false.
+    //   超时后仍登记在等待队列中的节点需要调用者在channel的锁内移除.
+    bool WaitUntil(CoTimerMgr::TimePoint const& deadline);
+
+    // TryFire成功后调用一次
+    void Notify();
+};
+
+// 登记在channel等待队列中的节点
+struct ChanWaiter : public TSQueueHook
+{
+    ChanWaitGroup* group_;
+    int index_;
+
+    explicit ChanWaiter(ChanWaitGroup* group, int index = 0)
+        : group_(group), index_(index) {}
+    virtual ~ChanWaiter() {}
+};
+
+// 无缓冲区channel的等待节点, 携带交接的数据
+//   写者登记时写入要发送的数据, 读者登记时由写者写入.
 template <typename T>
-class Channel
+struct ChanValueWaiter : public ChanWaiter
 {
-private:
-    class ChannelImpl;
-    mutable std::shared_ptr<ChannelImpl> impl_;
+    typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage_;
+    bool has_value_ = false;
 
-public:
-    explicit Channel(std::size_t capacity = 0)
+    explicit ChanValueWaiter(ChanWaitGroup* group, int index = 0)
+        : ChanWaiter(group, index) {}
+
+    ~ChanValueWaiter()
     {
-        impl_.reset(new ChannelImpl(capacity));
+        if (has_value_)
+            Value().~T();
     }
-    ~Channel()
+
+    template <typename U>
+    void Put(U && t)
     {
+        ::new (&storage_) T(std::forward<U>(t));
+        has_value_ = true;
     }
 
-    template <typename U>
-    Channel const& operator<<(U && t) const
+    T& Value()
     {
-        (*impl_) << std::forward<U>(t);
-        return *this;
+        return *reinterpret_cast<T*>(&storage_);
+    }
+};
+
+// channel一端的等待队列, 由channel的锁保护, 等待者数量可以不加锁读取.
+struct ChanWaitQueue
+{
+    TSQueue<ChanWaiter, false> queue_;
+    std::atomic<std::size_t> count_{0};
+
+    void Push(ChanWaiter* w);
+
+    // 移除尚未被唤醒者弹出的节点
+    bool Erase(ChanWaiter* w);
+
+    // 弹出第一个能够选中的等待者, 不能选中的(已被其他channel或自己撤销)直接丢弃.
+    ChanWaiter* PopFire();
+
+    // 弹出至多n个能够选中的等待者, 经next串成链表返回, 解锁后交给NotifyChain.
+    ChanWaiter* PopFireN(std::size_t n);
+
+    // 依次唤醒PopFireN返回的等待者
+    static void NotifyChain(ChanWaiter* chain);
+
+    bool HasWaiter()
+    {
+        return count_.load(std::memory_order_seq_cst) != 0;
+    }
+};
+
+// select的一个分支登记后的结果
+enum class eSelectState
+{
+    waiting,    // 已登记, 等待唤醒
+    done,       // 已选中group并直接完成了这个分支
+    retry,      // 已选中group但没有完成, 撤销所有登记后重新尝试
+    fired,      // group已被其他唤醒者选中, 停止登记并等待唤醒
+};
+
+class Select;
+
+// Channel<void>的元素
+struct ChanVoid
+{
+    ChanVoid(std::nullptr_t) {}
+};
+
+// channel的实现
+//   有缓冲区时, 元素存放在预先分配的无锁环形队列中, 读写只有一次CAS;
+//   只有缓冲区满(空)时才加锁登记到等待队列并挂起, 读写成功后对端有等待者时才加锁唤醒.
+//   容量超过kMaxRingCapacity, 或T的移动构造可能抛出异常时不使用环形队列, 缓冲区改用加锁的deque,
+//   元素数达到容量时写入同样阻塞;
+//   容量为kUnbounded((size_t)-1)时为无界, 写入不会阻塞.
+//   无缓冲区时, 读写双方在锁内交接: 先到的一方登记等待, 后到的一方完成交接并唤醒它.
+template <typename T>
+class ChannelImpl
+{
+    std::size_t capacity_;
+    std::unique_ptr<MPMCRing<T>> ring_;
+    std::deque<T> list_;
+    LFLock list_lock_{eLockSite::channel};
+
+    LFLock lock_{eLockSite::channel};
+    ChanWaitQueue send_waiters_;
+    ChanWaitQueue recv_waiters_;
+
+    typedef ChanValueWaiter<T> ValueWaiter;
+
+public:
+    // 超过此容量的channel不预先分配环形队列
+    static const std::size_t kMaxRingCapacity = 64 * 1024;
+
+    // 无界channel的容量
+    static const std::size_t kUnbounded = (std::size_t)-1;
+
+    explicit ChannelImpl(std::size_t capacity)
+        : capacity_(capacity)
+    {
+        if (capacity_ > 0 && capacity_ <= kMaxRingCapacity)
+            ring_.reset(NewRing(capacity_, std::is_nothrow_move_constructible<T>()));
+    }
+
+    ChannelImpl(ChannelImpl const&) = delete;
+    ChannelImpl& operator=(ChannelImpl const&) = delete;
+
+    std::size_t Capacity() const
+    {
+        return capacity_;
     }
 
+    typedef CoTimerMgr::TimePoint TimePoint;
+
+    // write
+    //   deadline不为NULL时最多等待到deadline, 超时返回false, 右值参数不会被移走.
     template <typename U>
-    Channel const& operator>>(U & t) const
+    bool Push(U && t, TimePoint const* deadline = NULL)
     {
-        (*impl_) >> t;
-        return *this;
+        if (!capacity_)
+            return SyncPush(std::forward<U>(t), true, deadline);
+
+        while (!BufferPush(std::forward<U>(t))) {
+            eWaitResult res = Wait(send_waiters_,
+                    [&]{ return this->BufferPush(std::forward<U>(t)); }, deadline);
+            if (res == eWaitResult::retry_ok)
+                break;
+            if (res == eWaitResult::timeout)
+                return false;
+        }
+
+        NotifyN(recv_waiters_, 1);
+        return true;
     }
 
-    Channel const& operator>>(nullptr_t ignore) const
+    // read
+    template <typename U>
+    bool Pop(U & t, TimePoint const* deadline = NULL)
     {
-        (*impl_) >> ignore;
-        return *this;
+        AssignSink<U> sink{t};
+        return PopN(sink, 1, deadline) != 0;
     }
 
+    // try write
     template <typename U>
-    bool TryPush(U && t) const
+    bool TryPush(U && t)
     {
-        return impl_->TryPush(std::forward<U>(t));
+        if (!capacity_)
+            return SyncPush(std::forward<U>(t), false, NULL);
+
+        if (!BufferPush(std::forward<U>(t)))
+            return false;
+
+        NotifyN(recv_waiters_, 1);
+        return true;
     }
 
+    // try read
     template <typename U>
-    bool TryPop(U & t) const
+    bool TryPop(U & t)
     {
-        return impl_->TryPop(t);
+        AssignSink<U> sink{t};
+        return TryPopN(sink, 1) != 0;
     }
 
-    bool TryPop(nullptr_t ignore) const
+    // 批量写入first开始的n个元素, 缓冲区满时阻塞, 直到全部写入.
+    template <typename InputIt>
+    void PushN(InputIt first, std::size_t n)
     {
-        return impl_->TryPop(ignore);
+        while (n) {
+            std::size_t k = TryPushN(first, n);
+            n -= k;
+            if (n && !k) {
+                // 没有空位, 逐个阻塞写入, 被唤醒后再尝试批量写入.
+                Push(*first);
+                ++first;
+                --n;
+            }
+        }
     }
 
-    template <typename U, typename Duration>
-    bool BlockTryPush(U && t, Duration const& timeout) const
+    // 批量写入至多n个元素, first前进到第一个未写入的元素, 返回写入的数量.
+    template <typename InputIt>
+    std::size_t TryPushN(InputIt &first, std::size_t n)
     {
-        int interval = 1;
-        auto begin = std::chrono::high_resolution_clock::now();
-        while (!TryPush(std::forward<U>(t))) {
-            auto now = std::chrono::high_resolution_clock::now();
-            if (std::chrono::duration_cast<Duration>(now - begin) >= timeout)
-                return false;
+        if (!capacity_)
+            return SyncPushN(first, n);
 
-            interval = std::min(32, interval << 1);
-            g_Scheduler.SleepSwitch(interval);
+        std::size_t k = BufferPushN(first, n);
+        NotifyN(recv_waiters_, k);
+        return k;
+    }
+
+    // 批量读取至多n个元素交给sink(T&&), 没有元素时阻塞, 返回读取的数量.
+    //   deadline不为NULL时最多等待到deadline, 超时返回0.
+    template <typename Sink>
+    std::size_t PopN(Sink &sink, std::size_t n, TimePoint const* deadline = NULL)
+    {
+        if (!capacity_)
+            return SyncPopN(sink, n, true, deadline);
+
+        std::size_t k;
+        while (!(k = BufferPopN(sink, n))) {
+            eWaitResult res = Wait(recv_waiters_,
+                    [&]{ return (k = this->BufferPopN(sink, n)) != 0; }, deadline);
+            if (res == eWaitResult::retry_ok)
+                break;
+            if (res == eWaitResult::timeout)
+                return 0;
         }
 
-        return true;
+        NotifyN(send_waiters_, k);
+        return k;
     }
 
-    template <typename U, typename Duration>
-    bool BlockTryPop(U & t, Duration const& timeout) const
+    // 批量读取至多n个元素交给sink(T&&), 不阻塞, 返回读取的数量.
+    template <typename Sink>
+    std::size_t TryPopN(Sink &sink, std::size_t n)
     {
-        int interval = 1;
-        auto begin = std::chrono::high_resolution_clock::now();
-        while (!TryPop(t)) {
-            auto now = std::chrono::high_resolution_clock::now();
-            if (std::chrono::duration_cast<Duration>(now - begin) >= timeout)
-                return false;
+        if (!capacity_)
+            return SyncPopN(sink, n, false, NULL);
+
+        std::size_t k = BufferPopN(sink, n);
+        NotifyN(send_waiters_, k);
+        return k;
+    }
 
-            interval = std::min(32, interval << 1);
-            g_Scheduler.SleepSwitch(interval);
+    /// ------------------------------------------------------------------------
+    // @{ select的分支
+    //    先登记再检查是否就绪, 与Wait的方式相同, 不会丢失唤醒.
+    //    无缓冲区时在锁内检查对端的等待者, 有则先选中group再交接, 因此一次select至多完成一个分支.
+    //
+    // 登记读分支
+    template <typename Sink>
+    eSelectState SelectRecv(ChanWaitGroup *group, int index,
+            std::unique_ptr<ValueWaiter> &node, Sink &sink)
+    {
+        std::unique_lock<LFLock> lock(lock_);
+        if (!capacity_ && send_waiters_.HasWaiter()) {
+            if (!group->TryFire(index))
+                return eSelectState::fired;
+
+            ChanWaiter *w = send_waiters_.PopFire();
+            if (!w)
+                return eSelectState::retry;
+
+            sink(std::move(static_cast<ValueWaiter*>(w)->Value()));
+            ChanWaitGroup *peer = w->group_;
+            lock.unlock();
+            peer->Notify();
+            return eSelectState::done;
         }
 
-        return true;
+        node.reset(new ValueWaiter(group, index));
+        recv_waiters_.Push(node.get());
+        lock.unlock();
+
+        if (capacity_ && !BufferEmpty())
+            return group->TryFire(-1) ? eSelectState::retry : eSelectState::fired;
+        return eSelectState::waiting;
     }
 
-    template <typename Duration>
-    bool BlockTryPop(nullptr_t ignore, Duration const& timeout) const
+    // 登记写分支, 无缓冲区时t被移入等待节点.
+    template <typename U>
+    eSelectState SelectSend(ChanWaitGroup *group, int index,
+            std::unique_ptr<ValueWaiter> &node, U &t)
     {
-        int interval = 1;
-        auto begin = std::chrono::high_resolution_clock::now();
-        while (!TryPop(ignore)) {
-            auto now = std::chrono::high_resolution_clock::now();
-            if (std::chrono::duration_cast<Duration>(now - begin) >= timeout)
-                return false;
-
-            interval = std::min(32, interval << 1);
-            g_Scheduler.SleepSwitch(interval);
+        std::unique_lock<LFLock> lock(lock_);
+        if (!capacity_ && recv_waiters_.HasWaiter()) {
+            if (!group->TryFire(index))
+                return eSelectState::fired;
+
+            ChanWaiter *w = recv_waiters_.PopFire();
+            if (!w)
+                return eSelectState::retry;
+
+            static_cast<ValueWaiter*>(w)->Put(std::move(t));
+            ChanWaitGroup *peer = w->group_;
+            lock.unlock();
+            peer->Notify();
+            return eSelectState::done;
         }
 
-        return true;
+        node.reset(new ValueWaiter(group, index));
+        if (!capacity_)
+            node->Put(std::move(t));
+        send_waiters_.Push(node.get());
+        lock.unlock();
+
+        if (capacity_ && BufferHasRoom())
+            return group->TryFire(-1) ? eSelectState::retry : eSelectState::fired;
+        return eSelectState::waiting;
     }
 
-    bool Unique() const
+    // 撤销登记, 此后不会再有唤醒者访问node.
+    void SelectCancel(bool send, ValueWaiter *node)
     {
-        return impl_.unique();
+        std::lock_guard<LFLock> lock(lock_);
+        (send ? send_waiters_ : recv_waiters_).Erase(node);
     }
+    // }@
+    /// ------------------------------------------------------------------------
 
-private:
-    class ChannelImpl
+    // 将读出的元素赋值给t, t为nullptr时丢弃.
+    //   sink是否noexcept决定了缓冲区能否批量取出, 见MPMCRing::TryPopN.
+    template <typename U>
+    struct AssignSink
     {
-        BlockObject write_block_;
-        BlockObject read_block_;
-        std::queue<T> queue_;
-        CoMutex queue_lock_;
+        U &t;
 
-    public:
-        explicit ChannelImpl(std::size_t capacity)
-            : write_block_(capacity)
-        {}
+        template <typename V>
+        void Assign(V & dst, T && v) noexcept(noexcept(dst = std::move(v))) { dst = std::move(v); }
+        void Assign(std::nullptr_t &, T &&) noexcept {}
 
-        // write
-        template <typename U>
-        void operator<<(U && t)
+        void operator()(T && v) noexcept(noexcept(std::declval<AssignSink&>().Assign(t, std::move(v))))
         {
-            write_block_.CoBlockWait();
+            Assign(t, std::move(v));
+        }
+    };
 
-            {
-                std::unique_lock<CoMutex> lock(queue_lock_);
-                queue_.push(std::forward<U>(t));
-            }
+    // 将读出的元素依次写入输出迭代器
+    template <typename OutputIt>
+    struct IteratorSink
+    {
+        OutputIt &out;
 
-            read_block_.Wakeup();
+        void operator()(T && v) noexcept(noexcept(*out = std::move(v)) && noexcept(++out))
+        {
+            *out = std::move(v); ++out;
         }
+    };
 
-        // read
-        template <typename U>
-        void operator>>(U & t)
-        {
-            write_block_.Wakeup();
-            read_block_.CoBlockWait();
+private:
+    // 移动构造可能抛出异常的元素不能放在环形队列中, 使用deque.
+    static MPMCRing<T>* NewRing(std::size_t capacity, std::true_type)
+    {
+        return new MPMCRing<T>(capacity);
+    }
+    static MPMCRing<T>* NewRing(std::size_t, std::false_type)
+    {
+        return NULL;
+    }
+
+    template <typename U>
+    bool BufferPush(U && t)
+    {
+        if (ring_)
+            return ring_->TryPush(std::forward<U>(t));
+
+        std::lock_guard<LFLock> lock(list_lock_);
+        if (list_.size() >= capacity_)
+            return false;
+        list_.emplace_back(std::forward<U>(t));
+        return true;
+    }
+
+    template <typename InputIt>
+    std::size_t BufferPushN(InputIt &first, std::size_t n)
+    {
+        if (ring_)
+            return ring_->TryPushN(first, n);
+
+        std::lock_guard<LFLock> lock(list_lock_);
+        std::size_t k = (std::min)(n, capacity_ - list_.size());
+        for (std::size_t i = 0; i < k; ++i, ++first)
+            list_.emplace_back(*first);
+        return k;
+    }
+
+    bool BufferEmpty()
+    {
+        if (ring_)
+            return ring_->empty();
+
+        std::lock_guard<LFLock> lock(list_lock_);
+        return list_.empty();
+    }
+
+    bool BufferHasRoom()
+    {
+        if (ring_)
+            return !ring_->full();
 
-            {
-                std::unique_lock<CoMutex> lock(queue_lock_);
-                t = std::move(queue_.front());
-                queue_.pop();
+        std::lock_guard<LFLock> lock(list_lock_);
+        return list_.size() < capacity_;
+    }
+
+    template <typename Sink>
+    std::size_t BufferPopN(Sink &sink, std::size_t n)
+    {
+        // sink抛出异常时, 已取出的元素(环形队列中还有抛出异常的那个)空出了位置, 唤醒等待的写者.
+        try {
+            if (ring_)
+                return ring_->TryPopN(sink, n);
+
+            std::lock_guard<LFLock> lock(list_lock_);
+            std::size_t k = 0;
+            for (; k < n && !list_.empty(); ++k) {
+                sink(std::move(list_.front()));
+                list_.pop_front();
             }
+            return k;
+        } catch (...) {
+            NotifyN(send_waiters_, n);
+            throw;
         }
+    }
 
-        // read and ignore
-        void operator>>(nullptr_t ignore)
+    enum class eWaitResult
+    {
+        retry_ok,   // 登记后的重试成功
+        notified,   // 被唤醒, 需要重新尝试
+        timeout,    // 超时
+    };
+
+    // 登记到等待队列后再重试一次, 仍失败才挂起; 与读写成功后再检查对端等待者相对应, 不会丢失唤醒.
+    template <typename F>
+    eWaitResult Wait(ChanWaitQueue &q, F const& retry, TimePoint const* deadline)
+    {
+        std::unique_ptr<ChanWaitGroup> group(new ChanWaitGroup);
+        std::unique_ptr<ChanWaiter> w(new ChanWaiter(group.get()));
         {
-            write_block_.Wakeup();
-            read_block_.CoBlockWait();
+            std::lock_guard<LFLock> lock(lock_);
+            q.Push(w.get());
+        }
 
-            {
-                std::unique_lock<CoMutex> lock(queue_lock_);
-                queue_.pop();
+        if (!retry()) {
+            DebugPrint(dbg_syncblock, "channel wait.");
+            if (!deadline) {
+                group->Wait();
+                return eWaitResult::notified;
             }
+
+            if (group->WaitUntil(*deadline))
+                return eWaitResult::notified;
+
+            // 超时: 在锁内移除节点, 此后不会再有唤醒者访问它.
+            std::lock_guard<LFLock> lock(lock_);
+            q.Erase(w.get());
+            return eWaitResult::timeout;
         }
 
-        // try write
-        template <typename U>
-        bool TryPush(U && t)
-        {
-            if (!write_block_.TryBlockWait())
-                return false;
+        if (group->TryFire(-1)) {
+            std::lock_guard<LFLock> lock(lock_);
+            q.Erase(w.get());
+            return eWaitResult::retry_ok;
+        }
 
-            {
-                std::unique_lock<CoMutex> lock(queue_lock_);
-                queue_.push(std::forward<U>(t));
-            }
+        // 已被唤醒者选中: 等它完成唤醒, 再把这次唤醒转交给其他等待者.
+        group->Wait();
+        NotifyN(q, 1);
+        return eWaitResult::retry_ok;
+    }
+
+    // 读写了n个元素后, 一次加锁唤醒至多n个等待者.
+    //   读写缓冲区时修改位置(或加锁)与这里读取等待者数量都是seq_cst的,
+    //   等待者先增加数量再重试, 因此二者至少有一方能看到对方, 不需要额外的内存屏障.
+    void NotifyN(ChanWaitQueue &q, std::size_t n)
+    {
+        if (!n || !q.HasWaiter()) return ;
+
+        ChanWaiter *chain;
+        {
+            std::lock_guard<LFLock> lock(lock_);
+            chain = q.PopFireN(n);
+        }
+        ChanWaitQueue::NotifyChain(chain);
+    }
 
-            read_block_.Wakeup();
+    // 无缓冲区时写入, block为false时没有等待的读者则返回false.
+    //   deadline不为NULL时最多等待到deadline, 超时后把右值参数的数据还给调用者.
+    template <typename U>
+    bool SyncPush(U && t, bool block, TimePoint const* deadline)
+    {
+        std::unique_lock<LFLock> lock(lock_);
+        if (ChanWaiter *w = recv_waiters_.PopFire()) {
+            static_cast<ValueWaiter*>(w)->Put(std::forward<U>(t));
+            ChanWaitGroup *group = w->group_;
+            lock.unlock();
+            group->Notify();
             return true;
         }
 
-        // try read
-        template <typename U>
-        bool TryPop(U & t)
-        {
-            write_block_.Wakeup();
-            while (!read_block_.TryBlockWait())
-                if (write_block_.TryBlockWait())
-                    return false;
-                else
-                    g_Scheduler.CoYield();
-
-            {
-                std::unique_lock<CoMutex> lock(queue_lock_);
-                t = std::move(queue_.front());
-                queue_.pop();
-            }
+        if (!block)
+            return false;
+
+        std::unique_ptr<ChanWaitGroup> group(new ChanWaitGroup);
+        std::unique_ptr<ValueWaiter> w(new ValueWaiter(group.get()));
+        w->Put(std::forward<U>(t));
+        send_waiters_.Push(w.get());
+        lock.unlock();
+
+        DebugPrint(dbg_syncblock, "channel wait for reader.");
+        if (!deadline) {
+            group->Wait();
             return true;
         }
 
-        // try read and ignore
-        bool TryPop(nullptr_t ignore)
-        {
-            write_block_.Wakeup();
-            while (!read_block_.TryBlockWait())
-                if (write_block_.TryBlockWait())
-                    return false;
-                else
-                    g_Scheduler.CoYield();
-
-            {
-                std::unique_lock<CoMutex> lock(queue_lock_);
-                queue_.pop();
-            }
+        if (group->WaitUntil(*deadline))
             return true;
+
+        lock.lock();
+        send_waiters_.Erase(w.get());
+        lock.unlock();
+        GiveBack(t, std::move(w->Value()), std::integral_constant<bool,
+                !std::is_reference<U>::value && !std::is_const<U>::value &&
+                std::is_same<typename std::decay<U>::type, T>::value>());
+        return false;
+    }
+
+    template <typename U>
+    static void GiveBack(U & dst, T && src, std::true_type) { dst = std::move(src); }
+
+    template <typename U>
+    static void GiveBack(U &, T &&, std::false_type) {}
+
+    // 无缓冲区时批量写入, 交给至多n个等待的读者, 返回写入的数量.
+    template <typename InputIt>
+    std::size_t SyncPushN(InputIt &first, std::size_t n)
+    {
+        if (!n || !recv_waiters_.HasWaiter()) return 0;
+
+        ChanWaiter *chain;
+        std::size_t k = 0;
+        {
+            std::lock_guard<LFLock> lock(lock_);
+            chain = recv_waiters_.PopFireN(n);
+            for (ChanWaiter *w = chain; w; w = static_cast<ChanWaiter*>(w->next), ++k, ++first)
+                static_cast<ValueWaiter*>(w)->Put(*first);
         }
-    };
+        ChanWaitQueue::NotifyChain(chain);
+        return k;
+    }
+
+    // 无缓冲区时读取至多n个等待的写者的数据, block为true时没有等待的写者则阻塞, 返回读取的数量.
+    //   deadline不为NULL时最多等待到deadline, 超时返回0.
+    template <typename Sink>
+    std::size_t SyncPopN(Sink &sink, std::size_t n, bool block, TimePoint const* deadline)
+    {
+        if (!n) return 0;
+
+        std::unique_lock<LFLock> lock(lock_);
+        if (ChanWaiter *chain = send_waiters_.PopFireN(n)) {
+            std::size_t k = 0;
+            for (ChanWaiter *w = chain; w; w = static_cast<ChanWaiter*>(w->next), ++k)
+                sink(std::move(static_cast<ValueWaiter*>(w)->Value()));
+            lock.unlock();
+            ChanWaitQueue::NotifyChain(chain);
+            return k;
+        }
+
+        if (!block)
+            return 0;
+
+        std::unique_ptr<ChanWaitGroup> group(new ChanWaitGroup);
+        std::unique_ptr<ValueWaiter> w(new ValueWaiter(group.get()));
+        recv_waiters_.Push(w.get());
+        lock.unlock();
+
+        DebugPrint(dbg_syncblock, "channel wait for writer.");
+        if (!deadline)
+            group->Wait();
+        else if (!group->WaitUntil(*deadline)) {
+            lock.lock();
+            recv_waiters_.Erase(w.get());
+            return 0;
+        }
+
+        sink(std::move(w->Value()));
+        return 1;
+    }
+};
+
+template <typename T>
+class Channel
+{
+private:
+    typedef ChannelImpl<T> Impl;
+    mutable std::shared_ptr<Impl> impl_;
+    friend class Select;
+
+public:
+    explicit Channel(std::size_t capacity = 0)
+    {
+        impl_.reset(new Impl(capacity));
+    }
+    ~Channel()
+    {
+    }
+
+    template <typename U>
+    Channel const& operator<<(U && t) const
+    {
+        impl_->Push(std::forward<U>(t));
+        return *this;
+    }
+
+    template <typename U>
+    Channel const& operator>>(U & t) const
+    {
+        impl_->Pop(t);
+        return *this;
+    }
+
+    Channel const& operator>>(nullptr_t ignore) const
+    {
+        impl_->Pop(ignore);
+        return *this;
+    }
+
+    template <typename U>
+    bool TryPush(U && t) const
+    {
+        return impl_->TryPush(std::forward<U>(t));
+    }
+
+    template <typename U>
+    bool TryPop(U & t) const
+    {
+        return impl_->TryPop(t);
+    }
+
+    bool TryPop(nullptr_t ignore) const
+    {
+        return impl_->TryPop(ignore);
+    }
+
+    /// ------------------------------------------------------------------------
+    // @{ 批量读写
+    //    一次CAS(或一次加锁)读写一批元素, 并一次唤醒相应数量的等待者.
+    //
+    // 写入[first, last)中的所有元素, 缓冲区满时阻塞. 使用std::make_move_iterator可以移动写入.
+    template <typename ForwardIt>
+    void PushN(ForwardIt first, ForwardIt last) const
+    {
+        impl_->PushN(first, std::distance(first, last));
+    }
+
+    // 尽量写入[first, last)中的元素, 不阻塞, 返回写入的数量(从first开始).
+    template <typename ForwardIt>
+    std::size_t TryPushN(ForwardIt first, ForwardIt last) const
+    {
+        return impl_->TryPushN(first, std::distance(first, last));
+    }
+
+    // 读取至多n个元素依次写入out, 没有元素时阻塞, 返回读取的数量.
+    template <typename OutputIt>
+    std::size_t PopN(OutputIt out, std::size_t n) const
+    {
+        typename Impl::template IteratorSink<OutputIt> sink{out};
+        return impl_->PopN(sink, n);
+    }
+
+    // 读取至多n个元素依次写入out, 不阻塞, 返回读取的数量.
+    template <typename OutputIt>
+    std::size_t TryPopN(OutputIt out, std::size_t n) const
+    {
+        typename Impl::template IteratorSink<OutputIt> sink{out};
+        return impl_->TryPopN(sink, n);
+    }
 
+    // 读取当前所有的元素依次写入out, 不阻塞, 返回读取的数量.
+    template <typename OutputIt>
+    std::size_t TryPopAll(OutputIt out) const
+    {
+        return TryPopN(out, (std::size_t)-1);
+    }
+    // }@
+    /// ------------------------------------------------------------------------
+
+    template <typename U, typename Duration>
+    bool BlockTryPush(U && t, Duration const& timeout) const
+    {
+        CoTimerMgr::TimePoint deadline = CoTimerMgr::Now() +
+            std::chrono::duration_cast<CoTimerMgr::TimePoint::duration>(timeout);
+        return impl_->Push(std::forward<U>(t), &deadline);
+    }
+
+    template <typename U, typename Duration>
+    bool BlockTryPop(U & t, Duration const& timeout) const
+    {
+        CoTimerMgr::TimePoint deadline = CoTimerMgr::Now() +
+            std::chrono::duration_cast<CoTimerMgr::TimePoint::duration>(timeout);
+        return impl_->Pop(t, &deadline);
+    }
+
+    template <typename Duration>
+    bool BlockTryPop(nullptr_t ignore, Duration const& timeout) const
+    {
+        CoTimerMgr::TimePoint deadline = CoTimerMgr::Now() +
+            std::chrono::duration_cast<CoTimerMgr::TimePoint::duration>(timeout);
+        return impl_->Pop(ignore, &deadline);
+    }
 
+    bool Unique() const
+    {
+        return impl_.unique();
+    }
 };
 
 
@@ -231,13 +763,14 @@ template <>
 class Channel<void>
 {
 private:
-    class ChannelImpl;
-    mutable std::shared_ptr<ChannelImpl> impl_;
+    typedef ChannelImpl<ChanVoid> Impl;
+    mutable std::shared_ptr<Impl> impl_;
+    friend class Select;
 
 public:
     explicit Channel(std::size_t capacity = 0)
     {
-        impl_.reset(new ChannelImpl(capacity));
+        impl_.reset(new Impl(capacity));
     }
     ~Channel()
     {
@@ -245,13 +778,13 @@ public:
 
     Channel const& operator<<(nullptr_t ignore) const
     {
-        (*impl_) << ignore;
+        impl_->Push(ignore);
         return *this;
     }
 
     Channel const& operator>>(nullptr_t ignore) const
     {
-        (*impl_) >> ignore;
+        impl_->Pop(ignore);
         return *this;
     }
 
@@ -268,92 +801,214 @@ public:
     template <typename Duration>
     bool BlockTryPush(nullptr_t ignore, Duration const& timeout) const
     {
-        int interval = 1;
-        auto begin = std::chrono::high_resolution_clock::now();
-        while (!TryPush(ignore)) {
-            auto now = std::chrono::high_resolution_clock::now();
-            if (std::chrono::duration_cast<Duration>(now - begin) >= timeout)
-                return false;
+        CoTimerMgr::TimePoint deadline = CoTimerMgr::Now() +
+            std::chrono::duration_cast<CoTimerMgr::TimePoint::duration>(timeout);
+        return impl_->Push(ignore, &deadline);
+    }
 
-            interval = std::min(32, interval << 1);
-            g_Scheduler.SleepSwitch(interval);
-        }
+    template <typename Duration>
+    bool BlockTryPop(nullptr_t ignore, Duration const& timeout) const
+    {
+        CoTimerMgr::TimePoint deadline = CoTimerMgr::Now() +
+            std::chrono::duration_cast<CoTimerMgr::TimePoint::duration>(timeout);
+        return impl_->Pop(ignore, &deadline);
+    }
+
+    bool Unique() const
+    {
+        return impl_.unique();
+    }
+};
+
+// select的一个分支
+struct SelectCase
+{
+    virtual ~SelectCase() {}
+
+    // 不阻塞地尝试完成
+    virtual bool Try() = 0;
+
+    virtual eSelectState Register(ChanWaitGroup *group, int index) = 0;
+
+    // 被唤醒者选中后完成这个分支, 有缓冲区时可能已被其他协程抢先, 返回false.
+    virtual bool Complete() = 0;
+
+    // 撤销登记, selected表示这个分支已被唤醒者选中.
+    virtual void Cancel(bool selected) = 0;
+};
+
+template <typename T, typename U>
+struct SelectRecvCase : public SelectCase
+{
+    typedef ChannelImpl<T> Impl;
+    typedef typename Impl::template AssignSink<U> Sink;
+
+    std::shared_ptr<Impl> impl_;
+    U &t_;
+    std::unique_ptr<ChanValueWaiter<T>> node_;
 
+    SelectRecvCase(std::shared_ptr<Impl> const& impl, U &t) : impl_(impl), t_(t) {}
+
+    bool Try() override
+    {
+        return impl_->TryPop(t_);
+    }
+
+    eSelectState Register(ChanWaitGroup *group, int index) override
+    {
+        Sink sink{t_};
+        return impl_->SelectRecv(group, index, node_, sink);
+    }
+
+    bool Complete() override
+    {
+        if (impl_->Capacity())
+            return Try();
+
+        // 无缓冲区时写者已把数据放入等待节点
+        Sink sink{t_};
+        sink(std::move(node_->Value()));
         return true;
     }
 
-    template <typename Duration>
-    bool BlockTryPop(nullptr_t ignore, Duration const& timeout) const
+    void Cancel(bool) override
     {
-        int interval = 1;
-        auto begin = std::chrono::high_resolution_clock::now();
-        while (!TryPop(ignore)) {
-            auto now = std::chrono::high_resolution_clock::now();
-            if (std::chrono::duration_cast<Duration>(now - begin) >= timeout)
-                return false;
+        if (!node_) return ;
+        impl_->SelectCancel(false, node_.get());
+        node_.reset();
+    }
+};
 
-            interval = std::min(32, interval << 1);
-            g_Scheduler.SleepSwitch(interval);
-        }
+template <typename T>
+struct SelectSendCase : public SelectCase
+{
+    typedef ChannelImpl<T> Impl;
 
+    std::shared_ptr<Impl> impl_;
+    T t_;
+    std::unique_ptr<ChanValueWaiter<T>> node_;
+
+    template <typename U>
+    SelectSendCase(std::shared_ptr<Impl> const& impl, U && t)
+        : impl_(impl), t_(std::forward<U>(t)) {}
+
+    bool Try() override
+    {
+        return impl_->TryPush(std::move(t_));
+    }
+
+    eSelectState Register(ChanWaitGroup *group, int index) override
+    {
+        return impl_->SelectSend(group, index, node_, t_);
+    }
+
+    bool Complete() override
+    {
+        if (impl_->Capacity())
+            return Try();
+
+        // 无缓冲区时读者已从等待节点取走数据
         return true;
     }
 
-    bool Unique() const
+    void Cancel(bool selected) override
     {
-        return impl_.unique();
+        if (!node_) return ;
+        impl_->SelectCancel(true, node_.get());
+        if (!impl_->Capacity() && !selected)
+            t_ = std::move(node_->Value());     // 没有被读者取走, 还回来.
+        node_.reset();
     }
+};
 
-private:
-    class ChannelImpl
+// 同时等待多个channel的读写, 完成其中一个
+//   例:
+//     co_select sel;
+//     int a;
+//     sel.Recv(ch1, a);                        // 分支0
+//     sel.Send(ch2, std::string("hello"));     // 分支1
+//     switch (sel.Wait(std::chrono::milliseconds(100))) {
+//         case 0: ...; break;     // 从ch1读到了a
+//         case 1: ...; break;     // 已写入ch2
+//         default: ...; break;    // 超时
+//     }
+//
+//   按添加的顺序检查各分支, 都没有就绪时在所有channel上登记同一个ChanWaitGroup后挂起,
+//   第一个唤醒者以TryFire选中它, 因此只会完成一个分支, 其余分支的数据不受影响.
+//   同一个无缓冲的channel不能同时用于读分支和写分支, 否则会与自己的登记交接而不停重试.
+//   每个Select对象只用于一次Wait(TryWait).
+class Select
+{
+public:
+    Select() = default;
+    Select(Select const&) = delete;
+    Select& operator=(Select const&) = delete;
+
+    // 添加读分支, 返回分支的序号.
+    template <typename T, typename U>
+    int Recv(Channel<T> const& ch, U & t)
     {
-        BlockObject write_block_;
-        BlockObject read_block_;
+        cases_.emplace_back(new SelectRecvCase<T, U>(ch.impl_, t));
+        return (int)cases_.size() - 1;
+    }
 
-    public:
-        explicit ChannelImpl(std::size_t capacity)
-            : write_block_(capacity)
-        {}
+    // 添加读分支, 丢弃读出的数据.
+    template <typename T>
+    int Recv(Channel<T> const& ch, std::nullptr_t)
+    {
+        cases_.emplace_back(new SelectRecvCase<T, std::nullptr_t>(ch.impl_, ignore_));
+        return (int)cases_.size() - 1;
+    }
 
-        // write
-        void operator<<(nullptr_t ignore)
-        {
-            write_block_.CoBlockWait();
-            read_block_.Wakeup();
-        }
+    int Recv(Channel<void> const& ch, std::nullptr_t)
+    {
+        cases_.emplace_back(new SelectRecvCase<ChanVoid, std::nullptr_t>(ch.impl_, ignore_));
+        return (int)cases_.size() - 1;
+    }
 
-        // read and ignore
-        void operator>>(nullptr_t ignore)
-        {
-            write_block_.Wakeup();
-            read_block_.CoBlockWait();
-        }
+    // 添加写分支, 返回分支的序号. t被复制(移动)到分支中, 只有这个分支完成时才会被取走.
+    template <typename T, typename U>
+    int Send(Channel<T> const& ch, U && t)
+    {
+        cases_.emplace_back(new SelectSendCase<T>(ch.impl_, std::forward<U>(t)));
+        return (int)cases_.size() - 1;
+    }
 
-        // try write
-        bool TryPush(nullptr_t ignore)
-        {
-            if (!write_block_.TryBlockWait())
-                return false;
+    int Send(Channel<void> const& ch, std::nullptr_t)
+    {
+        cases_.emplace_back(new SelectSendCase<ChanVoid>(ch.impl_, nullptr));
+        return (int)cases_.size() - 1;
+    }
 
-            read_block_.Wakeup();
-            return true;
-        }
+    // 不阻塞, 返回完成的分支的序号, 没有就绪的分支时返回-1.
+    int TryWait();
 
-        // try read and ignore
-        bool TryPop(nullptr_t ignore)
-        {
-            write_block_.Wakeup();
-            while (!read_block_.TryBlockWait())
-                if (write_block_.TryBlockWait())
-                    return false;
-                else
-                    g_Scheduler.CoYield();
+    // 阻塞直到完成一个分支, 返回它的序号. 没有分支时返回-1.
+    int Wait()
+    {
+        return DoWait(NULL);
+    }
 
-            return true;
-        }
-    };
+    // 最多等待timeout, 超时返回-1.
+    template <typename Duration>
+    int Wait(Duration const& timeout)
+    {
+        CoTimerMgr::TimePoint deadline = CoTimerMgr::Now() +
+            std::chrono::duration_cast<CoTimerMgr::TimePoint::duration>(timeout);
+        return DoWait(&deadline);
+    }
+
+private:
+    int DoWait(CoTimerMgr::TimePoint const* deadline);
 
+    // 撤销所有分支的登记, selected为被唤醒者选中的分支.
+    void CancelAll(int selected);
 
+private:
+    std::vector<std::unique_ptr<SelectCase>> cases_;
+    std::nullptr_t ignore_ = nullptr;
 };
 
+typedef Select co_select;
+
 } //namespace co
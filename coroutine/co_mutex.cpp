@@ -1,39 +1,78 @@
 #include "co_mutex.h"
-#include "scheduler.h"
+#include "channel.h"
 #include "error.h"
 #include <assert.h>
 
 namespace co
 {
 
-CoMutex::CoMutex()
-    : block_(new BlockObject(1, 1))
-{
-}
+// 慢路径加锁前自旋等待的次数, 持有者在其他线程上很快解锁时可以免去挂起.
+static const int kCoMutexSpinCount = 32;
 
-CoMutex::~CoMutex()
+CoMutexCore::~CoMutexCore()
 {
+    assert(waiters_.empty());
 }
 
-void CoMutex::lock()
+void CoMutexCore::lock_slow(bool handoff)
 {
-    block_->CoBlockWait();
-}
+    for (int i = 0; i < kCoMutexSpinCount; ++i) {
+        CpuRelax();
+        if (state_.load(std::memory_order_relaxed) == 0 && try_lock())
+            return ;
+    }
 
-bool CoMutex::try_lock()
-{
-    return block_->TryBlockWait();
-}
+    for (;;) {
+        std::unique_lock<LFLock> lock(lock_);
 
-bool CoMutex::is_lock()
-{
-    return !block_->IsWakeup();
+        // 标记有等待者, 恰好已解锁时直接加锁.
+        //   还有其他等待者时(抢占策略下被唤醒者重新竞争)保持2, 以免解锁时漏掉唤醒.
+        uint32_t s = state_.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t desired = s ? 2 : (waiters_.empty() ? 1 : 2);
+            if (s == 2 || state_.compare_exchange_weak(s, desired,
+                        std::memory_order_acquire, std::memory_order_relaxed))
+                break;
+        }
+        if (s == 0)
+            return ;
+
+        std::unique_ptr<ChanWaitGroup> group(new ChanWaitGroup);
+        std::unique_ptr<ChanWaiter> node(new ChanWaiter(group.get()));
+        waiters_.push(node.get());
+        lock.unlock();
+        DebugPrint(dbg_syncblock, "co_mutex wait.");
+        group->Wait();
+
+        // 直接转交时醒来即已持有锁
+        if (handoff)
+            return ;
+    }
 }
 
-void CoMutex::unlock()
+void CoMutexCore::unlock_slow(bool handoff)
 {
-    if (!block_->Wakeup())
+    std::unique_lock<LFLock> lock(lock_);
+    if (state_.load(std::memory_order_relaxed) == 0) {
+        lock.unlock();
         ThrowError(eCoErrorCode::ec_mutex_double_unlock);
+    }
+
+    if (!handoff)
+        state_.store(0, std::memory_order_release);
+
+    ChanWaiter *w = static_cast<ChanWaiter*>(waiters_.pop());
+    if (handoff) {
+        // 锁保持占用, 转交给w; 没有等待者时才真正解锁.
+        if (!w)
+            state_.store(0, std::memory_order_release);
+        else if (waiters_.empty())
+            state_.store(1, std::memory_order_relaxed);
+    }
+
+    lock.unlock();
+    if (w)
+        ChanWaitQueue::NotifyChain(w);
 }
 
 } //namespace co
@@ -1,25 +1,85 @@
 #pragma once
 #include <stdint.h>
-#include "block_object.h"
+#include <atomic>
+#include <memory>
+#include "ts_queue.h"
 
 namespace co
 {
 
+// 协程锁解锁时已有等待者的处理策略
+//   直接转交: 锁保持占用并交给队首的等待者, 新来者只能排队, 先来先得.
+struct CoMutexHandoff
+{
+    static const bool handoff = true;
+};
+
+//   抢占: 释放锁后唤醒队首的等待者, 它醒来后与新来者重新竞争.
+//   锁不必等待被唤醒者调度执行, 吞吐更高, 但等待者可能多次落空.
+struct CoMutexBarging
+{
+    static const bool handoff = false;
+};
+
+// 协程锁的状态和等待队列, 慢路径在co_mutex.cpp中实现.
+//   等待者(协程或协程外的线程)挂起在堆上的ChanWaitGroup上.
+struct CoMutexCore
+{
+    // 0: 未加锁, 1: 已加锁, 2: 已加锁且可能有等待者
+    std::atomic<uint32_t> state_{0};
+    LFLock lock_{eLockSite::block_object};      // 保护waiters_
+    TSQueue<TSQueueHook, false> waiters_;
+
+    ~CoMutexCore();
+
+    inline bool try_lock()
+    {
+        uint32_t expected = 0;
+        return state_.compare_exchange_strong(expected, 1, std::memory_order_acquire,
+                std::memory_order_relaxed);
+    }
+
+    void lock_slow(bool handoff);
+    void unlock_slow(bool handoff);
+};
+
 /// 协程锁
-class CoMutex
+//   无竞争时加锁、解锁各只有一次CAS; 有竞争时短暂自旋后排队挂起, 不占用CPU.
+//   拷贝的对象共享同一个锁.
+template <typename Policy>
+class BasicCoMutex
 {
-    std::shared_ptr<BlockObject> block_;
+    std::shared_ptr<CoMutexCore> core_;
 
 public:
-    CoMutex();
-    ~CoMutex();
+    BasicCoMutex() : core_(std::make_shared<CoMutexCore>()) {}
+
+    void lock()
+    {
+        if (!core_->try_lock())
+            core_->lock_slow(Policy::handoff);
+    }
+
+    bool try_lock()
+    {
+        return core_->try_lock();
+    }
+
+    bool is_lock()
+    {
+        return core_->state_.load(std::memory_order_relaxed) != 0;
+    }
 
-    void lock();
-    bool try_lock();
-    bool is_lock();
-    void unlock();
+    void unlock()
+    {
+        uint32_t expected = 1;
+        if (!core_->state_.compare_exchange_strong(expected, 0, std::memory_order_release,
+                    std::memory_order_relaxed))
+            core_->unlock_slow(Policy::handoff);
+    }
 };
 
+typedef BasicCoMutex<CoMutexHandoff> CoMutex;
 typedef CoMutex co_mutex;
 
 } //namespace co
@@ -1,13 +1,23 @@
 #include "co_rwmutex.h"
-#include "co_mutex.h"
-#include "scheduler.h"
+#include "channel.h"
+#include "error.h"
+#include <assert.h>
 
 namespace co
 {
+    // 读写锁的实现
+    //   状态和两个等待队列由lock_保护, 等待者挂起在堆上的ChanWaitGroup上, 不占用CPU.
+    //   解锁者直接把锁转交给被唤醒的等待者, 被唤醒者不必再次竞争.
+    //   阶段公平: 有写者排队时新来的读者也排队, 写者不会饿死;
+    //   写者解锁时优先一次性唤醒所有排队的读者, 没有读者时才交给下一个写者, 读者也不会饿死.
+    //   因此持有读锁时不能再次阻塞地加读锁, 否则与排队的写者死锁.
     class CoRWMutex::CoRWMutexImpl
     {
-        CoMutex mtx_;
-        std::atomic<int> readers_c_{0};
+        LFLock lock_{eLockSite::block_object};
+        int readers_c_ = 0;         // 持有读锁的数量
+        bool writer_ = false;       // 是否有写者持有锁
+        TSQueue<ChanWaiter, false> r_waiters_;
+        TSQueue<ChanWaiter, false> w_waiters_;
 
     public:
         ReadView r_view;
@@ -17,68 +27,121 @@ namespace co
             : r_view(*this), w_view(*this)
         {}
 
+        ~CoRWMutexImpl()
+        {
+            assert(r_waiters_.empty() && w_waiters_.empty());
+        }
+
         void r_lock()
         {
-            for (;;)
-            {
+            std::unique_lock<LFLock> lock(lock_);
+            if (r_can_lock()) {
                 ++readers_c_;
-                if (!mtx_.is_lock()) break ;
-                --readers_c_;
-                g_Scheduler.SleepSwitch(0);
+                return ;
             }
+
+            Wait(r_waiters_, lock);
         }
 
         bool r_try_lock()
         {
+            std::unique_lock<LFLock> lock(lock_);
+            if (!r_can_lock()) return false;
             ++readers_c_;
-            if (mtx_.is_lock()) {
-                --readers_c_;
-                return false;
-            }
-
             return true;
         }
 
         bool r_is_lock()
         {
-            return mtx_.is_lock();
+            std::unique_lock<LFLock> lock(lock_);
+            return writer_;
         }
 
         void r_unlock()
         {
+            std::unique_lock<LFLock> lock(lock_);
             int rc = --readers_c_;
             (void)rc;
             assert(rc >= 0);
+            if (readers_c_ == 0 && !w_waiters_.empty()) {
+                writer_ = true;
+                ChanWaiter *w = w_waiters_.pop();
+                lock.unlock();
+                ChanWaitQueue::NotifyChain(w);
+            }
         }
 
         void w_lock()
         {
-            mtx_.lock();
-            while (readers_c_)
-                g_Scheduler.SleepSwitch(0);
+            std::unique_lock<LFLock> lock(lock_);
+            if (w_can_lock()) {
+                writer_ = true;
+                return ;
+            }
+
+            Wait(w_waiters_, lock);
         }
 
         bool w_try_lock()
         {
-            if (!mtx_.try_lock()) return false;
-            if (readers_c_) {
-                mtx_.unlock();
-                return false;
-            }
-
+            std::unique_lock<LFLock> lock(lock_);
+            if (!w_can_lock()) return false;
+            writer_ = true;
             return true;
         }
 
         bool w_is_lock()
         {
-            return mtx_.is_lock();
+            std::unique_lock<LFLock> lock(lock_);
+            return writer_;
         }
 
         void w_unlock()
         {
-            mtx_.unlock();
+            std::unique_lock<LFLock> lock(lock_);
+            if (!writer_)
+                ThrowError(eCoErrorCode::ec_mutex_double_unlock);
+
+            ChanWaiter *chain = NULL;
+            if (!r_waiters_.empty()) {
+                // 排队的读者全部唤醒, 先在锁内计入持有数.
+                //   取出的节点经next串成链表, 直接交给NotifyChain.
+                SList<ChanWaiter> readers = r_waiters_.pop_all();
+                writer_ = false;
+                readers_c_ += (int)readers.size();
+                chain = static_cast<ChanWaiter*>(readers.head());
+            } else if (!w_waiters_.empty()) {
+                // 直接转交给下一个写者, writer_保持为true.
+                chain = w_waiters_.pop();
+            } else {
+                writer_ = false;
+            }
+
+            lock.unlock();
+            ChanWaitQueue::NotifyChain(chain);
+        }
+
+    private:
+        bool r_can_lock()
+        {
+            return !writer_ && w_waiters_.empty();
         }
 
+        bool w_can_lock()
+        {
+            return !writer_ && readers_c_ == 0;
+        }
+
+        // 排队等待解锁者转交锁, 返回时已持有锁.
+        void Wait(TSQueue<ChanWaiter, false> & q, std::unique_lock<LFLock> & lock)
+        {
+            std::unique_ptr<ChanWaitGroup> group(new ChanWaitGroup);
+            std::unique_ptr<ChanWaiter> node(new ChanWaiter(group.get()));
+            q.push(node.get());
+            lock.unlock();
+            DebugPrint(dbg_syncblock, "rwmutex wait. %s", &q == &r_waiters_ ? "reader" : "writer");
+            group->Wait();
+        }
     };
 
     CoRWMutex::ReadView::ReadView(CoRWMutexImpl & ref)
@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+
+// 协程上下文切换
+//   linux的x86-64和aarch64上默认使用汇编实现的切换(与boost.context的jump_fcontext相同),
+//   只保存callee-saved寄存器, 不保存信号掩码, 切换时没有系统调用.
+//   其他平台, 或编译时定义了CO_USE_UCONTEXT(cmake -DENABLE_FCONTEXT=OFF), 使用ucontext.
+//   库和使用者必须使用同样的定义, 否则Task的内存布局会不一致; 通过cmake目标(coroutine_static/
+//   coroutine_dynamic, 或安装后find_package(coroutine))链接时, 定义会自动传递给使用者.
+#if !defined(CO_USE_UCONTEXT) && defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+# define CO_USE_FCONTEXT 1
+#endif
+
+#if defined(CO_USE_FCONTEXT)
+extern "C" {
+
+// 挂起的上下文, 指向保存在其栈顶的寄存器.
+typedef void* co_fcontext_t;
+
+struct co_transfer_t
+{
+    co_fcontext_t fctx;     // 切换过来的上下文, 恢复它时使用
+    void *data;             // 切换时传递的参数
+};
+
+// 挂起当前上下文并切换到to, 返回值是下次切换回来时的来源上下文和参数.
+co_transfer_t co_jump_fcontext(co_fcontext_t const to, void *vp);
+
+// 在[sp - size, sp)的栈上创建一个上下文, 首次切换到它时执行fn, fn不能返回.
+co_fcontext_t co_make_fcontext(void *sp, size_t size, void (*fn)(co_transfer_t));
+
+} //extern "C"
+#else
+# include <ucontext.h>
+#endif
@@ -3,17 +3,25 @@
 #include "channel.h"
 #include "thread_pool.h"
 #include "co_rwmutex.h"
+#include "stack_pool.h"
 
 namespace co
 {
 
 struct __go
 {
+    __go() : stack_mode_(g_Scheduler.GetOptions().stack_mode) {}
+
+    explicit __go(eCoStackMode stack_mode) : stack_mode_(stack_mode) {}
+
+    // 临时的函数对象(如go [=]{...})被移动进协程中, 不会拷贝.
     template <typename Arg>
-    inline void operator-(Arg const& arg)
+    inline void operator-(Arg && arg)
     {
-        Scheduler::getInstance().CreateTask(arg);
+        Scheduler::getInstance().CreateTask(TaskF(std::forward<Arg>(arg)), stack_mode_);
     }
+
+    eCoStackMode stack_mode_;
 };
 
 // co_channel
@@ -21,9 +29,13 @@ template <typename T>
 using co_chan = Channel<T>;
 
 // co_timer_add will returns timer_id; The timer_id type is uint64_t.
+//
+// The optional slack lets the timer fire up to `slack` later than requested
+//   (never earlier), so that timers due at nearly the same time share one wakeup.
 template <typename Arg, typename F>
-inline TimerId co_timer_add(Arg const& duration_or_timepoint, F const& callback) {
-    return g_Scheduler.ExpireAt(duration_or_timepoint, callback);
+inline TimerId co_timer_add(Arg const& duration_or_timepoint, F const& callback,
+        CoTimerMgr::Slack slack = CoTimerMgr::Slack::zero()) {
+    return g_Scheduler.ExpireAt(duration_or_timepoint, callback, slack);
 }
 
 // co_timer_cancel will returns boolean type;
@@ -73,6 +85,9 @@ struct __async_wait<void>
 } //namespace co
 
 #define go ::co::__go()-
+
+// 指定协程栈的使用方式, 例如: go_stack(co::eCoStackMode::dedicated) foo;
+#define go_stack(stack_mode) ::co::__go(stack_mode)-
 #define co_yield do { g_Scheduler.CoYield(); } while (0)
 
 // (uint32_t type, uint64_t id)
@@ -80,6 +95,7 @@ struct __async_wait<void>
 #define co_wakeup(type, id) do { g_Scheduler.UserBlockWakeup(type, id); } while (0)
 
 // coroutine sleep, never blocks current thread.
+//   For sub-millisecond sleeps use g_Scheduler.SleepSwitch(std::chrono::microseconds(n)).
 #define co_sleep(milliseconds) do { g_Scheduler.SleepSwitch(milliseconds); } while (0)
 
 // co_sched
@@ -96,6 +112,9 @@ using ::co::co_wmutex;
 // co_chan
 using ::co::co_chan;
 
+// co_select
+using ::co::co_select;
+
 // co timer *
 typedef ::co::TimerId co_timer_id;
 using ::co::co_timer_add;
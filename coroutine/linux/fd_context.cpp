@@ -0,0 +1,38 @@
+#include "fd_context.h"
+
+namespace co
+{
+
+FdCtxTable& FdCtxTable::getInstance()
+{
+    static FdCtxTable *obj = new FdCtxTable;
+    return *obj;
+}
+
+FdCtxTable::FdCtxTable()
+{
+    for (auto &chunk : chunks_)
+        chunk = NULL;
+}
+
+FdCtx* FdCtxTable::Get(int fd, bool create)
+{
+    if (fd < 0 || fd >= kChunkSize * kMaxChunks)
+        return NULL;
+
+    std::atomic<FdCtx*> &slot = chunks_[fd >> kChunkBits];
+    FdCtx *chunk = slot.load(std::memory_order_acquire);
+    if (!chunk) {
+        if (!create) return NULL;
+
+        FdCtx *new_chunk = new FdCtx[kChunkSize];
+        if (slot.compare_exchange_strong(chunk, new_chunk))
+            chunk = new_chunk;
+        else
+            delete[] new_chunk;     // 其他线程已经分配, chunk已被更新为它的值.
+    }
+
+    return &chunk[fd & (kChunkSize - 1)];
+}
+
+} //namespace co
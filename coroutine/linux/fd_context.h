@@ -0,0 +1,102 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include "task.h"
+
+namespace co
+{
+
+// 每个fd的上下文
+//   fd首次需要等待时以边缘触发(EPOLLET)方式加入epoll, 直到hook的close时才移除,
+//   此后每次等待只需挂到fd的等待队列上, 不必再反复EPOLL_CTL_ADD/DEL.
+//
+// 由hook的socket/accept等创建的socket称为托管socket(managed), 创建时即置为非阻塞,
+//   用户设置的非阻塞标志和收发超时记录在这里, 读写时不必再调用fstat/fcntl/getsockopt.
+struct FdCtx
+{
+    LFLock lock{eLockSite::fd_ctx};
+    bool registered = false;                // 是否已加入epoll
+    std::atomic<uint32_t> ready_seq[2];     // 读、写方向的就绪(边缘)次数
+    TSQueue<Task, false> waiters[2];        // 读、写方向上等待中的协程, 由lock保护
+
+    std::atomic<bool> managed{false};       // 是否是托管socket
+    std::atomic<bool> user_nonblock{false}; // 用户是否设置了非阻塞
+    std::atomic<int64_t> recv_timeout_us{-1};   // SO_RCVTIMEO(微秒), -1表示不超时
+    std::atomic<int64_t> send_timeout_us{-1};   // SO_SNDTIMEO(微秒), -1表示不超时
+
+    FdCtx()
+    {
+        ready_seq[0] = ready_seq[1] = 0;
+    }
+
+    // hook的socket/accept创建fd后调用, 此时fd已是非阻塞的.
+    void OnCreate(bool nonblock)
+    {
+        OnReuse();
+        user_nonblock = nonblock;
+        recv_timeout_us = -1;
+        send_timeout_us = -1;
+        managed = true;
+    }
+
+    // dup出的fd和原fd共享同一个文件描述, 托管信息也一并复制.
+    void OnDup(FdCtx *src)
+    {
+        OnReuse();
+        if (!src || !src->managed) {
+            managed = false;
+            return ;
+        }
+
+        user_nonblock = (bool)src->user_nonblock;
+        recv_timeout_us = (int64_t)src->recv_timeout_us;
+        send_timeout_us = (int64_t)src->send_timeout_us;
+        managed = true;
+    }
+
+    // hook的pipe等创建了不托管的fd后调用.
+    void OnCreateUnmanaged()
+    {
+        OnReuse();
+        managed = false;
+    }
+
+    void OnClose()
+    {
+        managed = false;
+    }
+
+private:
+    // fd号被新的fd复用.
+    //   旧fd可能没有经过hook的close就关闭了(如fdopen后fclose, 直接发起close系统调用),
+    //   内核已将它移出epoll, registered却仍为true. 清除后下次等待时重新加入epoll.
+    void OnReuse()
+    {
+        std::unique_lock<LFLock> lock(this->lock);
+        registered = false;
+    }
+};
+
+// fd上下文表, 以fd为下标分块存储, 块一旦分配就不再释放(进程退出时也不释放),
+//   所以FdCtx的地址在进程生命期内一直有效, 可以直接作为epoll的data.ptr.
+class FdCtxTable
+{
+public:
+    static const int kChunkBits = 10;
+    static const int kChunkSize = 1 << kChunkBits;
+    static const int kMaxChunks = 1024;     // 最多支持kChunkSize * kMaxChunks个fd
+
+    // 全局唯一的表, 不会析构, 静态对象析构期间的close也可以安全访问.
+    static FdCtxTable& getInstance();
+
+    // 获取fd的上下文, create为false时不会分配新的块. fd超出范围时返回NULL.
+    FdCtx* Get(int fd, bool create = true);
+
+private:
+    FdCtxTable();
+
+    std::atomic<FdCtx*> chunks_[kMaxChunks];
+};
+
+} //namespace co
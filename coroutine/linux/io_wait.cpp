@@ -1,5 +1,9 @@
 #include "io_wait.h"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
 #include "scheduler.h"
 
 namespace co
@@ -22,9 +26,29 @@ IoWait::IoWait()
         fprintf(stderr, "CoroutineScheduler init failed. epoll create error:%s\n", strerror(errno));
         exit(1);
     }
+
+    et_epoll_fd_ = epoll_create(1024);
+    if (et_epoll_fd_ == -1) {
+        fprintf(stderr, "CoroutineScheduler init failed. epoll create error:%s\n", strerror(errno));
+        exit(1);
+    }
+
+    // poller只阻塞在读epoll上, 写epoll、边缘触发epoll和eventfd都挂在读epoll中, 以便一起唤醒.
+    // 这几个fd的data.ptr为NULL, 处理事件时跳过.
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev = {EPOLLIN, {NULL}};
+    if (event_fd_ == -1 ||
+            -1 == epoll_ctl(epoll_fds_[(int)EpollType::read], EPOLL_CTL_ADD, event_fd_, &ev) ||
+            -1 == epoll_ctl(epoll_fds_[(int)EpollType::read], EPOLL_CTL_ADD,
+                epoll_fds_[(int)EpollType::write], &ev) ||
+            -1 == epoll_ctl(epoll_fds_[(int)EpollType::read], EPOLL_CTL_ADD, et_epoll_fd_, &ev))
+    {
+        fprintf(stderr, "CoroutineScheduler init failed. eventfd error:%s\n", strerror(errno));
+        exit(1);
+    }
 }
 
-void IoWait::CoSwitch(std::vector<FdStruct> && fdsts, int timeout_ms)
+void IoWait::CoSwitch(std::vector<FdStruct> && fdsts, int64_t timeout_us)
 {
     Task* tk = g_Scheduler.GetCurrentTask();
     if (!tk) return ;
@@ -32,21 +56,174 @@ void IoWait::CoSwitch(std::vector<FdStruct> && fdsts, int timeout_ms)
     uint32_t id = ++tk->io_block_id_;
     tk->state_ = TaskState::io_block;
     tk->wait_successful_ = 0;
-    tk->io_block_timeout_ = timeout_ms;
+    tk->io_block_timeout_us_ = timeout_us;
     tk->io_block_timer_.reset();
+    tk->io_block_fd_ = -1;
     tk->wait_fds_.swap(fdsts);
     for (auto &fdst : tk->wait_fds_) {
         fdst.epoll_ptr.tk = tk;
         fdst.epoll_ptr.io_block_id = id;
     }
 
-    DebugPrint(dbg_ioblock, "task(%s) CoSwitch id=%d, nfds=%d, timeout=%d",
-            tk->DebugInfo(), id, (int)fdsts.size(), timeout_ms);
+    DebugPrint(dbg_ioblock, "task(%s) CoSwitch id=%d, nfds=%d, timeout=%lld us",
+            tk->DebugInfo(), id, (int)fdsts.size(), (long long)timeout_us);
+    g_Scheduler.CoYield();
+}
+
+uint32_t IoWait::GetReadySeq(int fd, uint32_t event)
+{
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd);
+    if (!ctx) return 0;
+    return ctx->ready_seq[(event & EPOLLIN) ? 0 : 1];
+}
+
+void IoWait::CoSwitch(int fd, uint32_t event, uint32_t ready_seq, int64_t timeout_us)
+{
+    Task* tk = g_Scheduler.GetCurrentTask();
+    if (!tk) return ;
+
+    if (!FdCtxTable::getInstance().Get(fd)) {
+        std::vector<FdStruct> fdsts(1);
+        fdsts[0].fd = fd;
+        fdsts[0].event = event;
+        CoSwitch(std::move(fdsts), timeout_us);
+        return ;
+    }
+
+    uint32_t id = ++tk->io_block_id_;
+    tk->state_ = TaskState::io_block;
+    tk->wait_successful_ = 0;
+    tk->io_block_timeout_us_ = timeout_us;
+    tk->io_block_timer_.reset();
+    tk->io_block_fd_ = fd;
+    tk->io_block_event_ = event;
+    tk->io_block_seq_ = ready_seq;
+
+    DebugPrint(dbg_ioblock, "task(%s) CoSwitch id=%d, fd=%d, event=%u, timeout=%lld us",
+            tk->DebugInfo(), id, fd, event, (long long)timeout_us);
     g_Scheduler.CoYield();
 }
 
+void IoWait::SchedulerSwitchFd(Task* tk)
+{
+    int fd = tk->io_block_fd_;
+    int dir = (tk->io_block_event_ & EPOLLIN) ? 0 : 1;
+    uint32_t id = tk->io_block_id_;
+    uint64_t task_id = tk->id_;
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd);
+
+    bool ok = true;
+    bool ready = false;
+    {
+        std::unique_lock<LFLock> lock(ctx->lock);
+        if (!ctx->registered) {
+            epoll_event ev = {EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, {(void*)ctx}};
+            if (0 == epoll_ctl(et_epoll_fd_, EPOLL_CTL_ADD, fd, &ev) ||
+                    (errno == EEXIST && 0 == epoll_ctl(et_epoll_fd_, EPOLL_CTL_MOD, fd, &ev))) {
+                ctx->registered = true;
+                DebugPrint(dbg_ioblock, "task(%s) register fd(%d) into epoll", tk->DebugInfo(), fd);
+            } else {
+                DebugPrint(dbg_ioblock, "task(%s) register fd(%d) into epoll error %d:%s",
+                        tk->DebugInfo(), fd, errno, strerror(errno));
+                ok = false;
+            }
+        }
+
+        if (ok) {
+            // syscall之后fd已经就绪过, 不必挂起.
+            if (ctx->ready_seq[dir] != tk->io_block_seq_) {
+                tk->wait_successful_ = 1;
+                ready = true;
+            } else {
+                // 定时器要在登记之前设置: 登记之后其他线程随时可能唤醒并执行这个协程.
+                if (tk->io_block_timeout_us_ != -1) {
+                    tk->IncrementRef();
+                    tk->io_block_timer_ = g_Scheduler.timer_mgr_.ExpireAt(
+                            std::chrono::microseconds(tk->io_block_timeout_us_),
+                            [=]{
+                                this->CancelFd(ctx, dir, tk, id);
+                                tk->DecrementRef();
+                            });
+                }
+                ctx->waiters[dir].push(tk);
+            }
+        }
+    }
+
+    // 解锁后tk可能已被唤醒, 只能使用局部变量.
+    DebugPrint(dbg_ioblock, "task(%d) SchedulerSwitch id=%d, fd=%d, ok=%s, ready=%s",
+            (int)task_id, id, fd, ok ? "true" : "false", ready ? "true" : "false");
+
+    if (!ok || ready)
+        g_Scheduler.AddTaskRunnable(tk);
+}
+
+void IoWait::CancelFd(FdCtx *ctx, int dir, Task *tk, uint32_t id)
+{
+    if (tk->io_block_id_ != id)
+        return ;
+
+    {
+        std::unique_lock<LFLock> lock(ctx->lock);
+        if (!ctx->waiters[dir].erase(tk))
+            return ;
+    }
+
+    DebugPrint(dbg_ioblock, "task(%s) fd(%d) io_block timeout. id=%d", tk->DebugInfo(), tk->io_block_fd_, id);
+    g_Scheduler.AddTaskRunnable(tk);
+}
+
+void IoWait::WakeupFd(FdCtx *ctx, uint32_t events)
+{
+    SList<Task> tasks[2];
+    {
+        std::unique_lock<LFLock> lock(ctx->lock);
+        if (events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            ++ctx->ready_seq[0];
+            tasks[0] = ctx->waiters[0].pop_all();
+        }
+        if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            ++ctx->ready_seq[1];
+            tasks[1] = ctx->waiters[1].pop_all();
+        }
+    }
+
+    for (auto &list : tasks) {
+        for (auto it = list.begin(); it != list.end();) {
+            Task *tk = &*it;
+            it = list.erase(it);
+            tk->wait_successful_ = 1;
+            DebugPrint(dbg_ioblock, "task(%s) fd(%d) ready, events=%u",
+                    tk->DebugInfo(), tk->io_block_fd_, events);
+            g_Scheduler.AddTaskRunnable(tk);
+        }
+    }
+}
+
+void IoWait::CloseFd(int fd)
+{
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd, false);
+    if (!ctx) return ;
+
+    {
+        std::unique_lock<LFLock> lock(ctx->lock);
+        if (!ctx->registered) return ;
+        epoll_ctl(et_epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+        ctx->registered = false;
+        DebugPrint(dbg_ioblock, "unregister fd(%d) from epoll", fd);
+    }
+
+    // 唤醒所有等待者, 它们重新调用syscall时会得到EBADF.
+    WakeupFd(ctx, EPOLLIN | EPOLLOUT);
+}
+
 void IoWait::SchedulerSwitch(Task* tk)
 {
+    if (tk->io_block_fd_ != -1) {
+        SchedulerSwitchFd(tk);
+        return ;
+    }
+
     bool ok = false;
     std::unique_lock<LFLock> lock(tk->io_block_lock_, std::defer_lock);
     if (tk->wait_fds_.size() > 1)
@@ -96,8 +273,8 @@ void IoWait::SchedulerSwitch(Task* tk)
                 tk->DebugInfo(), fdst.fd, fdst.event);
     }
 
-    DebugPrint(dbg_ioblock, "task(%s) SchedulerSwitch id=%d, nfds=%d, timeout=%d, ok=%s",
-            tk->DebugInfo(), id, (int)tk->wait_fds_.size(), tk->io_block_timeout_,
+    DebugPrint(dbg_ioblock, "task(%s) SchedulerSwitch id=%d, nfds=%d, timeout=%lld us, ok=%s",
+            tk->DebugInfo(), id, (int)tk->wait_fds_.size(), (long long)tk->io_block_timeout_us_,
             ok ? "true" : "false");
 
     if (!ok) {
@@ -105,11 +282,11 @@ void IoWait::SchedulerSwitch(Task* tk)
             g_Scheduler.AddTaskRunnable(tk);
         }
     }
-    else if (tk->io_block_timeout_ != -1) {
+    else if (tk->io_block_timeout_us_ != -1) {
         // set timer.
         tk->IncrementRef();
         uint64_t task_id = tk->id_;
-        auto timer_id = timer_mgr_.ExpireAt(std::chrono::milliseconds(tk->io_block_timeout_),
+        auto timer_id = g_Scheduler.timer_mgr_.ExpireAt(std::chrono::microseconds(tk->io_block_timeout_us_),
                 [=]{ 
                     DebugPrint(dbg_ioblock, "task(%d) syscall timeout", (int)task_id);
                     this->Cancel(tk, id);
@@ -149,39 +326,57 @@ void IoWait::Cancel(Task *tk, uint32_t id)
     }
 }
 
-int IoWait::WaitLoop()
+// 以微秒精度阻塞等待epoll事件.
+//   内核支持epoll_pwait2(5.11)时用它, 否则退回epoll_wait, 等待时间向上取整到毫秒.
+static int EpollWaitUs(int epfd, epoll_event *evs, int maxevents, int64_t wait_us)
 {
-    int c = 0;
-    for (;;) {
-        std::list<CoTimerPtr> timers;
-        timer_mgr_.GetExpired(timers, 128);
-        if (timers.empty())
-            break;
-
-        c += timers.size();
-        // 此处暂存callback而不是Task*，是为了block_cancel能够真实有效。
-        std::unique_lock<LFLock> lock(timeout_list_lock_);
-        timeout_list_.merge(std::move(timers));
+    if (wait_us <= 0)
+        return epoll_wait(epfd, evs, maxevents, wait_us < 0 ? -1 : 0);
+
+#if defined(SYS_epoll_pwait2)
+    static std::atomic<bool> s_no_pwait2{false};
+    if (!s_no_pwait2.load(std::memory_order_relaxed)) {
+        timespec ts;
+        ts.tv_sec = (time_t)(wait_us / 1000000);
+        ts.tv_nsec = (long)(wait_us % 1000000) * 1000;
+        int n = (int)syscall(SYS_epoll_pwait2, epfd, evs, maxevents, &ts, NULL, 0);
+        if (n != -1 || errno != ENOSYS)
+            return n;
+
+        s_no_pwait2.store(true, std::memory_order_relaxed);
     }
+#endif
+
+    return epoll_wait(epfd, evs, maxevents,
+            (int)(std::min<int64_t>)((wait_us + 999) / 1000, INT_MAX));
+}
 
+int IoWait::WaitLoop(int64_t wait_us)
+{
     std::unique_lock<LFLock> lock(epoll_lock_, std::defer_lock);
     if (!lock.try_lock())
-        return c ? c : -1;
+        return -1;
 
     static epoll_event evs[1024];
     int epoll_n = 0;
     for (int epoll_type = 0; epoll_type < 2; ++epoll_type)
     {
+        // 只有读epoll允许阻塞, 写epoll挂在读epoll中, 就绪时一样可以唤醒.
+        int64_t timeout = (epoll_type == (int)EpollType::read) ? wait_us : 0;
 retry:
-        int n = epoll_wait(epoll_fds_[epoll_type], evs, 1024, 0);
+        int n = EpollWaitUs(epoll_fds_[epoll_type], evs, 1024, timeout);
         if (n == -1 && errno == EAGAIN)
             goto retry;
+        if (n == -1)
+            n = 0;
 
-        epoll_n += n;
         DebugPrint(dbg_scheduler, "do epoll(%d) event, n = %d", epoll_type, n);
         for (int i = 0; i < n; ++i)
         {
             EpollPtr* ep = (EpollPtr*)evs[i].data.ptr;
+            if (!ep) continue;  // eventfd or write epoll.
+
+            ++epoll_n;
             ep->revent = evs[i].events;
             Task* tk = ep->tk;
             ++tk->wait_successful_;
@@ -196,26 +391,50 @@ retry:
         Cancel(st.tk, st.id);
     epollwait_tasks_.clear();
 
-    std::list<CoTimerPtr> timeout_list;
+    // 边缘触发方式注册的fd
     {
-        std::unique_lock<LFLock> lock(timeout_list_lock_);
-        timeout_list_.swap(timeout_list);
-    }
+retry_et:
+        int n = epoll_wait(et_epoll_fd_, evs, 1024, 0);
+        if (n == -1 && errno == EAGAIN)
+            goto retry_et;
+        if (n == -1)
+            n = 0;
 
-    for (auto &cb : timeout_list)
-        (*cb)();
+        DebugPrint(dbg_scheduler, "do epoll(et) event, n = %d", n);
+        epoll_n += n;
+        for (int i = 0; i < n; ++i)
+            WakeupFd((FdCtx*)evs[i].data.ptr, evs[i].events);
+    }
 
     // 由于epoll_wait的结果中会残留一些未计数的Task*,
-    //     epoll的性质决定了这些Task无法计数, 
-    //     所以这个析构的操作一定要在epoll_lock的保护中做
-    Task::DeleteList delete_list;
-    Task::SwapDeleteList(delete_list);
-    for (auto &tk : delete_list) {
-        DebugPrint(dbg_task, "task(%s) delete.", tk->DebugInfo());
-        delete tk;
-    }
+    //     epoll的性质决定了这些Task无法计数,
+    //     所以在epoll_lock的保护中处理完本轮结果后才推进epoch, 此前退休的Task才可以回收.
+    TaskPool::getInstance().AdvanceEpoch();
+
+    return epoll_n;
+}
+
+bool IoWait::BeginPoll()
+{
+    bool expected = false;
+    return polling_.compare_exchange_strong(expected, true);
+}
+
+void IoWait::EndPoll()
+{
+    eventfd_t val;
+    while (0 == eventfd_read(event_fd_, &val)) ;
+    polling_ = false;
+    interrupted_ = false;
+}
+
+void IoWait::Interrupt()
+{
+    if (!polling_ || interrupted_.exchange(true))
+        return ;
 
-    return epoll_n + c;
+    DebugPrint(dbg_scheduler_sleep, "interrupt epoll_wait");
+    eventfd_write(event_fd_, 1);
 }
 
 int IoWait::ChooseEpoll(uint32_t event)
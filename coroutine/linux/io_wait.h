@@ -76,6 +76,7 @@ runnable *          v
 #include <list>
 #include <set>
 #include "task.h"
+#include "fd_context.h"
 
 namespace co
 {
@@ -86,16 +87,48 @@ public:
     IoWait();
 
     // 在协程中调用的switch, 暂存状态并yield
-    void CoSwitch(std::vector<FdStruct> && fdsts, int timeout_ms);
+    //   timeout_us: 超时时间(微秒), -1表示不超时.
+    void CoSwitch(std::vector<FdStruct> && fdsts, int64_t timeout_us);
+
+    // @{ 以边缘触发方式等待单个fd, fd只在首次等待时加入epoll, hook的close时才移除.
+    //    调用syscall前先用GetReadySeq取得就绪计数, syscall返回EAGAIN后再调用CoSwitch挂起,
+    //    如果这期间fd已经就绪过, 则不会挂起.
+    //    fd超出上下文表的范围时, 退化为临时加入epoll的方式等待.
+    uint32_t GetReadySeq(int fd, uint32_t event);
+    void CoSwitch(int fd, uint32_t event, uint32_t ready_seq, int64_t timeout_us);
+
+    // fd即将被关闭, 从epoll中移除并唤醒在其上等待的协程.
+    void CloseFd(int fd);
+    // }@
 
     // 在调度器中调用的switch, 如果成功则进入等待队列，如果失败则重新加回runnable队列
     void SchedulerSwitch(Task* tk);
 
-    int WaitLoop();
+    // 处理已就绪的IO事件, 超时由调度器的定时器处理.
+    //   wait_us(微秒)大于0时阻塞等待IO事件, 只有通过BeginPoll成为poller的线程才能阻塞.
+    int WaitLoop(int64_t wait_us = 0);
+
+    // @{ 同一时刻只允许一个线程(poller)阻塞在epoll_wait中.
+    //    BeginPoll返回false表示已有其他线程在阻塞等待.
+    bool BeginPoll();
+    void EndPoll();
+
+    // 打断poller的阻塞等待, 没有poller时什么也不做.
+    void Interrupt();
+    // }@
 
 private:
     void Cancel(Task *tk, uint32_t id);
 
+    // 以边缘触发方式等待单个fd的SchedulerSwitch
+    void SchedulerSwitchFd(Task* tk);
+
+    // 等待fd超时
+    void CancelFd(FdCtx *ctx, int dir, Task *tk, uint32_t id);
+
+    // 处理fd就绪事件, 唤醒对应方向上等待的协程
+    void WakeupFd(FdCtx *ctx, uint32_t events);
+
     int ChooseEpoll(uint32_t event);
 
     struct EpollWaitSt
@@ -109,11 +142,12 @@ private:
     };
 
     int epoll_fds_[2];
-    LFLock epoll_lock_;
+    int et_epoll_fd_;                       // 边缘触发方式长期注册fd的epoll, 同样挂在读epoll中
+    int event_fd_;                          // 用于打断阻塞中的epoll_wait
+    std::atomic<bool> polling_{false};      // 是否有线程(poller)正在或即将阻塞等待
+    std::atomic<bool> interrupted_{false};  // 本次阻塞等待是否已被打断过
+    LFLock epoll_lock_{eLockSite::io_wait};
     std::set<EpollWaitSt> epollwait_tasks_;
-    std::list<CoTimerPtr> timeout_list_;
-    LFLock timeout_list_lock_;
-    CoTimerMgr timer_mgr_;
 
     typedef TSQueue<Task> TaskList;
     TaskList wait_tasks_;
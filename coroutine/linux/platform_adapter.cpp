@@ -1,4 +1,9 @@
 #include "platform_adapter.h"
+#include <unistd.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 
 namespace co {
 
@@ -10,4 +15,68 @@ ProcesserRunGuard::~ProcesserRunGuard()
 {
 }
 
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+
+bool FutexWait(std::atomic<uint32_t> *addr, uint32_t val, int64_t timeout_us)
+{
+    timespec ts, *pts = NULL;
+    if (timeout_us >= 0) {
+        ts.tv_sec = (time_t)(timeout_us / 1000000);
+        ts.tv_nsec = (long)(timeout_us % 1000000) * 1000;
+        pts = &ts;
+    }
+
+    return 0 == syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, val, pts, NULL, 0);
+}
+
+void FutexWake(std::atomic<uint32_t> *addr, int n)
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+uint32_t GetPageSize()
+{
+    static uint32_t page_size = sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+char* StackAlloc(uint32_t &size, bool guard_page, bool huge_page)
+{
+    uint32_t page_size = GetPageSize();
+    uint32_t guard_size = guard_page ? page_size : 0;
+    size = (size + page_size - 1) / page_size * page_size;
+    void *p = mmap(NULL, size + guard_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    if (guard_page && -1 == mprotect(p, guard_size, PROT_NONE)) {
+        munmap(p, size + guard_size);
+        return NULL;
+    }
+
+    char *stack = (char*)p + guard_size;
+#ifdef MADV_HUGEPAGE
+    if (huge_page)
+        madvise(stack, size, MADV_HUGEPAGE);
+#endif
+    return stack;
+}
+
+void StackFree(char *stack, uint32_t size, bool guard_page)
+{
+    uint32_t guard_size = guard_page ? GetPageSize() : 0;
+    munmap(stack - guard_size, size + guard_size);
+}
+
+void StackAdviseFree(char *stack, uint32_t size)
+{
+#ifdef MADV_FREE
+    if (0 == madvise(stack, size, MADV_FREE))
+        return ;
+#endif
+    // 内核不支持MADV_FREE(4.5以前)
+    madvise(stack, size, MADV_DONTNEED);
+}
+
 } //namespace co
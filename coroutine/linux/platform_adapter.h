@@ -1,4 +1,6 @@
 #pragma once
+#include <stdint.h>
+#include <atomic>
 
 #define co_thread_local thread_local
 
@@ -12,4 +14,23 @@ namespace co {
 		~ProcesserRunGuard();
 	};
 
+	// 当*addr等于val时阻塞当前线程, 直到被FutexWake唤醒或超时.
+	//   timeout_us(微秒)为-1时不超时. 返回false表示超时或值已改变.
+	bool FutexWait(std::atomic<uint32_t> *addr, uint32_t val, int64_t timeout_us);
+
+	// 唤醒最多n个阻塞在addr上的线程
+	void FutexWake(std::atomic<uint32_t> *addr, int n);
+
+	uint32_t GetPageSize();
+
+	// 分配协程栈, size向上取整到页大小并返回实际大小.
+	//   guard_page为true时栈底(低地址)多分配一个不可访问的保护页, 栈溢出时立即触发SIGSEGV.
+	//   huge_page为true时建议内核使用透明大页.
+	//   返回可用栈空间的起始地址, 失败时返回NULL.
+	char* StackAlloc(uint32_t &size, bool guard_page = true, bool huge_page = false);
+	void StackFree(char *stack, uint32_t size, bool guard_page = true);
+
+	// 栈内存暂不使用, 物理页可由内核在内存紧张时回收(MADV_FREE), 再次写入时无需系统调用.
+	void StackAdviseFree(char *stack, uint32_t size);
+
 } //namespace co
@@ -4,14 +4,104 @@
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdarg.h>
 #include <assert.h>
+#include <limits.h>
+#include <chrono>
 #include "scheduler.h"
+#include "fd_context.h"
 using namespace co;
 
 namespace co {
     void coroutine_hook_init();
 }
 
+// SO_RCVTIMEO, SO_SNDTIMEO和select的超时转为微秒, 全为0时返回-1(不超时).
+static int64_t timeval_to_us(const struct timeval *tv)
+{
+    if (tv->tv_sec <= 0 && tv->tv_usec <= 0)
+        return -1;
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+// 以poll等待的方式模拟阻塞调用, 用于非协程中或加入epoll失败时.
+template <typename OriginF, typename ... Args>
+static ssize_t poll_mode(int fd, OriginF fn, uint32_t event, int64_t timeout_us, Args && ... args)
+{
+    // 就绪后可能被其他读者抢先、poll也可能被信号打断, 重试时只等待剩余的时间.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+    for (;;) {
+        ssize_t n = fn(fd, std::forward<Args>(args)...);
+        if (n != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return n;
+
+        // poll只支持毫秒, 向上取整.
+        int timeout_ms = -1;
+        if (timeout_us >= 0) {
+            int64_t left_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            if (left_us <= 0) {
+                errno = EAGAIN;
+                return -1;
+            }
+            timeout_ms = (int)std::min<int64_t>((left_us + 999) / 1000, INT_MAX);
+        }
+
+        struct pollfd pfd = {fd, (short)((event & EPOLLIN) ? POLLIN : POLLOUT), 0};
+        int r = poll(&pfd, 1, timeout_ms);
+        if (r == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (r == -1 && errno != EINTR)
+            return -1;
+    }
+}
+
+// 托管socket的读写: fd已是非阻塞的, 非阻塞标志和超时都从FdCtx中取得,
+//   快速路径上只有一次真正的syscall.
+template <typename OriginF, typename ... Args>
+static ssize_t managed_mode(FdCtx *ctx, Task *tk, int fd, OriginF fn, const char* hook_fn_name, uint32_t event, int timeout_so, Args && ... args)
+{
+    if (ctx->user_nonblock)
+        return fn(fd, std::forward<Args>(args)...);
+
+    int64_t timeout_us = (timeout_so == SO_RCVTIMEO) ? ctx->recv_timeout_us : ctx->send_timeout_us;
+    if (!tk)
+        return poll_mode(fd, fn, event, timeout_us, std::forward<Args>(args)...);
+
+    uint32_t ready_seq = g_Scheduler.GetIOReadySeq(fd, event);
+    ssize_t n = fn(fd, std::forward<Args>(args)...);
+    while (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        g_Scheduler.IOBlockSwitch(fd, event, timeout_us, ready_seq);
+        bool is_timeout = false;
+        if (tk->io_block_timer_) {
+            is_timeout = true;
+            if (g_Scheduler.BlockCancelTimer(tk->io_block_timer_)) {
+                is_timeout = false;
+                tk->DecrementRef(); // timer use ref.
+            }
+        }
+
+        if (tk->wait_successful_ == 0) {
+            if (is_timeout) {
+                errno = EAGAIN;
+                return -1;
+            } else {
+                return poll_mode(fd, fn, event, timeout_us, std::forward<Args>(args)...);
+            }
+        }
+
+        DebugPrint(dbg_hook, "continue task(%s) %s. fd=%d", g_Scheduler.GetCurrentTaskDebugInfo(), hook_fn_name, fd);
+        ready_seq = g_Scheduler.GetIOReadySeq(fd, event);
+        n = fn(fd, std::forward<Args>(args)...);
+    }
+    return n;
+}
+
 template <typename OriginF, typename ... Args>
 static ssize_t read_write_mode(int fd, OriginF fn, const char* hook_fn_name, uint32_t event, int timeout_so, Args && ... args)
 {
@@ -19,6 +109,11 @@ static ssize_t read_write_mode(int fd, OriginF fn, const char* hook_fn_name, uin
     DebugPrint(dbg_hook, "task(%s) hook %s. %s coroutine.",
             tk ? tk->DebugInfo() : "nil", hook_fn_name, g_Scheduler.IsCoroutine() ? "In" : "Not in");
 
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd, false);
+    if (ctx && ctx->managed)
+        return managed_mode(ctx, tk, fd, fn, hook_fn_name, event, timeout_so, std::forward<Args>(args)...);
+
+    // 不是由hook创建的fd, 只能逐次查询fd的类型和标志.
     if (!tk)
         return fn(fd, std::forward<Args>(args)...);
 
@@ -37,44 +132,50 @@ static ssize_t read_write_mode(int fd, OriginF fn, const char* hook_fn_name, uin
         return fn(fd, std::forward<Args>(args)...);
 
     DebugPrint(dbg_hook, "task(%s) real hook %s fd=%d", tk->DebugInfo(), hook_fn_name, fd);
+    uint32_t ready_seq = g_Scheduler.GetIOReadySeq(fd, event);
     ssize_t n = fn(fd, std::forward<Args>(args)...);
     if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
         // get timeout option.
-        int timeout_ms = -1;
+        int64_t timeout_us = -1;
         struct timeval timeout;
         socklen_t timeout_blen = sizeof(timeout);
         if (0 == getsockopt(fd, SOL_SOCKET, timeout_so, &timeout, &timeout_blen)) {
-            if (timeout.tv_sec > 0 || timeout.tv_usec > 0) {
-                timeout_ms = timeout.tv_sec * 1000 + timeout.tv_usec / 1000;
-                DebugPrint(dbg_hook, "hook task(%s) %s timeout=%dms. fd=%d",
-                        g_Scheduler.GetCurrentTaskDebugInfo(), hook_fn_name, timeout_ms, fd);
-            }
+            timeout_us = timeval_to_us(&timeout);
+            if (timeout_us != -1)
+                DebugPrint(dbg_hook, "hook task(%s) %s timeout=%lldus. fd=%d",
+                        g_Scheduler.GetCurrentTaskDebugInfo(), hook_fn_name, (long long)timeout_us, fd);
         }
 
         // add into epoll, and switch other context.
-        g_Scheduler.IOBlockSwitch(fd, event, timeout_ms);
-        bool is_timeout = false;
-        if (tk->io_block_timer_) {
-            is_timeout = true;
-            if (g_Scheduler.BlockCancelTimer(tk->io_block_timer_)) {
-                is_timeout = false;
-                tk->DecrementRef(); // timer use ref.
+        // 边缘触发方式下, 唤醒后数据可能已被其他协程取走, 此时重新等待下一次就绪.
+        for (;;) {
+            g_Scheduler.IOBlockSwitch(fd, event, timeout_us, ready_seq);
+            bool is_timeout = false;
+            if (tk->io_block_timer_) {
+                is_timeout = true;
+                if (g_Scheduler.BlockCancelTimer(tk->io_block_timer_)) {
+                    is_timeout = false;
+                    tk->DecrementRef(); // timer use ref.
+                }
             }
-        }
 
-        if (tk->wait_successful_ == 0) {
-            if (is_timeout) {
-                fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
-                errno = EAGAIN;
-                return -1;
-            } else {
-                fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
-                return fn(fd, std::forward<Args>(args)...);
+            if (tk->wait_successful_ == 0) {
+                if (is_timeout) {
+                    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+                    errno = EAGAIN;
+                    return -1;
+                } else {
+                    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+                    return fn(fd, std::forward<Args>(args)...);
+                }
             }
-        }
 
-        DebugPrint(dbg_hook, "continue task(%s) %s. fd=%d", g_Scheduler.GetCurrentTaskDebugInfo(), hook_fn_name, fd);
-        n = fn(fd, std::forward<Args>(args)...);
+            DebugPrint(dbg_hook, "continue task(%s) %s. fd=%d", g_Scheduler.GetCurrentTaskDebugInfo(), hook_fn_name, fd);
+            ready_seq = g_Scheduler.GetIOReadySeq(fd, event);
+            n = fn(fd, std::forward<Args>(args)...);
+            if (n != -1 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                break;
+        }
     } else {
         DebugPrint(dbg_hook, "task(%s) syscall(%s) completed immediately. fd=%d",
                 g_Scheduler.GetCurrentTaskDebugInfo(), hook_fn_name, fd);
@@ -91,6 +192,34 @@ extern "C" {
 typedef int(*connect_t)(int, const struct sockaddr *, socklen_t);
 static connect_t connect_f = NULL;
 
+typedef int(*close_t)(int);
+static close_t close_f = NULL;
+
+typedef int(*socket_t)(int domain, int type, int protocol);
+static socket_t socket_f = NULL;
+
+typedef int(*socketpair_t)(int domain, int type, int protocol, int sv[2]);
+static socketpair_t socketpair_f = NULL;
+
+typedef int(*fcntl_t)(int fd, int cmd, ...);
+static fcntl_t fcntl_f = NULL;
+
+typedef int(*ioctl_t)(int fd, unsigned long request, ...);
+static ioctl_t ioctl_f = NULL;
+
+typedef int(*setsockopt_t)(int sockfd, int level, int optname,
+        const void *optval, socklen_t optlen);
+static setsockopt_t setsockopt_f = NULL;
+
+typedef int(*dup_t)(int);
+static dup_t dup_f = NULL;
+
+typedef int(*dup2_t)(int, int);
+static dup2_t dup2_f = NULL;
+
+typedef int(*dup3_t)(int, int, int);
+static dup3_t dup3_f = NULL;
+
 typedef ssize_t(*read_t)(int, void *, size_t);
 static read_t read_f = NULL;
 
@@ -130,8 +259,14 @@ typedef int(*select_t)(int nfds, fd_set *readfds, fd_set *writefds,
         fd_set *exceptfds, struct timeval *timeout);
 static select_t select_f = NULL;
 
-typedef int(*accept_t)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
-static accept_t accept_f = NULL;
+typedef int(*accept4_t)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+static accept4_t accept4_f = NULL;
+
+typedef int(*pipe_t)(int pipefd[2]);
+static pipe_t pipe_f = NULL;
+
+typedef int(*pipe2_t)(int pipefd[2], int flags);
+static pipe2_t pipe2_f = NULL;
 
 typedef unsigned int(*sleep_t)(unsigned int seconds);
 static sleep_t sleep_f = NULL;
@@ -139,12 +274,92 @@ static sleep_t sleep_f = NULL;
 typedef int(*nanosleep_t)(const struct timespec *req, struct timespec *rem);
 static nanosleep_t nanosleep_f = NULL;
 
+// hook创建的socket已是非阻塞的, 记录用户设置的非阻塞标志.
+static void on_socket_created(int fd, bool nonblock)
+{
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd);
+    if (ctx) {
+        ctx->OnCreate(nonblock);
+        return ;
+    }
+
+    // fd超出上下文表的范围, 不托管, 还原为用户期望的阻塞模式.
+    if (!nonblock)
+        fcntl_f(fd, F_SETFL, fcntl_f(fd, F_GETFL) & ~O_NONBLOCK);
+}
+
+// 不托管的fd复用了原先托管socket的fd号时, 清除残留的托管信息.
+static void on_fd_created_unmanaged(int fd)
+{
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd, false);
+    if (ctx)
+        ctx->OnCreateUnmanaged();
+}
+
+static void on_fd_dup(int oldfd, int newfd)
+{
+    FdCtx *ctx = FdCtxTable::getInstance().Get(newfd);
+    if (ctx)
+        ctx->OnDup(FdCtxTable::getInstance().Get(oldfd, false));
+}
+
+static void on_fd_close(int fd)
+{
+    g_Scheduler.IOBlockClose(fd);
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd, false);
+    if (ctx)
+        ctx->OnClose();
+}
+
+static int managed_connect(FdCtx *ctx, Task *tk, int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+    if (ctx->user_nonblock)
+        return connect_f(fd, addr, addrlen);
+
+    uint32_t ready_seq = tk ? g_Scheduler.GetIOReadySeq(fd, EPOLLOUT) : 0;
+    int n = connect_f(fd, addr, addrlen);
+    if (n == 0 || errno != EINPROGRESS)
+        return n;
+
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    if (tk) {
+        // 唤醒后socket仍不可写时说明是旧的就绪事件, 继续等待.
+        do {
+            g_Scheduler.IOBlockSwitch(fd, EPOLLOUT, -1, ready_seq);
+            if (tk->wait_successful_ == 0)
+                break;
+            ready_seq = g_Scheduler.GetIOReadySeq(fd, EPOLLOUT);
+        } while (0 == poll_f(&pfd, 1, 0));
+    }
+
+    // 非协程中或加入epoll失败时, 阻塞等待连接完成.
+    if (!tk || tk->wait_successful_ == 0) {
+        while (-1 == poll_f(&pfd, 1, -1) && errno == EINTR) ;
+    }
+
+    DebugPrint(dbg_hook, "continue task(%s) connect. fd=%d", g_Scheduler.GetCurrentTaskDebugInfo(), fd);
+    int error = 0;
+    socklen_t len = sizeof(int);
+    if (-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len))
+        return -1;
+
+    if (0 == error)
+        return 0;
+
+    errno = error;
+    return -1;
+}
+
 int connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
 {
     Task* tk = g_Scheduler.GetCurrentTask();
     DebugPrint(dbg_hook, "task(%s) hook connect. %s coroutine.",
             tk ? tk->DebugInfo() : "nil", g_Scheduler.IsCoroutine() ? "In" : "Not in");
 
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd, false);
+    if (ctx && ctx->managed)
+        return managed_connect(ctx, tk, fd, addr, addrlen);
+
     if (!tk) {
         return connect_f(fd, addr, addrlen);
     } else {
@@ -155,6 +370,7 @@ int connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
         if (-1 == fcntl(fd, F_SETFL, flags | O_NONBLOCK))
             return connect_f(fd, addr, addrlen);
 
+        uint32_t ready_seq = g_Scheduler.GetIOReadySeq(fd, EPOLLOUT);
         int n = connect_f(fd, addr, addrlen);
         int e = errno;
         if (n == 0) {
@@ -168,14 +384,18 @@ int connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
             return n;
         } else {
             // add into epoll, and switch other context.
-            g_Scheduler.IOBlockSwitch(fd, EPOLLOUT, -1);
-        }
-
-        if (tk->wait_successful_ == 0) {
-            // 添加到epoll中失败了
-            fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
-            errno = e;
-            return n;
+            // 唤醒后socket仍不可写时说明是旧的就绪事件, 继续等待.
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            do {
+                g_Scheduler.IOBlockSwitch(fd, EPOLLOUT, -1, ready_seq);
+                if (tk->wait_successful_ == 0) {
+                    // 添加到epoll中失败了
+                    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+                    errno = e;
+                    return n;
+                }
+                ready_seq = g_Scheduler.GetIOReadySeq(fd, EPOLLOUT);
+            } while (0 == poll_f(&pfd, 1, 0));
         }
 
         DebugPrint(dbg_hook, "continue task(%s) connect. fd=%d", g_Scheduler.GetCurrentTaskDebugInfo(), fd);
@@ -201,10 +421,192 @@ int connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
     }
 }
 
+int close(int fd)
+{
+    if (!close_f) coroutine_hook_init();
+    DebugPrint(dbg_hook, "hook close. fd=%d", fd);
+    on_fd_close(fd);
+    return close_f(fd);
+}
+
+int socket(int domain, int type, int protocol)
+{
+    if (!socket_f) coroutine_hook_init();
+    int fd = socket_f(domain, type | SOCK_NONBLOCK, protocol);
+    DebugPrint(dbg_hook, "hook socket. fd=%d", fd);
+    if (fd >= 0)
+        on_socket_created(fd, type & SOCK_NONBLOCK);
+    return fd;
+}
+
+// socketpair常用于与子进程通信, 或经fdopen交给stdio, 这些读写不经过hook,
+//   因此不托管, 保持用户要求的阻塞模式; 协程中的读写按未托管的socket处理.
+int socketpair(int domain, int type, int protocol, int sv[2])
+{
+    if (!socketpair_f) coroutine_hook_init();
+    int n = socketpair_f(domain, type, protocol, sv);
+    DebugPrint(dbg_hook, "hook socketpair. ret=%d", n);
+    if (n == 0) {
+        on_fd_created_unmanaged(sv[0]);
+        on_fd_created_unmanaged(sv[1]);
+    }
+    return n;
+}
+
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+    if (!accept4_f) coroutine_hook_init();
+    int fd = read_write_mode(sockfd, accept4_f, "accept", EPOLLIN, SO_RCVTIMEO, addr, addrlen,
+            flags | SOCK_NONBLOCK);
+    if (fd >= 0)
+        on_socket_created(fd, flags & SOCK_NONBLOCK);
+    return fd;
+}
+
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
-    if (!accept_f) coroutine_hook_init();
-    return read_write_mode(sockfd, accept_f, "accept", EPOLLIN, SO_RCVTIMEO, addr, addrlen);
+    return accept4(sockfd, addr, addrlen, 0);
+}
+
+int pipe(int pipefd[2])
+{
+    if (!pipe_f) coroutine_hook_init();
+    int n = pipe_f(pipefd);
+    if (n == 0) {
+        on_fd_created_unmanaged(pipefd[0]);
+        on_fd_created_unmanaged(pipefd[1]);
+    }
+    return n;
+}
+
+int pipe2(int pipefd[2], int flags)
+{
+    if (!pipe2_f) coroutine_hook_init();
+    int n = pipe2_f(pipefd, flags);
+    if (n == 0) {
+        on_fd_created_unmanaged(pipefd[0]);
+        on_fd_created_unmanaged(pipefd[1]);
+    }
+    return n;
+}
+
+int fcntl(int fd, int cmd, ...)
+{
+    if (!fcntl_f) coroutine_hook_init();
+
+    va_list ap;
+    va_start(ap, cmd);
+    void *arg = va_arg(ap, void*);
+    va_end(ap);
+
+    FdCtx *ctx = FdCtxTable::getInstance().Get(fd, false);
+    bool managed = ctx && ctx->managed;
+    switch (cmd) {
+        case F_GETFL:
+            {
+                // 托管socket总是非阻塞的, 返回用户设置的标志.
+                int flags = fcntl_f(fd, cmd);
+                if (flags != -1 && managed && !ctx->user_nonblock)
+                    flags &= ~O_NONBLOCK;
+                return flags;
+            }
+
+        case F_SETFL:
+            {
+                int flags = (int)(intptr_t)arg;
+                if (!managed)
+                    return fcntl_f(fd, cmd, flags);
+
+                int n = fcntl_f(fd, cmd, flags | O_NONBLOCK);
+                if (n != -1)
+                    ctx->user_nonblock = (flags & O_NONBLOCK) != 0;
+                return n;
+            }
+
+        case F_DUPFD:
+        case F_DUPFD_CLOEXEC:
+            {
+                int newfd = fcntl_f(fd, cmd, arg);
+                if (newfd >= 0)
+                    on_fd_dup(fd, newfd);
+                return newfd;
+            }
+
+        default:
+            return fcntl_f(fd, cmd, arg);
+    }
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    if (!ioctl_f) coroutine_hook_init();
+
+    va_list ap;
+    va_start(ap, request);
+    void *arg = va_arg(ap, void*);
+    va_end(ap);
+
+    if (request == FIONBIO && arg) {
+        FdCtx *ctx = FdCtxTable::getInstance().Get(fd, false);
+        if (ctx && ctx->managed) {
+            // 托管socket已是非阻塞的, 只记录用户的设置.
+            ctx->user_nonblock = *(int*)arg != 0;
+            return 0;
+        }
+    }
+
+    return ioctl_f(fd, request, arg);
+}
+
+int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen)
+{
+    if (!setsockopt_f) coroutine_hook_init();
+    int n = setsockopt_f(sockfd, level, optname, optval, optlen);
+    if (n == 0 && level == SOL_SOCKET && (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO)
+            && optlen >= sizeof(struct timeval))
+    {
+        FdCtx *ctx = FdCtxTable::getInstance().Get(sockfd, false);
+        if (ctx && ctx->managed) {
+            int64_t timeout_us = timeval_to_us((const struct timeval*)optval);
+            if (optname == SO_RCVTIMEO)
+                ctx->recv_timeout_us = timeout_us;
+            else
+                ctx->send_timeout_us = timeout_us;
+        }
+    }
+    return n;
+}
+
+int dup(int oldfd)
+{
+    if (!dup_f) coroutine_hook_init();
+    int newfd = dup_f(oldfd);
+    if (newfd >= 0)
+        on_fd_dup(oldfd, newfd);
+    return newfd;
+}
+
+// newfd原先打开的文件被隐式关闭, 同时清除它的上下文.
+int dup2(int oldfd, int newfd)
+{
+    if (!dup2_f) coroutine_hook_init();
+    int n = dup2_f(oldfd, newfd);
+    if (n >= 0 && oldfd != newfd) {
+        g_Scheduler.IOBlockClose(newfd);
+        on_fd_dup(oldfd, newfd);
+    }
+    return n;
+}
+
+int dup3(int oldfd, int newfd, int flags)
+{
+    if (!dup3_f) coroutine_hook_init();
+    int n = dup3_f(oldfd, newfd, flags);
+    if (n >= 0) {
+        g_Scheduler.IOBlockClose(newfd);
+        on_fd_dup(oldfd, newfd);
+    }
+    return n;
 }
 
 ssize_t read(int fd, void *buf, size_t count)
@@ -313,6 +715,9 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout)
         return 0;
     }
 
+    // 负的超时都表示无限等待
+    int64_t timeout_us = timeout < 0 ? -1 : (int64_t)timeout * 1000;
+
     std::vector<FdStruct> fdsts;
     for (nfds_t i = 0; i < nfds; ++i) {
         fdsts.emplace_back();
@@ -323,7 +728,7 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout)
     }
 
     // add into epoll, and switch other context.
-    g_Scheduler.IOBlockSwitch(std::move(fdsts), timeout);
+    g_Scheduler.IOBlockSwitch(std::move(fdsts), timeout_us);
     bool is_timeout = false; // 是否超时
     if (tk->io_block_timer_) {
         is_timeout = true;
@@ -361,23 +766,23 @@ int select(int nfds, fd_set *readfds, fd_set *writefds,
 {
     if (!select_f) coroutine_hook_init();
 
-    int timeout_ms = -1;
+    int64_t timeout_us = -1;
     if (timeout)
-        timeout_ms = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+        timeout_us = (int64_t)timeout->tv_sec * 1000000 + timeout->tv_usec;
 
     Task* tk = g_Scheduler.GetCurrentTask();
-    DebugPrint(dbg_hook, "task(%s) hook select(nfds=%d, rd_set=%p, wr_set=%p, er_set=%p, timeout=%d ms).",
+    DebugPrint(dbg_hook, "task(%s) hook select(nfds=%d, rd_set=%p, wr_set=%p, er_set=%p, timeout=%lld us).",
             tk ? tk->DebugInfo() : "nil",
-            (int)nfds, readfds, writefds, exceptfds, timeout_ms);
+            (int)nfds, readfds, writefds, exceptfds, (long long)timeout_us);
 
     if (!tk)
         return select_f(nfds, readfds, writefds, exceptfds, timeout);
 
-    if (timeout_ms == 0)
+    if (timeout_us == 0)
         return select_f(nfds, readfds, writefds, exceptfds, timeout);
 
     if (!nfds && !readfds && !writefds && !exceptfds && timeout) {
-        g_Scheduler.SleepSwitch(timeout_ms);
+        g_Scheduler.SleepSwitch(std::chrono::microseconds(timeout_us));
         return 0;
     }
 
@@ -412,7 +817,7 @@ int select(int nfds, fd_set *readfds, fd_set *writefds,
         }
     }
 
-    g_Scheduler.IOBlockSwitch(std::move(fdsts), timeout_ms);
+    g_Scheduler.IOBlockSwitch(std::move(fdsts), timeout_us);
     bool is_timeout = false;
     if (tk->io_block_timer_) {
         is_timeout = true;
@@ -429,8 +834,8 @@ int select(int nfds, fd_set *readfds, fd_set *writefds,
             if (exceptfds) FD_ZERO(exceptfds);
             return 0;
         } else {
-            if (timeout_ms > 0)
-                g_Scheduler.SleepSwitch(timeout_ms);
+            if (timeout_us > 0)
+                g_Scheduler.SleepSwitch(std::chrono::microseconds(timeout_us));
             timeval immedaitely = {0, 0};
             return select_f(nfds, readfds, writefds, exceptfds, &immedaitely);
         }
@@ -470,8 +875,7 @@ unsigned int sleep(unsigned int seconds)
     if (!g_Scheduler.IsCoroutine())
         return sleep_f(seconds);
 
-    int timeout_ms = seconds * 1000;
-    g_Scheduler.SleepSwitch(timeout_ms);
+    g_Scheduler.SleepSwitch(std::chrono::seconds(seconds));
     return 0;
 }
 
@@ -480,20 +884,32 @@ int nanosleep(const struct timespec *req, struct timespec *rem)
     if (!nanosleep_f) coroutine_hook_init();
 
     Task* tk = g_Scheduler.GetCurrentTask();
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000000;
-    DebugPrint(dbg_hook, "task(%s) hook nanosleep(milliseconds=%d). %s coroutine.",
-            tk ? tk->DebugInfo() : "nil", timeout_ms,
+    int64_t timeout_ns = (int64_t)req->tv_sec * 1000000000 + req->tv_nsec;
+    DebugPrint(dbg_hook, "task(%s) hook nanosleep(nanoseconds=%lld). %s coroutine.",
+            tk ? tk->DebugInfo() : "nil", (long long)timeout_ns,
             g_Scheduler.IsCoroutine() ? "In" : "Not in");
 
     if (!g_Scheduler.IsCoroutine())
         return nanosleep_f(req, rem);
 
-    g_Scheduler.SleepSwitch(timeout_ms);
+    g_Scheduler.SleepSwitch(std::chrono::nanoseconds(timeout_ns));
     return 0;
 }
 
 #if !defined(CO_DYNAMIC_LINK)
 extern int __connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+extern int __close(int fd);
+extern int __socket(int domain, int type, int protocol);
+extern int __socketpair(int domain, int type, int protocol, int sv[2]);
+extern int __fcntl(int fd, int cmd, ...);
+extern int __ioctl(int fd, unsigned long request, ...);
+extern int __setsockopt(int sockfd, int level, int optname,
+        const void *optval, socklen_t optlen);
+extern int __pipe(int pipefd[2]);
+extern int __pipe2(int pipefd[2], int flags);
+extern int __dup(int);
+extern int __dup2(int, int);
+extern int __dup3(int, int, int);
 extern ssize_t __read(int fd, void *buf, size_t count);
 extern ssize_t __readv(int fd, const struct iovec *iov, int iovcnt);
 extern ssize_t __recv(int sockfd, void *buf, size_t len, int flags);
@@ -506,12 +922,17 @@ extern ssize_t __send(int sockfd, const void *buf, size_t len, int flags);
 extern ssize_t __sendto(int sockfd, const void *buf, size_t len, int flags,
         const struct sockaddr *dest_addr, socklen_t addrlen);
 extern ssize_t __sendmsg(int sockfd, const struct msghdr *msg, int flags);
-extern int __libc_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 extern int __poll(struct pollfd *fds, nfds_t nfds, int timeout);
 extern int __select(int nfds, fd_set *readfds, fd_set *writefds,
                           fd_set *exceptfds, struct timeval *timeout);
 extern unsigned int __sleep(unsigned int seconds);
 extern int __nanosleep(const struct timespec *req, struct timespec *rem);
+
+// libc.a中的accept4没有内部别名, 直接发起系统调用.
+static int libc_accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+    return syscall(SYS_accept4, sockfd, addr, addrlen, flags);
+}
 #endif
 }
 
@@ -525,6 +946,15 @@ void coroutine_hook_init()
 
 #if defined(CO_DYNAMIC_LINK)
     connect_f = (connect_t)dlsym(RTLD_NEXT, "connect");
+    close_f = (close_t)dlsym(RTLD_NEXT, "close");
+    socket_f = (socket_t)dlsym(RTLD_NEXT, "socket");
+    socketpair_f = (socketpair_t)dlsym(RTLD_NEXT, "socketpair");
+    fcntl_f = (fcntl_t)dlsym(RTLD_NEXT, "fcntl");
+    ioctl_f = (ioctl_t)dlsym(RTLD_NEXT, "ioctl");
+    setsockopt_f = (setsockopt_t)dlsym(RTLD_NEXT, "setsockopt");
+    dup_f = (dup_t)dlsym(RTLD_NEXT, "dup");
+    dup2_f = (dup2_t)dlsym(RTLD_NEXT, "dup2");
+    dup3_f = (dup3_t)dlsym(RTLD_NEXT, "dup3");
     read_f = (read_t)dlsym(RTLD_NEXT, "read");
     readv_f = (readv_t)dlsym(RTLD_NEXT, "readv");
     recv_f = (recv_t)dlsym(RTLD_NEXT, "recv");
@@ -535,13 +965,24 @@ void coroutine_hook_init()
     send_f = (send_t)dlsym(RTLD_NEXT, "send");
     sendto_f = (sendto_t)dlsym(RTLD_NEXT, "sendto");
     sendmsg_f = (sendmsg_t)dlsym(RTLD_NEXT, "sendmsg");
-    accept_f = (accept_t)dlsym(RTLD_NEXT, "accept");
+    accept4_f = (accept4_t)dlsym(RTLD_NEXT, "accept4");
+    pipe_f = (pipe_t)dlsym(RTLD_NEXT, "pipe");
+    pipe2_f = (pipe2_t)dlsym(RTLD_NEXT, "pipe2");
     poll_f = (poll_t)dlsym(RTLD_NEXT, "poll");
     select_f = (select_t)dlsym(RTLD_NEXT, "select");
     sleep_f = (sleep_t)dlsym(RTLD_NEXT, "sleep");
     nanosleep_f = (nanosleep_t)dlsym(RTLD_NEXT, "nanosleep");
 #else
     connect_f = &__connect;
+    close_f = &__close;
+    socket_f = &__socket;
+    socketpair_f = &__socketpair;
+    fcntl_f = &__fcntl;
+    ioctl_f = &__ioctl;
+    setsockopt_f = &__setsockopt;
+    dup_f = &__dup;
+    dup2_f = &__dup2;
+    dup3_f = &__dup3;
     read_f = &__read;
     readv_f = &__readv;
     recv_f = &__recv;
@@ -552,15 +993,18 @@ void coroutine_hook_init()
     send_f = &__send;
     sendto_f = &__sendto;
     sendmsg_f = &__sendmsg;
-    accept_f = &__libc_accept;
+    accept4_f = &libc_accept4;
+    pipe_f = &__pipe;
+    pipe2_f = &__pipe2;
     poll_f = &__poll;
     select_f = &__select;
     sleep_f = &__sleep;
     nanosleep_f = &__nanosleep;
 #endif
 
-    if (!connect_f || !read_f || !write_f || !readv_f || !writev_f || !send_f
-            || !sendto_f || !sendmsg_f || !accept_f || !poll_f || !select_f
+    if (!connect_f || !close_f || !socket_f || !socketpair_f || !fcntl_f || !ioctl_f
+            || !setsockopt_f || !dup_f || !dup2_f || !dup3_f || !read_f || !write_f || !readv_f || !writev_f || !send_f
+            || !sendto_f || !sendmsg_f || !accept4_f || !pipe_f || !pipe2_f || !poll_f || !select_f
             || !sleep_f || !nanosleep_f) {
         fprintf(stderr, "Hook syscall failed. Please don't remove libc.a when static-link.\n");
         exit(1);
@@ -3,6 +3,7 @@
 #include "error.h"
 #include "assert.h"
 #include "platform_adapter.h"
+#include "stack_pool.h"
 
 namespace co {
 
@@ -12,12 +13,14 @@ Processer::Processer(uint32_t stack_size)
     : id_(++s_id_)
 {
     shared_stack_cap_ = stack_size;
-    shared_stack_ = new char[shared_stack_cap_];
+    shared_stack_ = StackPool::getInstance().AllocStack(shared_stack_cap_);
+    if (!shared_stack_)
+        throw std::bad_alloc();
 }
 Processer::~Processer()
 {
     if (shared_stack_) {
-        delete[] shared_stack_;
+        StackPool::getInstance().FreeStack(shared_stack_, shared_stack_cap_);
         shared_stack_ = NULL;
     }
 }
@@ -30,7 +33,7 @@ void Processer::AddTaskRunnable(Task *tk)
         tk->AddIntoProcesser(this, shared_stack_, shared_stack_cap_);
         if (tk->state_ == TaskState::fatal) {
             // 创建失败
-            delete tk;
+            tk->DecrementRef();
             throw std::system_error(errno, std::system_category());
         }
         ++ task_count_;
@@ -41,6 +44,15 @@ void Processer::AddTaskRunnable(Task *tk)
     runnable_list_.push(tk);
 }
 
+void Processer::AddTaskRunNext(Task *tk)
+{
+    DebugPrint(dbg_scheduler, "task(%s) add into proc(%u) runnext", tk->DebugInfo(), id_);
+    assert(tk->proc_ == this);
+    tk->state_ = TaskState::runnable;
+    if (Task *old = runnext_.exchange(tk, std::memory_order_relaxed))
+        runnable_list_.push(old);
+}
+
 uint32_t Processer::Run(ThreadLocalInfo &info, uint32_t &done_count)
 {
 	ProcesserRunGuard _run_guard(info);
@@ -48,6 +60,9 @@ uint32_t Processer::Run(ThreadLocalInfo &info, uint32_t &done_count)
     info.current_task = NULL;
     done_count = 0;
     uint32_t c = 0;
+    uint32_t runnext_c = 0;
+    if (Task *next = runnext_.exchange(NULL, std::memory_order_relaxed))
+        runnable_list_.push(next);
     SList<Task> slist = runnable_list_.pop_all();
     uint32_t do_count = slist.size();
 
@@ -61,13 +76,20 @@ uint32_t Processer::Run(ThreadLocalInfo &info, uint32_t &done_count)
         tk->state_ = TaskState::runnable;
         DebugPrint(dbg_switch, "enter task(%s)", tk->DebugInfo());
         RestoreStack(tk);
+#if defined(CO_USE_FCONTEXT)
+        co_transfer_t t = co_jump_fcontext(tk->ctx_, &info);
+        tk->ctx_ = t.fctx;
+        if (tk->state_ != TaskState::done)
+            SaveStack(tk);
+#else
         int ret = swapcontext(&info.scheduler, &tk->ctx_);
         if (ret) {
             fprintf(stderr, "swapcontext error:%s\n", strerror(errno));
             runnable_list_.push(tk);
             ThrowError(eCoErrorCode::ec_swapcontext_failed);
         }
-        DebugPrint(dbg_switch, "leave task(%s) state=%d", tk->DebugInfo(), tk->state_);
+#endif
+        DebugPrint(dbg_switch, "leave task(%s) state=%d", tk->DebugInfo(), (int)tk->state_);
         info.current_task = NULL;
 
         switch (tk->state_) {
@@ -85,6 +107,20 @@ uint32_t Processer::Run(ThreadLocalInfo &info, uint32_t &done_count)
                 g_Scheduler.sleep_wait_.SchedulerSwitch(tk);
                 break;
 
+            case TaskState::park:
+                {
+                    // 先移出队列再登记为已挂起, 登记之后其他线程随时可能唤醒它.
+                    it = slist.erase(it);
+                    uint32_t expected = Task::kParkNone;
+                    if (!tk->park_state_.compare_exchange_strong(expected, Task::kParkParked,
+                                std::memory_order_acq_rel, std::memory_order_acquire)) {
+                        // 切出期间已被唤醒
+                        tk->park_state_.store(Task::kParkNone, std::memory_order_relaxed);
+                        runnable_list_.push(tk);
+                    }
+                }
+                break;
+
             case TaskState::sys_block:
             case TaskState::user_block:
                 {
@@ -127,6 +163,14 @@ uint32_t Processer::Run(ThreadLocalInfo &info, uint32_t &done_count)
                     tk->DecrementRef();
                 break;
         }
+
+        // 刚切出的协程唤醒了本P上的协程, 插到下一个执行.
+        if (Task *next = runnext_.exchange(NULL, std::memory_order_relaxed)) {
+            if (++runnext_c <= kMaxRunNext)
+                it = slist.insert(it, next);
+            else
+                runnable_list_.push(next);
+        }
     }
     if (do_count)
         runnable_list_.push(slist);
@@ -139,14 +183,21 @@ void Processer::CoYield(ThreadLocalInfo &info)
     Task *tk = info.current_task;
     if (!tk) return ;
 
-    DebugPrint(dbg_yield, "yield task(%s) state=%d", tk->DebugInfo(), tk->state_);
+    DebugPrint(dbg_yield, "yield task(%s) state=%d", tk->DebugInfo(), (int)tk->state_);
     ++tk->yield_count_;
+#if defined(CO_USE_FCONTEXT)
+    // 寄存器保存在栈上, 切换回调度器之后才能保存栈.
+    // 恢复执行时可能已在另一个调度线程上, 以切换来源为准.
+    co_transfer_t t = co_jump_fcontext(info.scheduler, NULL);
+    ((ThreadLocalInfo*)t.data)->scheduler = t.fctx;
+#else
     SaveStack(tk);
     int ret = swapcontext(&tk->ctx_, &info.scheduler);
     if (ret) {
         fprintf(stderr, "swapcontext error:%s\n", strerror(errno));
         ThrowError(eCoErrorCode::ec_yield_failed);
     }
+#endif
 }
 
 uint32_t Processer::GetTaskCount()
@@ -154,26 +205,44 @@ uint32_t Processer::GetTaskCount()
     return task_count_;
 }
 
+bool Processer::IsRunnable()
+{
+    return !runnable_list_.empty() || runnext_.load(std::memory_order_relaxed);
+}
+
 void Processer::SaveStack(Task *tk)
 {
 #ifndef CO_USE_WINDOWS_FIBER
+    if (tk->dedicated_stack_) return ;
+
+# if defined(CO_USE_FCONTEXT)
+    char *sp = (char*)tk->ctx_;
+# else
     char dummy = 0;
+    char *sp = &dummy;
+# endif
     char *top = shared_stack_ + shared_stack_cap_;
-    uint32_t current_stack_size = top - &dummy;
+    uint32_t current_stack_size = top - sp;
     DebugPrint(dbg_scheduler, "task(%s) in proc(%u) save_stack size=%u", tk->DebugInfo(), id_, current_stack_size);
     assert(current_stack_size <= shared_stack_cap_);
     if (tk->stack_capacity_ < current_stack_size) {
-        tk->stack_ = (char*)realloc(tk->stack_, current_stack_size);
+        // 旧的数据随即被覆盖, 不需要拷贝.
+        StackPool::getInstance().FreeSegment(tk->stack_, tk->stack_capacity_);
         tk->stack_capacity_ = current_stack_size;
+        tk->stack_ = StackPool::getInstance().AllocSegment(tk->stack_capacity_);
+        if (!tk->stack_)
+            throw std::bad_alloc();
     }
     tk->stack_size_ = current_stack_size;
-    memcpy(tk->stack_, &dummy, tk->stack_size_);
+    memcpy(tk->stack_, sp, tk->stack_size_);
 #endif
 }
 
 void Processer::RestoreStack(Task *tk)
 {
 #ifndef CO_USE_WINDOWS_FIBER
+    if (tk->dedicated_stack_) return ;
+
     DebugPrint(dbg_scheduler, "task(%s) in proc(%u) restore_stack size=%u", tk->DebugInfo(), id_, tk->stack_size_);
     memcpy(shared_stack_ + shared_stack_cap_ - tk->stack_size_, tk->stack_, tk->stack_size_);
 #endif
@@ -11,7 +11,8 @@ struct ThreadLocalInfo;
 class Processer : public TSQueueHook
 {
 private:
-    typedef TSQueue<Task> TaskList;
+    // 其他线程唤醒协程时只入队, 不需要加锁
+    typedef MPSCQueue<Task> TaskList;
 
     uint32_t id_;
     char *shared_stack_ = NULL;
@@ -19,6 +20,13 @@ private:
     std::atomic<uint32_t> task_count_{0};
     TaskList runnable_list_;
 
+    // 本P上正在执行的协程唤醒的本P上的协程, 当前协程切出后紧接着执行.
+    //   只由执行本P的线程修改, 窃取P时由其他线程读取.
+    std::atomic<Task*> runnext_{NULL};
+
+    // 一次Run中至多连续执行runnext的次数, 以免互相唤醒的协程独占P.
+    static const uint32_t kMaxRunNext = 128;
+
     static std::atomic<uint32_t> s_id_;
 
 public:
@@ -28,12 +36,18 @@ public:
 
     void AddTaskRunnable(Task *tk);
 
+    // 由本P上正在执行的协程调用, 唤醒的协程在它切出后紧接着执行.
+    void AddTaskRunNext(Task *tk);
+
     uint32_t Run(ThreadLocalInfo &info, uint32_t &done_count);
 
     void CoYield(ThreadLocalInfo &info);
 
     uint32_t GetTaskCount();
 
+    // 是否有可执行的协程, 供其他线程窃取时判断.
+    bool IsRunnable();
+
 private:
     void SaveStack(Task *tk);
 
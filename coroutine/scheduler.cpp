@@ -1,9 +1,9 @@
 #include "scheduler.h"
-#include <ucontext.h>
 #include "error.h"
 #include <stdio.h>
 #include <system_error>
 #include <unistd.h>
+#include <limits.h>
 #include "thread_pool.h"
 #include "platform_adapter.h"
 
@@ -19,6 +19,8 @@ Scheduler& Scheduler::getInstance()
 extern void coroutine_hook_init();
 Scheduler::Scheduler()
 {
+    for (auto &rq : run_queues_)
+        rq = NULL;
     thread_pool_ = new ThreadPool;
     coroutine_hook_init();
 }
@@ -37,15 +39,88 @@ ThreadLocalInfo& Scheduler::GetLocalInfo()
     return *info;
 }
 
+// 调度线程退出时归还其运行队列, 以免队列中的P和协程无人调度.
+struct RunQueueOwner
+{
+    LocalRunQueue *rq = NULL;
+
+    ~RunQueueOwner()
+    {
+        if (!rq) return ;
+        g_Scheduler.GetLocalInfo().run_queue = NULL;
+        g_Scheduler.ReleaseRunQueue(rq);
+    }
+};
+
+LocalRunQueue& Scheduler::GetLocalRunQueue()
+{
+    ThreadLocalInfo &info = GetLocalInfo();
+    if (!info.run_queue) {
+        static co_thread_local RunQueueOwner owner;
+        owner.rq = info.run_queue = AcquireRunQueue();
+    }
+
+    return *info.run_queue;
+}
+
+LocalRunQueue* Scheduler::AcquireRunQueue()
+{
+    std::unique_lock<LFLock> lock(run_queue_lock_);
+    uint32_t n = run_queue_count_;
+    for (uint32_t i = 0; i < n; ++i) {
+        LocalRunQueue *rq = run_queues_[i];
+        if (rq->owners == 0) {
+            ++rq->owners;
+            ++active_run_queues_;
+            return rq;
+        }
+    }
+
+    if (n < max_run_queues) {
+        LocalRunQueue *rq = new LocalRunQueue;
+        rq->index = n;
+        rq->owners = 1;
+        run_queues_[n] = rq;
+        ++run_queue_count_;
+        ++active_run_queues_;
+        return rq;
+    }
+
+    // 调度线程过多, 与其他线程共用队列.
+    LocalRunQueue *rq = run_queues_[GetLocalInfo().thread_id % n];
+    ++rq->owners;
+    return rq;
+}
+
+void Scheduler::ReleaseRunQueue(LocalRunQueue *rq)
+{
+    std::unique_lock<LFLock> lock(run_queue_lock_);
+    if (--rq->owners > 0) return ;
+    --active_run_queues_;
+
+    while (Processer *proc = rq->procs.pop())
+        run_proc_list_.push(proc);
+
+    while (Task *tk = rq->new_tasks.pop())
+        run_tasks_.push(tk);
+
+    DebugPrint(dbg_scheduler, "release run queue(%u)", rq->index);
+}
+
 CoroutineOptions& Scheduler::GetOptions()
 {
     static CoroutineOptions options;
     return options;
 }
 
-void Scheduler::CreateTask(TaskF const& fn)
+void Scheduler::CreateTask(TaskF && fn)
 {
-    Task* tk = new Task(fn);
+    CreateTask(std::move(fn), GetOptions().stack_mode);
+}
+
+void Scheduler::CreateTask(TaskF && fn, eCoStackMode stack_mode)
+{
+    Task* tk = TaskPool::getInstance().Create(std::move(fn), stack_mode);
     ++task_count_;
     DebugPrint(dbg_task, "task(%s) created.", tk->DebugInfo());
     AddTaskRunnable(tk);
@@ -75,6 +150,12 @@ uint32_t Scheduler::Run()
         info.thread_id = ++ thread_id_;
     }
 
+    LocalRunQueue &rq = GetLocalRunQueue();
+    rq.run_tick.store(rq.run_tick + 1, std::memory_order_relaxed);
+
+    // 本轮调度中定时器到期判断与休眠时长的计算共用一次时钟读取.
+    CoTimerMgr::CachedNowScope cached_now_scope;
+
     // 创建、增补P
     CoroutineOptions &op = GetOptions();
     if (proc_count < op.processer_count) {
@@ -83,31 +164,23 @@ uint32_t Scheduler::Run()
             uint32_t i = proc_count;
             for (; i < op.processer_count; ++i) {
                 Processer *proc = new Processer(op.stack_size);
-                run_proc_list_.push(proc);
+                rq.procs.push(proc);
             }
 
             proc_count = i;
         }
     }
 
-    uint32_t run_task_count = DoRunnable();
+    uint32_t run_task_count = DoRunnable(rq);
 
     // epoll
     int ep_count = DoEpoll();
 
-    // timer
+    // timer, sleep wait and io timeout.
     uint32_t tm_count = DoTimer();
 
-    // sleep wait.
-    uint32_t sl_count = DoSleep();
-
-    if (!run_task_count && ep_count <= 0 && !tm_count && !sl_count) {
-        DebugPrint(dbg_scheduler_sleep, "sleep %d ms", (int)sleep_ms_);
-        sleep_ms_ = (std::min)(++sleep_ms_, GetOptions().max_sleep_ms);
-        usleep(sleep_ms_ * 1000);
-    } else {
-        sleep_ms_ = 1;
-    }
+    if (!run_task_count && ep_count <= 0 && !tm_count)
+        Park(rq);
 
     return run_task_count;
 }
@@ -120,24 +193,40 @@ void Scheduler::RunUntilNoTask()
 }
 
 // Run函数的一部分, 处理runnable状态的协程
-uint32_t Scheduler::DoRunnable()
+uint32_t Scheduler::DoRunnable(LocalRunQueue &rq)
+{
+    // 接管所属线程已退出的P
+    while (Processer *proc = run_proc_list_.pop())
+        rq.procs.push(proc);
+
+    // 顺便检查一个其他线程是否停滞, 以免其持有的协程迟迟得不到调度
+    Steal(rq, false);
+
+    uint32_t do_count = RunLocalProcs(rq);
+    if (!do_count && Steal(rq, true))
+        do_count = RunLocalProcs(rq);
+
+    return do_count;
+}
+
+uint32_t Scheduler::RunLocalProcs(LocalRunQueue &rq)
 {
     uint32_t do_count = 0;
-    uint32_t proc_c = run_proc_list_.size();
+    uint32_t proc_c = rq.procs.size();
+    uint32_t total_proc_c = (std::max<uint32_t>)(proc_count, 1);
     for (uint32_t i = 0; i < proc_c; ++i)
     {
-        Processer *proc = run_proc_list_.pop();
+        Processer *proc = rq.procs.pop();
         if (!proc) break;
 
-        // cherry-pick tasks.
-        if (!run_tasks_.empty()) {
-            uint32_t task_c = task_count_;
-            uint32_t average = task_c / proc_c + (task_c % proc_c ? 1 : 0);
-            for (uint32_t ti = proc->GetTaskCount(); ti < average; ++ti) {
-                Task *tk = run_tasks_.pop();
-                if (!tk) break;
-                proc->AddTaskRunnable(tk);
-            }
+        // cherry-pick tasks. 先取本线程的新协程, 再取全局队列中的.
+        uint32_t task_c = task_count_;
+        uint32_t average = task_c / total_proc_c + (task_c % total_proc_c ? 1 : 0);
+        for (uint32_t ti = proc->GetTaskCount(); ti < average; ++ti) {
+            Task *tk = rq.new_tasks.pop();
+            if (!tk) tk = run_tasks_.pop();
+            if (!tk) break;
+            proc->AddTaskRunnable(tk);
         }
 
         uint32_t done_count = 0;
@@ -145,41 +234,194 @@ uint32_t Scheduler::DoRunnable()
             do_count += proc->Run(GetLocalInfo(), done_count);
         } catch (...) {
             task_count_ -= done_count;
-            run_proc_list_.push(proc);
+            rq.procs.push(proc);
             throw ;
         }
         task_count_ -= done_count;
 
-        run_proc_list_.push(proc);
+        rq.procs.push(proc);
     }
 
+    // 所有协程都已结束, 唤醒休眠的线程以便RunUntilNoTask及时返回.
+    if (do_count && task_count_ == 0)
+        Unpark(true);
+
     return do_count;
 }
 
-// Run函数的一部分, 处理epoll相关
-int Scheduler::DoEpoll()
+uint32_t Scheduler::Steal(LocalRunQueue &rq, bool idle)
 {
-    return io_wait_.WaitLoop();
+    uint32_t n = run_queue_count_;
+    if (n < 2) return 0;
+
+    uint32_t stolen = 0;
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        LocalRunQueue *victim = run_queues_[rq.steal_cursor % n];
+        if (!victim || victim == &rq || victim->owners == 0) {
+            ++rq.steal_cursor;
+            rq.steal_checking = false;
+            if (idle) continue;
+            return 0;
+        }
+
+        // 非空闲时, 连续两次Run检查同一个线程, 期间它没有执行过Run才视为停滞.
+        uint64_t tick = victim->run_tick.load(std::memory_order_relaxed);
+        if (!idle) {
+            if (!rq.steal_checking) {
+                rq.steal_checking = true;
+                rq.steal_seen_tick = tick;
+                return 0;
+            }
+
+            rq.steal_checking = false;
+            ++rq.steal_cursor;
+            if (tick != rq.steal_seen_tick)
+                return 0;
+        } else {
+            rq.steal_checking = false;
+            ++rq.steal_cursor;
+        }
+
+        // 新协程窃取一半
+        std::size_t task_c = victim->new_tasks.size();
+        std::size_t task_got = 0;
+        if (task_c) {
+            SList<Task> tasks = victim->new_tasks.pop((task_c + 1) / 2);
+            for (auto it = tasks.begin(); it != tasks.end(); ++task_got) {
+                Task *tk = &*it;
+                it = tasks.erase(it);
+                rq.new_tasks.push(tk);
+            }
+        }
+
+        // 协程与P的共享栈绑定, 无法单独迁移, 所以窃取有可执行协程的P, 至多一半.
+        // 持有的P少于平均数时, 也窃取空闲的P, 以便执行新协程.
+        std::size_t proc_c = victim->procs.size();
+        std::size_t want = (proc_c + 1) / 2;
+        std::size_t proc_got = 0;
+        uint32_t active = (std::max<uint32_t>)(active_run_queues_, 1);
+        std::size_t fair = proc_count / active + (proc_count % active ? 1 : 0);
+        std::size_t own = rq.procs.size();
+        for (std::size_t pi = 0; pi < proc_c && proc_got < want; ++pi) {
+            Processer *proc = victim->procs.pop();
+            if (!proc) break;
+            if (proc->IsRunnable() || (idle && own + proc_got < fair)) {
+                rq.procs.push(proc);
+                ++proc_got;
+            } else {
+                victim->procs.push(proc);
+            }
+        }
+
+        // 放回期间对方线程可能已退出, 此时由窃取者负责将P转入无主队列.
+        if (victim->owners == 0) {
+            while (Processer *proc = victim->procs.pop())
+                run_proc_list_.push(proc);
+        }
+
+        if (task_got || proc_got) {
+            DebugPrint(dbg_scheduler, "steal from run queue(%u): tasks=%u procs=%u",
+                    victim->index, (unsigned)task_got, (unsigned)proc_got);
+            stolen += task_got + proc_got;
+            break;
+        }
+
+        if (!idle) break;
+    }
+
+    return stolen;
 }
 
-uint32_t Scheduler::DoSleep()
+// Run函数的一部分, 处理epoll相关
+int Scheduler::DoEpoll()
 {
-    return sleep_wait_.WaitLoop();
+    int n = io_wait_.WaitLoop();
+
+    // epoll推进epoch之后, 回收本线程退休的Task.
+    TaskPool::getInstance().Reclaim();
+    return n;
 }
 
 // Run函数的一部分, 处理定时器
 uint32_t Scheduler::DoTimer()
 {
-    std::list<CoTimerPtr> timers;
-    timer_mgr_.GetExpired(timers, 128);
-    for (auto &sp_timer : timers)
-    {
-        DebugPrint(dbg_timer, "enter timer callback %llu", (long long unsigned)sp_timer->GetId());
-        (*sp_timer)();
-        DebugPrint(dbg_timer, "leave timer callback %llu", (long long unsigned)sp_timer->GetId());
+    uint32_t n = timer_mgr_.RunExpired(128);
+    if (n)
+        DebugPrint(dbg_timer, "run %u timer callbacks", n);
+    return n;
+}
+
+// 距deadline的微秒数, 向上取整, 以免提前醒来后空转.
+static int64_t MicrosecondsUntil(CoTimerMgr::TimePoint const& deadline,
+        CoTimerMgr::TimePoint const& now)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+    return ns <= 0 ? 0 : (ns + 999) / 1000;
+}
+
+void Scheduler::Park(LocalRunQueue &rq)
+{
+    int64_t timeout_us = (int64_t)GetOptions().max_sleep_ms * 1000;
+    CoTimerMgr::TimePoint deadline;
+    if (timer_mgr_.GetNextDeadline(deadline))
+        // 只在本轮没有执行任何协程、定时器时休眠, 与RunExpired共用同一次时钟读取, 误差很小.
+        timeout_us = (std::min)(timeout_us, MicrosecondsUntil(deadline, CoTimerMgr::CachedNow()));
+
+    if (timeout_us <= 0) return ;
+
+    // 先登记再检查队列, 与Unpark中的先入队再检查登记数相对应, 避免丢失唤醒.
+    // 没有其他线程阻塞在epoll_wait时, 由本线程阻塞等待IO事件, 否则休眠在futex上.
+    if (io_wait_.BeginPoll()) {
+        if (!HasRunnable(rq)) {
+            DebugPrint(dbg_scheduler_sleep, "poll %lld us", (long long)timeout_us);
+            io_wait_.WaitLoop(timeout_us);
+        }
+        io_wait_.EndPoll();
+        return ;
     }
 
-    return timers.size();
+    uint32_t seq = park_seq_.load();
+    ++parked_count_;
+    if (!HasRunnable(rq)) {
+        DebugPrint(dbg_scheduler_sleep, "park %lld us", (long long)timeout_us);
+        FutexWait(&park_seq_, seq, timeout_us);
+    }
+    --parked_count_;
+    unparking_ = false;
+}
+
+void Scheduler::Unpark(bool all)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_count_ > 0) {
+        // 已经有唤醒在途时, 被唤醒的线程会检查所有队列, 无需重复唤醒.
+        if (all || !unparking_.exchange(true)) {
+            ++park_seq_;
+            FutexWake(&park_seq_, all ? INT_MAX : 1);
+        }
+
+        if (!all) return ;
+    }
+
+    // 没有休眠在futex上的线程, 打断阻塞在epoll_wait中的poller.
+    io_wait_.Interrupt();
+}
+
+bool Scheduler::HasRunnable(LocalRunQueue &rq)
+{
+    if (!rq.new_tasks.empty() || !run_tasks_.empty() || !run_proc_list_.empty())
+        return true;
+
+    bool runnable = false;
+    std::size_t proc_c = rq.procs.size();
+    for (std::size_t i = 0; i < proc_c; ++i) {
+        Processer *proc = rq.procs.pop();
+        if (!proc) break;
+        runnable = runnable || proc->IsRunnable();
+        rq.procs.push(proc);
+    }
+    return runnable;
 }
 
 void Scheduler::RunLoop()
@@ -190,10 +432,23 @@ void Scheduler::RunLoop()
 void Scheduler::AddTaskRunnable(Task* tk)
 {
     DebugPrint(dbg_scheduler, "Add task(%s) to runnable list.", tk->DebugInfo());
-    if (tk->proc_)
+    if (tk->proc_) {
+        // 由同一个P上正在执行的协程唤醒(如channel交接), 在它切出后紧接着执行,
+        // 不必等到下一轮调度, 也不必唤醒其他线程.
+        Task *cur = GetLocalInfo().current_task;
+        if (cur && cur != tk && cur->proc_ == tk->proc_) {
+            tk->proc_->AddTaskRunNext(tk);
+            return ;
+        }
+
         tk->proc_->AddTaskRunnable(tk);
+    }
+    else if (LocalRunQueue *rq = GetLocalInfo().run_queue)
+        rq->new_tasks.push(tk);
     else
         run_tasks_.push(tk);
+
+    Unpark();
 }
 
 uint32_t Scheduler::TaskCount()
@@ -236,25 +491,100 @@ Task* Scheduler::GetCurrentTask()
     return GetLocalInfo().current_task;
 }
 
-void Scheduler::IOBlockSwitch(int fd, uint32_t event, int timeout_ms)
+uint32_t Scheduler::GetIOReadySeq(int fd, uint32_t event)
 {
-    std::vector<FdStruct> fdst(1);
-    fdst[0].fd = fd;
-    fdst[0].event = event;
-    IOBlockSwitch(std::move(fdst), timeout_ms);
+    return io_wait_.GetReadySeq(fd, event);
 }
 
-void Scheduler::IOBlockSwitch(std::vector<FdStruct> && fdsts, int timeout_ms)
+void Scheduler::IOBlockSwitch(int fd, uint32_t event, int64_t timeout_us, uint32_t ready_seq)
 {
-    io_wait_.CoSwitch(std::move(fdsts), timeout_ms);
+    io_wait_.CoSwitch(fd, event, ready_seq, timeout_us);
 }
 
-void Scheduler::SleepSwitch(int timeout_ms)
+void Scheduler::IOBlockClose(int fd)
 {
-    if (timeout_ms <= 0)
+    io_wait_.CloseFd(fd);
+}
+
+void Scheduler::IOBlockSwitch(std::vector<FdStruct> && fdsts, int64_t timeout_us)
+{
+    io_wait_.CoSwitch(std::move(fdsts), timeout_us);
+}
+
+void Scheduler::SleepSwitch(int timeout_ms, int slack_ms)
+{
+    SleepSwitch(std::chrono::milliseconds(timeout_ms), std::chrono::milliseconds(slack_ms));
+}
+
+void Scheduler::SleepSwitch(std::chrono::nanoseconds timeout, std::chrono::nanoseconds slack)
+{
+    if (timeout.count() <= 0)
         CoYield();
     else
-        sleep_wait_.CoSwitch(timeout_ms);
+        sleep_wait_.CoSwitch(timeout.count(), (std::max)(slack.count(), (int64_t)0));
+}
+
+void Scheduler::ParkSwitch()
+{
+    Task* tk = GetLocalInfo().current_task;
+    if (!tk) return ;
+
+    uint32_t expected = Task::kParkNotified;
+    if (tk->park_state_.compare_exchange_strong(expected, Task::kParkNone,
+                std::memory_order_acquire, std::memory_order_relaxed)) {
+        DebugPrint(dbg_syncblock, "task(%s) park immedaitely done.", tk->DebugInfo());
+        return ;
+    }
+
+    // 由调度器在切出之后登记为已挂起, 见Processer::Run
+    tk->state_ = TaskState::park;
+    DebugPrint(dbg_syncblock, "task(%s) park.", tk->DebugInfo());
+    CoYield();
+}
+
+void Scheduler::UnparkTask(Task* tk)
+{
+    // 尚未挂起时只留下标记, 由ParkSwitch或调度器消耗.
+    if (tk->park_state_.exchange(Task::kParkNotified, std::memory_order_acq_rel)
+            != Task::kParkParked)
+        return ;
+
+    tk->park_state_.store(Task::kParkNone, std::memory_order_relaxed);
+    DebugPrint(dbg_syncblock, "unpark task(%s).", tk->DebugInfo());
+    AddTaskRunnable(tk);
+}
+
+bool Scheduler::ThreadParkUntil(std::atomic<uint32_t> const& flag,
+        CoTimerMgr::TimePoint const* deadline)
+{
+    std::atomic<uint32_t> &seq = GetLocalInfo().park_seq;
+    while (!flag.load(std::memory_order_acquire)) {
+        // 先取seq再检查flag, 其间的唤醒会改变seq, FutexWait不会休眠.
+        uint32_t s = seq.load(std::memory_order_acquire);
+        if (flag.load(std::memory_order_acquire))
+            break;
+
+        int64_t timeout_us = -1;
+        if (deadline) {
+            timeout_us = MicrosecondsUntil(*deadline, CoTimerMgr::Now());
+            if (!timeout_us)
+                return false;
+        }
+        FutexWait(&seq, s, timeout_us);
+    }
+
+    return true;
+}
+
+std::atomic<uint32_t>* Scheduler::GetThreadParkSeq()
+{
+    return &GetLocalInfo().park_seq;
+}
+
+void Scheduler::ThreadUnpark(std::atomic<uint32_t> *park_seq)
+{
+    park_seq->fetch_add(1, std::memory_order_release);
+    FutexWake(park_seq, 1);
 }
 
 bool Scheduler::UserBlockWait(uint32_t type, uint64_t wait_id)
@@ -273,10 +603,17 @@ uint32_t Scheduler::UserBlockWakeup(uint32_t type, uint64_t wait_id, uint32_t wa
 }
 
 TimerId Scheduler::ExpireAt(CoTimerMgr::TimePoint const& time_point,
-        CoTimer::fn_t const& fn)
+        CoTimer::fn_t const& fn, CoTimerMgr::Slack slack)
 {
-    TimerId id = timer_mgr_.ExpireAt(time_point, fn);
+    CoTimerMgr::TimePoint next;
+    bool earliest = !timer_mgr_.GetNextDeadline(next) || time_point + slack < next;
+    TimerId id = timer_mgr_.ExpireAt(time_point, fn, slack);
     DebugPrint(dbg_timer, "add timer %llu", (long long unsigned)id->GetId());
+
+    // 休眠中的线程可能错过这个更早的定时器, 唤醒一个重新计算休眠时间.
+    //   允许的最晚触发时间不早于已有定时器时, 休眠中的线程会在那之前醒来.
+    if (earliest)
+        Unpark();
     return id;
 }
 
@@ -349,10 +686,12 @@ uint32_t Scheduler::BlockWakeup(int64_t type, uint64_t wait_id, uint32_t wakeup_
     uint32_t domain_wakeup = wait_pair.first;
     locker.unlock();
 
-    for (auto &task: tasks)
+    // 先从链表中摘下再唤醒, 唤醒后协程可能立即被其他线程加入别的队列, 不能再通过它遍历.
+    for (auto it = tasks.begin(); it != tasks.end();)
     {
         ++c;
-        Task *tk = &task;
+        Task *tk = &*it;
+        it = tasks.erase(it);
         DebugPrint(dbg_wait, "%s wakeup task(%s). wait_type=%lld, wait_id=%llu",
                 type < 0 ? "sys_block" : "user_block", tk->DebugInfo(), (long long int)type, (long long unsigned)wait_id);
         AddTaskRunnable(tk);
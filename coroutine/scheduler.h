@@ -1,5 +1,5 @@
 #pragma once
-#include <ucontext.h>
+#include "context.h"
 #include <unordered_map>
 #include <list>
 #include <sys/epoll.h>
@@ -72,6 +72,22 @@ struct CoroutineOptions
     // @仅在Linux生效.
     uint32_t init_stack_size = 512; 
 
+    // 新协程默认的栈使用方式, 也可以在创建时用go_stack(mode)单独指定.
+    // @仅在Linux生效.
+    eCoStackMode stack_mode = eCoStackMode::shared;
+
+    // 独立栈(eCoStackMode::dedicated)的大小, 按页对齐, 另有一个保护页.
+    //    栈内存按需分配物理页, 只占用实际使用到的部分.
+    // @仅在Linux生效.
+    uint32_t dedicated_stack_size = 256 * 1024;
+
+    // 栈内存池中每种大小最多缓存的内存块数量, 超出的直接归还给系统.
+    uint32_t stack_pool_cache_count = 1024;
+
+    // P的共享栈和独立栈是否使用透明大页, 可以减少TLB miss, 但会增加内存占用.
+    // @仅在Linux生效.
+    bool stack_huge_page = false;
+
     // P的数量, 首次Run时创建所有P, 随后只能增加新的P不能减少现有的P
     //    此值越大, 并行效果越好, 但是相应的每次Run时的消耗很会增加, 同时会占用大量内存.
     //    建议设置为Run线程数的两倍或四倍.
@@ -82,11 +98,37 @@ struct CoroutineOptions
 };
 ///-------------------
 
+// 调度线程私有的运行队列
+//   每个执行Run的线程持有一批P和尚未绑定P的新协程, 平时只操作自己的队列,
+//   空闲时再从其他线程的队列中窃取, 以免所有线程竞争同一个全局队列.
+struct LocalRunQueue
+{
+    uint32_t index = 0;                     // 在Scheduler::run_queues_中的槽位
+    std::atomic<uint32_t> owners{0};        // 共用此队列的线程数, 为0时表示空闲槽位
+    TSQueue<Processer> procs{eLockSite::run_queue};     // 本线程持有的P
+    TSQueue<Task> new_tasks{eLockSite::run_queue};      // 本线程创建的、尚未绑定P的协程
+    std::atomic<uint64_t> run_tick{0};      // 每次Run递增, 窃取者据此判断本线程是否停滞
+
+    // 以下仅由持有线程访问
+    uint32_t steal_cursor = 0;              // 下一个检查的窃取对象
+    bool steal_checking = false;            // 是否已记录过当前窃取对象的run_tick
+    uint64_t steal_seen_tick = 0;           // 上次检查时窃取对象的run_tick
+};
+
 struct ThreadLocalInfo
 {
     Task* current_task = NULL;
+#if defined(CO_USE_FCONTEXT)
+    co_fcontext_t scheduler = NULL;
+#else
     ucontext_t scheduler;
+#endif
     uint32_t thread_id = 0;     // Run thread index, increment from 1.
+    LocalRunQueue *run_queue = NULL;
+
+    // 协程外的线程等待时休眠的futex, 每次唤醒时递增.
+    //   ThreadLocalInfo不释放, 唤醒者在等待者返回甚至线程退出之后访问也是安全的.
+    std::atomic<uint32_t> park_seq{0};
 };
 
 class ThreadPool;
@@ -105,8 +147,11 @@ class Scheduler
         // 获取配置选项
         CoroutineOptions& GetOptions();
 
-        // 创建一个协程
-        void CreateTask(TaskF const& fn);
+        // 创建一个协程, 协程函数被移动进协程中, 不会拷贝.
+        void CreateTask(TaskF && fn);
+
+        // 创建一个协程, 并指定协程栈的使用方式
+        void CreateTask(TaskF && fn, eCoStackMode stack_mode);
 
         // 当前是否处于协程中
         bool IsCoroutine();
@@ -147,7 +192,34 @@ class Scheduler
     public:
         /// sleep switch
         //  \timeout_ms min value is 0.
-        void SleepSwitch(int timeout_ms);
+        //  \slack_ms 允许醒来的时间延后的量, 见CoTimerMgr::ExpireAt.
+        void SleepSwitch(int timeout_ms, int slack_ms = 0);
+
+        //  纳秒精度的sleep, 不足1ms的睡眠也会挂起而不是只让出一次.
+        //  timeout为0时只让出一次.
+        void SleepSwitch(std::chrono::nanoseconds timeout,
+                std::chrono::nanoseconds slack = std::chrono::nanoseconds::zero());
+
+        /// park switch
+        //  挂起当前协程, 直到其他协程或线程调用UnparkTask唤醒它.
+        //  UnparkTask先于ParkSwitch发生时, ParkSwitch直接返回而不挂起, 因此不会丢失唤醒.
+        //  每次UnparkTask只抵消一次ParkSwitch. 不在协程中调用时不做任何事.
+        void ParkSwitch();
+
+        /// 唤醒ParkSwitch挂起的协程, 可在任意线程中调用.
+        void UnparkTask(Task* tk);
+
+        // 协程外的线程休眠在本线程的park_seq上, 直到flag非0或到达deadline(为NULL时不超时).
+        //   返回flag是否已非0.
+        bool ThreadParkUntil(std::atomic<uint32_t> const& flag,
+                CoTimerMgr::TimePoint const* deadline = NULL);
+
+        // 本线程休眠的futex, 等待者登记时取出, 交给唤醒者.
+        std::atomic<uint32_t>* GetThreadParkSeq();
+
+        // 置位flag之后调用, 唤醒ThreadParkUntil中的线程.
+        //   唤醒者应在置位flag之前取出park_seq, 之后不再访问flag所在的对象.
+        void ThreadUnpark(std::atomic<uint32_t> *park_seq);
 
         /// ------------------------------------------------------------------------
         // @{ 以计数的方式模拟实现的协程同步方式. 
@@ -167,12 +239,15 @@ class Scheduler
         
         /// ------------------------------------------------------------------------
         // @{ 定时器
-        TimerId ExpireAt(CoTimerMgr::TimePoint const& time_point, CoTimer::fn_t const& fn);
+        //  slack: 允许延后触发的量, 见CoTimerMgr::ExpireAt.
+        TimerId ExpireAt(CoTimerMgr::TimePoint const& time_point, CoTimer::fn_t const& fn,
+                CoTimerMgr::Slack slack = CoTimerMgr::Slack::zero());
 
         template <typename Duration>
-        TimerId ExpireAt(Duration const& duration, CoTimer::fn_t const& fn)
+        TimerId ExpireAt(Duration const& duration, CoTimer::fn_t const& fn,
+                CoTimerMgr::Slack slack = CoTimerMgr::Slack::zero())
         {
-            return this->ExpireAt(CoTimerMgr::Now() + duration, fn);
+            return this->ExpireAt(CoTimerMgr::Now() + duration, fn, slack);
         }
 
         bool CancelTimer(TimerId timer_id);
@@ -190,8 +265,15 @@ class Scheduler
         Task* GetCurrentTask();
 
         /// 调用阻塞式网络IO时, 将当前协程加入等待队列中, socket加入epoll中.
-        void IOBlockSwitch(int fd, uint32_t event, int timeout_ms);
-        void IOBlockSwitch(std::vector<FdStruct> && fdsts, int timeout_ms);
+        //   单个fd时, 需在syscall之前用GetIOReadySeq取得就绪计数,
+        //   syscall返回EAGAIN后以此计数挂起, 期间发生过的就绪事件不会丢失.
+        uint32_t GetIOReadySeq(int fd, uint32_t event);
+        //   timeout_us: 超时时间(微秒), -1表示不超时.
+        void IOBlockSwitch(int fd, uint32_t event, int64_t timeout_us, uint32_t ready_seq);
+        void IOBlockSwitch(std::vector<FdStruct> && fdsts, int64_t timeout_us);
+
+        /// hook的close调用, 将fd从epoll中移除并唤醒在它上面等待的协程.
+        void IOBlockClose(int fd);
 
     private:
         Scheduler();
@@ -223,28 +305,56 @@ class Scheduler
 
     private:
         // Run函数的一部分, 处理runnable状态的协程
-        uint32_t DoRunnable();
+        uint32_t DoRunnable(LocalRunQueue &rq);
+
+        // 执行本线程持有的所有P
+        uint32_t RunLocalProcs(LocalRunQueue &rq);
+
+        // 从其他线程窃取P和新协程, 返回窃取到的P和协程数量.
+        //   idle为true时依次检查所有线程, 否则只检查轮询到的一个线程是否停滞.
+        uint32_t Steal(LocalRunQueue &rq, bool idle);
 
         // Run函数的一部分, 处理epoll相关
         int DoEpoll();
 
-        // Run函数的一部分, 处理sleep相关
-        uint32_t DoSleep();
-
-        // Run函数的一部分, 处理定时器
+        // Run函数的一部分, 处理定时器, 包括用户定时器、睡眠和IO超时
         uint32_t DoTimer();
 
+        // 没有协程需要调度时休眠本线程, 直到有新的可执行协程、IO事件或最近的定时器到期.
+        //   同一时刻只有一个线程阻塞在epoll_wait中, 其余线程休眠在futex上.
+        //   休眠时间不超过max_sleep_ms.
+        void Park(LocalRunQueue &rq);
+
+        // 唤醒休眠中的调度线程. all为false时只唤醒一个.
+        void Unpark(bool all = false);
+
+        // 本线程或全局队列中是否有待执行的协程
+        bool HasRunnable(LocalRunQueue &rq);
+
         // 获取线程局部信息
         ThreadLocalInfo& GetLocalInfo();
 
+        // 获取本线程的运行队列, 首次调用时登记
+        LocalRunQueue& GetLocalRunQueue();
+
+        // 登记、注销调度线程的运行队列
+        LocalRunQueue* AcquireRunQueue();
+        void ReleaseRunQueue(LocalRunQueue *rq);
+
         // List of Processer
-        LFLock proc_init_lock_;
+        LFLock proc_init_lock_{eLockSite::run_queue};
         uint32_t proc_count = 0;
-        ProcList run_proc_list_;
-        ProcList wait_proc_list_;
+        ProcList run_proc_list_{eLockSite::run_queue};  // 无主的P(所属线程已退出), 由空闲线程接管
 
         // List of task.
-        TaskList run_tasks_;
+        TaskList run_tasks_{eLockSite::run_queue};      // 非调度线程创建的、尚未绑定P的协程
+
+        // 调度线程的运行队列, 超出上限的线程共用已有的队列
+        static const uint32_t max_run_queues = 256;
+        std::atomic<LocalRunQueue*> run_queues_[max_run_queues];
+        std::atomic<uint32_t> run_queue_count_{0};
+        std::atomic<uint32_t> active_run_queues_{0};
+        LFLock run_queue_lock_{eLockSite::run_queue};
 
         // io block waiter.
         IoWait io_wait_;
@@ -254,22 +364,27 @@ class Scheduler
 
         // User define wait tasks table.
         WaitTable user_wait_tasks_;
-        LFLock user_wait_lock_;
+        LFLock user_wait_lock_{eLockSite::user_wait};
 
         // Timer manager.
+        // 用户定时器、睡眠和IO超时共用的定时器
         CoTimerMgr timer_mgr_;
 
         ThreadPool *thread_pool_;
 
         std::atomic<uint32_t> task_count_{0};
-        std::atomic<uint8_t> sleep_ms_{0};
         std::atomic<uint32_t> thread_id_{0};
 
-    friend class CoMutex;
+        // 调度线程休眠等待的futex, 每次唤醒时递增. parked_count_不含poller.
+        std::atomic<uint32_t> park_seq_{0};
+        std::atomic<uint32_t> parked_count_{0};
+        std::atomic<bool> unparking_{false};
+
     friend class BlockObject;
     friend class IoWait;
     friend class SleepWait;
     friend class Processer;
+    friend struct RunQueueOwner;
 };
 
 } //namespace co
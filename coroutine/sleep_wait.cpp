@@ -6,40 +6,27 @@
 namespace co
 {
 
-void SleepWait::CoSwitch(int timeout_ms)
+void SleepWait::CoSwitch(int64_t timeout_ns, int64_t slack_ns)
 {
     Task *tk = g_Scheduler.GetCurrentTask();
     if (!tk) return ;
 
-    tk->sleep_ms_ = timeout_ms;
+    tk->sleep_ns_ = timeout_ns;
+    tk->sleep_slack_ns_ = slack_ns;
     tk->state_ = TaskState::sleep;
 
-    DebugPrint(dbg_sleepblock, "task(%s) will sleep %d ms", tk->DebugInfo(), tk->sleep_ms_);
+    DebugPrint(dbg_sleepblock, "task(%s) will sleep %lld ns", tk->DebugInfo(), (long long)tk->sleep_ns_);
     g_Scheduler.CoYield();
 }
 
 void SleepWait::SchedulerSwitch(Task* tk)
 {
-    DebugPrint(dbg_sleepblock, "task(%s) begin sleep %d ms", tk->DebugInfo(), tk->sleep_ms_);
+    DebugPrint(dbg_sleepblock, "task(%s) begin sleep %lld ns", tk->DebugInfo(), (long long)tk->sleep_ns_);
     wait_tasks_.push(tk);
-    timer_mgr_.ExpireAt(std::chrono::milliseconds(tk->sleep_ms_),
+    g_Scheduler.timer_mgr_.ExpireAt(std::chrono::nanoseconds(tk->sleep_ns_),
             [=] {
                 this->Wakeup(tk);
-            });
-}
-
-uint32_t SleepWait::WaitLoop()
-{
-    std::list<CoTimerPtr> timers;
-    timer_mgr_.GetExpired(timers, 128);
-    for (auto &sp_timer : timers)
-    {
-        DebugPrint(dbg_sleepblock, "enter timer callback %llu", (long long unsigned)sp_timer->GetId());
-        (*sp_timer)();
-        DebugPrint(dbg_sleepblock, "leave timer callback %llu", (long long unsigned)sp_timer->GetId());
-    }
-
-    return timers.size();
+            }, std::chrono::nanoseconds(tk->sleep_slack_ns_));
 }
 
 void SleepWait::Wakeup(Task* tk)
@@ -13,18 +13,14 @@ class SleepWait
 {
 public:
     // 在协程中调用的switch, 暂存状态并yield
-    void CoSwitch(int timeout_ms);
+    void CoSwitch(int64_t timeout_ns, int64_t slack_ns = 0);
 
     // 在调度器中调用的switch
     void SchedulerSwitch(Task* tk);
 
-    uint32_t WaitLoop();
-
 private:
     void Wakeup(Task *tk);
 
-    CoTimerMgr timer_mgr_;
-
     typedef TSQueue<Task> TaskList;
     TaskList wait_tasks_;
 };
@@ -0,0 +1,119 @@
+#include "spinlock.h"
+#include "platform_adapter.h"
+#if defined(_MSC_VER)
+# include <Windows.h>
+#elif defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+#endif
+
+namespace co
+{
+
+std::atomic<bool> LFLock::s_stats_enabled{false};
+
+// 每个位置的统计独占一个cache line, 以免不同位置的锁互相影响.
+struct alignas(64) LockSiteCounters
+{
+    std::atomic<uint64_t> acquire_count{0};
+    std::atomic<uint64_t> contended_count{0};
+    std::atomic<uint64_t> spin_count{0};
+    std::atomic<uint64_t> park_count{0};
+};
+
+static LockSiteCounters s_counters[(int)eLockSite::count];
+
+static const char* s_site_names[(int)eLockSite::count] = {
+    "other",
+    "ts_queue",
+    "run_queue",
+    "block_object",
+    "user_wait",
+    "timer",
+    "io_wait",
+    "fd_ctx",
+    "stack_pool",
+    "task_pool",
+    "channel",
+};
+
+// 自旋时每轮pause次数从1开始加倍, 直到此上限后休眠.
+static const uint32_t kMaxSpinBackoff = 128;
+
+void CpuRelax()
+{
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+void EnableLockStats(bool enable)
+{
+    LFLock::s_stats_enabled = enable;
+}
+
+LockStats GetLockStats(eLockSite site)
+{
+    LockStats stats;
+    if (site >= eLockSite::count) return stats;
+    LockSiteCounters &c = s_counters[(int)site];
+    stats.acquire_count = c.acquire_count;
+    stats.contended_count = c.contended_count;
+    stats.spin_count = c.spin_count;
+    stats.park_count = c.park_count;
+    return stats;
+}
+
+const char* GetLockSiteName(eLockSite site)
+{
+    if (site >= eLockSite::count) return "unknown";
+    return s_site_names[(int)site];
+}
+
+void LFLock::lock_slow()
+{
+    LockSiteCounters &c = s_counters[(int)site_];
+    ++c.contended_count;
+    if (s_stats_enabled.load(std::memory_order_relaxed))
+        ++c.acquire_count;
+
+    uint64_t spins = 0;
+    for (uint32_t backoff = 1; backoff <= kMaxSpinBackoff; backoff <<= 1) {
+        for (uint32_t i = 0; i < backoff; ++i)
+            CpuRelax();
+        spins += backoff;
+
+        // 只在锁空闲时才尝试CAS, 减少对cache line的争用.
+        uint32_t expected = 0;
+        if (state_.load(std::memory_order_relaxed) == 0 &&
+                state_.compare_exchange_weak(expected, 1, std::memory_order_acquire,
+                    std::memory_order_relaxed)) {
+            c.spin_count += spins;
+            return ;
+        }
+    }
+    c.spin_count += spins;
+
+    // 标记为有休眠者后等待, 解锁时据此决定是否唤醒.
+    while (state_.exchange(2, std::memory_order_acquire) != 0) {
+        ++c.park_count;
+        FutexWait(&state_, 2, -1);
+    }
+}
+
+void LFLock::unlock_slow()
+{
+    FutexWake(&state_, 1);
+}
+
+void LFLock::count_acquire()
+{
+    s_counters[(int)site_].acquire_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+} //namespace co
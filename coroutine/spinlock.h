@@ -1,32 +1,95 @@
 #pragma once
+#include <stdint.h>
 #include <atomic>
 
 namespace co
 {
 
+// 锁的使用位置, 同一位置的锁(如所有BlockObject的锁)共用一份统计信息.
+enum class eLockSite : uint8_t
+{
+    other,
+    ts_queue,       // TSQueue
+    run_queue,      // 调度线程的运行队列、P的初始化
+    block_object,   // BlockObject(co_mutex, channel等)
+    user_wait,      // Scheduler::user_wait_lock_
+    timer,          // CoTimerMgr, CoTimer
+    io_wait,        // IoWait的epoll和超时队列, Task::io_block_lock_
+    fd_ctx,         // FdCtx
+    stack_pool,     // StackPool
+    task_pool,      // TaskPool
+    channel,        // Channel的等待队列和deque缓冲区
+    count,
+};
+
+// 锁的统计信息
+struct LockStats
+{
+    uint64_t acquire_count = 0;     // 加锁次数, 只在EnableLockStats(true)之后统计
+    uint64_t contended_count = 0;   // 其中加锁时锁已被占用的次数
+    uint64_t spin_count = 0;        // 等待时自旋(pause)的次数
+    uint64_t park_count = 0;        // 自旋后仍未得到锁, 休眠在futex上的次数
+};
+
+// 自旋等待时降低CPU占用(pause), 让出流水线给同一核心上的其他线程.
+void CpuRelax();
+
+// 开启、关闭加锁次数的统计. 默认关闭, 以免无竞争时所有线程争用统计计数.
+//   有竞争时的统计始终开启.
+void EnableLockStats(bool enable);
+
+LockStats GetLockStats(eLockSite site);
+
+const char* GetLockSiteName(eLockSite site);
+
+// 自适应锁
+//   无竞争时只有一次CAS; 锁被占用时先自旋, 每次等待的pause次数加倍,
+//   超过上限后休眠在futex上, 以免持有者被抢占时其他线程空转整个时间片.
 struct LFLock
 {
-    volatile std::atomic_flag lck;
+    // 0: 未加锁, 1: 已加锁, 2: 已加锁且可能有线程休眠等待
+    std::atomic<uint32_t> state_{0};
+    eLockSite site_;
 
-    LFLock() 
-    {
-        lck.clear();
-    }
+    explicit LFLock(eLockSite site = eLockSite::other) : site_(site) {}
+
+    LFLock(LFLock const&) = delete;
+    LFLock& operator=(LFLock const&) = delete;
 
     inline void lock()
     {
-        while (std::atomic_flag_test_and_set_explicit(&lck, std::memory_order_acquire));
+        uint32_t expected = 0;
+        if (!state_.compare_exchange_strong(expected, 1, std::memory_order_acquire,
+                    std::memory_order_relaxed))
+            lock_slow();
+        else if (s_stats_enabled.load(std::memory_order_relaxed))
+            count_acquire();
     }
 
     inline bool try_lock()
     {
-        return !std::atomic_flag_test_and_set_explicit(&lck, std::memory_order_acquire);
+        uint32_t expected = 0;
+        if (!state_.compare_exchange_strong(expected, 1, std::memory_order_acquire,
+                    std::memory_order_relaxed))
+            return false;
+
+        if (s_stats_enabled.load(std::memory_order_relaxed))
+            count_acquire();
+        return true;
     }
-    
+
     inline void unlock()
     {
-        std::atomic_flag_clear_explicit(&lck, std::memory_order_release);
+        if (state_.exchange(0, std::memory_order_release) == 2)
+            unlock_slow();
     }
+
+    static std::atomic<bool> s_stats_enabled;
+
+private:
+    void lock_slow();
+    void unlock_slow();
+    void count_acquire();
 };
 
 
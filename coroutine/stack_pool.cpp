@@ -0,0 +1,202 @@
+#include "stack_pool.h"
+#include <stdlib.h>
+#include <mutex>
+#include "scheduler.h"
+#include "platform_adapter.h"
+
+namespace co
+{
+
+StackPool& StackPool::getInstance()
+{
+    // 不析构, 静态对象析构期间结束的协程仍可归还内存.
+    static StackPool *obj = new StackPool;
+    return *obj;
+}
+
+char* StackPool::AllocSegment(uint32_t &size)
+{
+    uint32_t cls = 0;
+    while (cls < kSegmentClasses && ((uint64_t)1 << (cls + kMinSegmentShift)) < size)
+        ++cls;
+
+    if (cls < kSegmentClasses)
+        size = 1 << (cls + kMinSegmentShift);
+
+    return Alloc(cls < kSegmentClasses ? &segments_[cls] : NULL, size, false);
+}
+
+void StackPool::FreeSegment(char *ptr, uint32_t size)
+{
+    uint32_t cls = 0;
+    while (cls < kSegmentClasses && ((uint64_t)1 << (cls + kMinSegmentShift)) < size)
+        ++cls;
+
+    Free(cls < kSegmentClasses ? &segments_[cls] : NULL, ptr, size, false);
+}
+
+char* StackPool::AllocStack(uint32_t &size)
+{
+    uint32_t page_size = GetPageSize();
+    size = (size + page_size - 1) / page_size * page_size;
+    return Alloc(GetStackList(size, true), size, true);
+}
+
+void StackPool::FreeStack(char *ptr, uint32_t size)
+{
+    Free(GetStackList(size, false), ptr, size, true);
+}
+
+StackPoolStats StackPool::GetStats()
+{
+    StackPoolStats stats;
+    stats.alloc_count = alloc_count_;
+    stats.reuse_count = reuse_count_;
+    stats.os_alloc_count = os_alloc_count_;
+    stats.os_free_count = os_free_count_;
+    stats.advise_count = advise_count_;
+    stats.cached_bytes = cached_bytes_;
+    stats.in_use_bytes = in_use_bytes_;
+    return stats;
+}
+
+char* StackPool::Alloc(FreeList *fl, uint32_t size, bool is_stack)
+{
+    ++alloc_count_;
+    char *ptr = NULL;
+    if (fl) {
+        std::unique_lock<LFLock> lock(fl->lock);
+        if (!fl->hot.empty()) {
+            ptr = fl->hot.back();
+            fl->hot.pop_back();
+            if (fl->hot.size() < fl->low_water)
+                fl->low_water = fl->hot.size();
+        } else if (!fl->cold.empty()) {
+            ptr = fl->cold.back();
+            fl->cold.pop_back();
+        }
+    }
+
+    if (ptr) {
+        ++reuse_count_;
+        cached_bytes_ -= size;
+    } else {
+        ptr = OsAlloc(size, is_stack);
+        if (!ptr) return NULL;
+    }
+
+    in_use_bytes_ += size;
+    return ptr;
+}
+
+void StackPool::Free(FreeList *fl, char *ptr, uint32_t size, bool is_stack)
+{
+    in_use_bytes_ -= size;
+    if (!fl) {
+        OsFree(ptr, size, is_stack);
+        return ;
+    }
+
+    bool scavenge = false;
+    {
+        std::unique_lock<LFLock> lock(fl->lock);
+        if (fl->hot.size() + fl->cold.size() >= g_Scheduler.GetOptions().stack_pool_cache_count) {
+            lock.unlock();
+            OsFree(ptr, size, is_stack);
+            return ;
+        }
+
+        cached_bytes_ += size;
+        fl->hot.push_back(ptr);
+        scavenge = ++fl->free_count >= kScavengeInterval;
+    }
+
+    if (scavenge)
+        Scavenge(*fl, size, is_stack);
+}
+
+void StackPool::Scavenge()
+{
+    for (uint32_t cls = 0; cls < kSegmentClasses; ++cls)
+        Scavenge(segments_[cls], 1 << (cls + kMinSegmentShift), false);
+
+    for (auto &fl : stacks_) {
+        uint32_t size;
+        {
+            std::unique_lock<LFLock> lock(stacks_lock_);
+            size = fl.size;
+        }
+        if (size)
+            Scavenge(fl, size, true);
+    }
+}
+
+void StackPool::Scavenge(FreeList &fl, uint32_t size, bool is_stack)
+{
+    std::vector<char*> evicts;
+    {
+        std::unique_lock<LFLock> lock(fl.lock);
+        fl.free_count = 0;
+        evicts.assign(fl.hot.begin(), fl.hot.begin() + fl.low_water);
+        fl.hot.erase(fl.hot.begin(), fl.hot.begin() + fl.low_water);
+        fl.low_water = fl.hot.size();
+    }
+
+    if (evicts.empty()) return ;
+
+    // 先从hot中移除再MADV_FREE, 以免正在被复用的内存被释放.
+    if (is_stack || size >= kAdviseMinSize) {
+        for (char *ptr : evicts)
+            StackAdviseFree(ptr, size);
+        advise_count_ += evicts.size();
+    }
+
+    std::unique_lock<LFLock> lock(fl.lock);
+    fl.cold.insert(fl.cold.end(), evicts.begin(), evicts.end());
+}
+
+char* StackPool::OsAlloc(uint32_t size, bool is_stack)
+{
+    char *ptr = NULL;
+    if (is_stack)
+        ptr = StackAlloc(size, true, g_Scheduler.GetOptions().stack_huge_page);
+    else if (size >= kAdviseMinSize)
+        ptr = StackAlloc(size, false, false);
+    else
+        ptr = (char*)malloc(size);
+
+    if (ptr) ++os_alloc_count_;
+    return ptr;
+}
+
+void StackPool::OsFree(char *ptr, uint32_t size, bool is_stack)
+{
+    ++os_free_count_;
+    if (is_stack)
+        StackFree(ptr, size, true);
+    else if (size >= kAdviseMinSize)
+        StackFree(ptr, size, false);
+    else
+        free(ptr);
+}
+
+StackPool::FreeList* StackPool::GetStackList(uint32_t size, bool create)
+{
+    std::unique_lock<LFLock> lock(stacks_lock_);
+    FreeList *empty = NULL;
+    for (auto &fl : stacks_) {
+        if (fl.size == size)
+            return &fl;
+        if (!fl.size && !empty)
+            empty = &fl;
+    }
+
+    if (create && empty) {
+        empty->size = size;
+        return empty;
+    }
+
+    return NULL;
+}
+
+} //namespace co
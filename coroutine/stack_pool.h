@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "spinlock.h"
+
+namespace co
+{
+
+// 栈内存池的统计信息
+struct StackPoolStats
+{
+    uint64_t alloc_count = 0;       // 分配次数
+    uint64_t reuse_count = 0;       // 其中从池中复用的次数
+    uint64_t os_alloc_count = 0;    // 向系统申请内存(malloc/mmap)的次数
+    uint64_t os_free_count = 0;     // 归还给系统(free/munmap)的次数
+    uint64_t advise_count = 0;      // 以MADV_FREE释放冷内存物理页的次数
+    uint64_t cached_bytes = 0;      // 池中缓存的内存
+    uint64_t in_use_bytes = 0;      // 正在使用的内存
+};
+
+// 协程栈内存池
+//   管理两类内存, 都按大小分级(size class)缓存, 协程结束时回收, 新协程直接复用:
+//     segment: 共享栈模式下保存协程栈数据的内存块, 按2的幂次分级;
+//     stack:   独立栈和P的共享栈, 带保护页, 按页对齐后的大小分级.
+//   每级每归还一定次数做一次回收: 上次回收以来一直没有被复用过的块视为冷块,
+//   以MADV_FREE交还物理页, 再次使用时不需要系统调用, 只在内存紧张时才会被内核回收.
+//   协程频繁创建销毁时缓存的块都会被复用, 不会产生mmap/malloc/madvise调用.
+class StackPool
+{
+public:
+    static StackPool& getInstance();
+
+    // 分配保存栈数据的内存块, size向上取整到所属级别的大小.
+    char* AllocSegment(uint32_t &size);
+    void FreeSegment(char *ptr, uint32_t size);
+
+    // 分配带保护页的栈, size向上取整到页大小.
+    char* AllocStack(uint32_t &size);
+    void FreeStack(char *ptr, uint32_t size);
+
+    StackPoolStats GetStats();
+
+    // 立即回收所有级别中上次回收以来没有被复用过的块.
+    void Scavenge();
+
+private:
+    StackPool() = default;
+    StackPool(StackPool const&) = delete;
+    StackPool& operator=(StackPool const&) = delete;
+
+    struct FreeList
+    {
+        LFLock lock{eLockSite::stack_pool};
+        uint32_t size = 0;          // 栈的大小, 为0时表示未使用(segment不使用此字段)
+        std::vector<char*> hot;     // 未MADV_FREE的块, 末尾最热
+        std::vector<char*> cold;    // 已MADV_FREE的块
+        std::size_t low_water = 0;  // 上次回收以来hot的最小长度, 之下的块一直没有被复用
+        uint32_t free_count = 0;    // 上次回收以来的归还次数
+    };
+
+    static const uint32_t kMinSegmentShift = 9;     // 最小的segment为512bytes
+    static const uint32_t kSegmentClasses = 20;     // 最大的segment为256MB
+    static const uint32_t kStackClasses = 8;        // 最多缓存8种大小的栈
+    static const uint32_t kScavengeInterval = 256;  // 每级每归还这么多次回收一次冷块
+    static const uint32_t kAdviseMinSize = 64 * 1024; // 小于此值的segment由malloc分配, 不做MADV_FREE
+
+    // fl为NULL时不缓存, 直接向系统申请和归还.
+    char* Alloc(FreeList *fl, uint32_t size, bool is_stack);
+    void Free(FreeList *fl, char *ptr, uint32_t size, bool is_stack);
+
+    char* OsAlloc(uint32_t size, bool is_stack);
+    void OsFree(char *ptr, uint32_t size, bool is_stack);
+
+    FreeList* GetStackList(uint32_t size, bool create);
+
+    void Scavenge(FreeList &fl, uint32_t size, bool is_stack);
+
+    FreeList segments_[kSegmentClasses];
+    FreeList stacks_[kStackClasses];
+    LFLock stacks_lock_{eLockSite::stack_pool};
+
+    std::atomic<uint64_t> alloc_count_{0};
+    std::atomic<uint64_t> reuse_count_{0};
+    std::atomic<uint64_t> os_alloc_count_{0};
+    std::atomic<uint64_t> os_free_count_{0};
+    std::atomic<uint64_t> advise_count_{0};
+    std::atomic<uint64_t> cached_bytes_{0};
+    std::atomic<uint64_t> in_use_bytes_{0};
+};
+
+} //namespace co
@@ -4,6 +4,8 @@
 #include <string>
 #include <algorithm>
 #include "scheduler.h"
+#include "stack_pool.h"
+#include "platform_adapter.h"
 
 namespace co
 {
@@ -11,9 +13,6 @@ namespace co
 uint64_t Task::s_id = 0;
 std::atomic<uint64_t> Task::s_task_count{0};
 
-Task::DeleteList Task::s_delete_list;
-LFLock Task::s_delete_list_lock;
-
 static void C_func(Task* self)
 {
     if (g_Scheduler.GetOptions().exception_handle == eCoExHandle::immedaitely_throw) {
@@ -59,18 +58,80 @@ static void C_func(Task* self)
     Scheduler::getInstance().CoYield();
 }
 
-Task::Task(TaskF const& fn)
-    : id_(++s_id), fn_(fn)
+#if defined(CO_USE_FCONTEXT)
+// 首次切换进协程时, 参数是切换来源的调度线程.
+static void FContextEntry(co_transfer_t t)
+{
+    ThreadLocalInfo *info = (ThreadLocalInfo*)t.data;
+    info->scheduler = t.fctx;
+    C_func(info->current_task);
+}
+#endif
+
+Task::Task(TaskF && fn, eCoStackMode stack_mode)
+    : id_(++s_id), fn_(std::move(fn)), stack_mode_(stack_mode)
 {
-    ++s_task_count;
 }
 
 Task::~Task()
 {
-    --s_task_count;
     if (stack_) {
-        free(stack_);
+        StackPool::getInstance().FreeSegment(stack_, stack_capacity_);
+        stack_ = NULL;
+    }
+
+    if (dedicated_stack_) {
+        StackPool::getInstance().FreeStack(dedicated_stack_, dedicated_stack_size_);
+        dedicated_stack_ = NULL;
+    }
+}
+
+void Task::Reset(TaskF && fn, eCoStackMode stack_mode)
+{
+    id_ = ++s_id;
+    state_ = TaskState::init;
+    yield_count_ = 0;
+#if defined(CO_USE_FCONTEXT)
+    ctx_ = NULL;
+#endif
+    fn_ = std::move(fn);
+    proc_ = NULL;
+    stack_size_ = 0;
+    stack_mode_ = stack_mode;
+    ref_count_ = 1;
+    // io_block_id_不重置, 以免与上次使用时残留在epoll中的数据混淆.
+    wait_successful_ = 0;
+    io_block_timeout_us_ = 0;
+    io_block_fd_ = -1;
+    io_block_event_ = 0;
+    io_block_seq_ = 0;
+    user_wait_type_ = 0;
+    user_wait_id_ = 0;
+    block_ = NULL;
+    park_state_ = kParkNone;
+    sleep_ns_ = 0;
+    sleep_slack_ns_ = 0;
+    retire_epoch_ = 0;
+}
+
+void Task::Release()
+{
+    fn_ = nullptr;
+    eptr_ = std::exception_ptr();
+    io_block_timer_.reset();
+    debug_info_.clear();
+    wait_fds_.clear();
+
+    if (dedicated_stack_) {
+        StackPool::getInstance().FreeStack(dedicated_stack_, dedicated_stack_size_);
+        dedicated_stack_ = NULL;
+        dedicated_stack_size_ = 0;
+    }
+
+    if (stack_ && stack_capacity_ > kRecycleSegmentMax) {
+        StackPool::getInstance().FreeSegment(stack_, stack_capacity_);
         stack_ = NULL;
+        stack_capacity_ = 0;
     }
 }
 
@@ -78,11 +139,42 @@ void Task::AddIntoProcesser(Processer *proc, char* shared_stack, uint32_t shared
 {
     assert(!proc_);
     proc_ = proc;
-    if (-1 == getcontext(&ctx_)) {
-        state_ = TaskState::fatal;
-        fprintf(stderr, "task(%s) init, getcontext error:%s\n",
-                DebugInfo(), strerror(errno));
-        return ;
+
+#ifndef CO_USE_WINDOWS_FIBER
+    if (stack_mode_ == eCoStackMode::dedicated) {
+        uint32_t size = g_Scheduler.GetOptions().dedicated_stack_size;
+        dedicated_stack_ = StackPool::getInstance().AllocStack(size);
+        if (!dedicated_stack_) {
+            state_ = TaskState::fatal;
+            fprintf(stderr, "task(%s) init, alloc stack error:%s\n",
+                    DebugInfo(), strerror(errno));
+            return ;
+        }
+        dedicated_stack_size_ = size;
+    }
+#endif
+
+    // 独立栈的协程切换时不需要拷贝栈.
+    if (dedicated_stack_) {
+        shared_stack = dedicated_stack_;
+        shared_stack_cap = dedicated_stack_size_;
+    }
+
+#if defined(CO_USE_FCONTEXT)
+    ctx_ = co_make_fcontext(shared_stack + shared_stack_cap, shared_stack_cap, &FContextEntry);
+
+    // save the initial frame written by make_fcontext on the top of the stack.
+    stack_size_ = shared_stack + shared_stack_cap - (char*)ctx_;
+#else
+    // 复用的Task已经初始化过上下文, 不需要再次getcontext.
+    if (!ctx_inited_) {
+        if (-1 == getcontext(&ctx_)) {
+            state_ = TaskState::fatal;
+            fprintf(stderr, "task(%s) init, getcontext error:%s\n",
+                    DebugInfo(), strerror(errno));
+            return ;
+        }
+        ctx_inited_ = true;
     }
 
     ctx_.uc_stack.ss_sp = shared_stack;
@@ -90,12 +182,33 @@ void Task::AddIntoProcesser(Processer *proc, char* shared_stack, uint32_t shared
     ctx_.uc_link = NULL;
     makecontext(&ctx_, (void(*)(void))&C_func, 1, this);
 
-#ifndef CO_USE_WINDOWS_FIBER
+# ifndef CO_USE_WINDOWS_FIBER
     // save coroutine stack first 16 bytes.
-    assert(!stack_);
     stack_size_ = 16;
-    stack_capacity_ = std::max<uint32_t>(16, g_Scheduler.GetOptions().init_stack_size);
-    stack_ = (char*)malloc(stack_capacity_);
+# endif
+#endif
+
+#ifndef CO_USE_WINDOWS_FIBER
+    if (dedicated_stack_) {
+        state_ = TaskState::runnable;
+        return ;
+    }
+
+    // 复用的Task保留了上次使用的栈数据块, 足够大时直接使用.
+    uint32_t capacity = std::max<uint32_t>(stack_size_, g_Scheduler.GetOptions().init_stack_size);
+    if (stack_ && stack_capacity_ < capacity) {
+        StackPool::getInstance().FreeSegment(stack_, stack_capacity_);
+        stack_ = NULL;
+    }
+    if (!stack_) {
+        stack_capacity_ = capacity;
+        stack_ = StackPool::getInstance().AllocSegment(stack_capacity_);
+        if (!stack_) {
+            stack_capacity_ = 0;
+            state_ = TaskState::fatal;
+            return ;
+        }
+    }
     memcpy(stack_, shared_stack + shared_stack_cap - stack_size_, stack_size_);
 #endif
 
@@ -120,16 +233,9 @@ uint64_t Task::GetTaskCount()
     return s_task_count;
 }
 
-void Task::SwapDeleteList(DeleteList &output)
-{
-    std::unique_lock<LFLock> lock(s_delete_list_lock);
-    s_delete_list.swap(output);
-}
-
 std::size_t Task::GetDeletedTaskCount()
 {
-    std::unique_lock<LFLock> lock(s_delete_list_lock);
-    return s_delete_list.size();
+    return TaskPool::getInstance().GetRetiredCount();
 }
 
 void Task::IncrementRef()
@@ -144,12 +250,220 @@ void Task::DecrementRef()
     DebugPrint(dbg_task, "task(%s) DecrementRef ref=%d",
             DebugInfo(), (int)ref_count_);
     if (--ref_count_ == 0) {
-        std::unique_lock<LFLock> lock(s_delete_list_lock);
         assert(!this->prev);
         assert(!this->next);
         assert(!this->check_);
-        s_delete_list.push_back(this);
+        TaskPool::getInstance().Retire(this);
+    }
+}
+
+const std::size_t TaskPool::kLocalFreeMax;
+const std::size_t TaskPool::kTransferBatch;
+const std::size_t TaskPool::kDepotMax;
+
+TaskPool& TaskPool::getInstance()
+{
+    // 不析构, 线程退出和静态对象析构期间仍可能有Task退休.
+    static TaskPool *obj = new TaskPool;
+    return *obj;
+}
+
+static co_thread_local TaskPool::LocalCache *t_task_cache = NULL;
+static co_thread_local bool t_task_cache_released = false;
+
+// 线程退出时将本线程缓存的Task交还全局
+struct TaskCacheOwner
+{
+    TaskPool::LocalCache *cache = NULL;
+
+    ~TaskCacheOwner()
+    {
+        t_task_cache = NULL;
+        t_task_cache_released = true;
+        if (cache)
+            TaskPool::getInstance().ReleaseLocalCache(cache);
+    }
+};
+
+TaskPool::LocalCache* TaskPool::GetLocalCache()
+{
+    if (!t_task_cache && !t_task_cache_released) {
+        static co_thread_local TaskCacheOwner owner;
+        owner.cache = t_task_cache = new LocalCache;
+    }
+
+    return t_task_cache;
+}
+
+void TaskPool::ReleaseLocalCache(LocalCache *cache)
+{
+    if (!cache->retired.empty()) {
+        std::unique_lock<LFLock> lock(orphan_lock_);
+        orphan_count_ += cache->retired.size();
+        orphans_.insert(orphans_.end(), cache->retired.begin(), cache->retired.end());
+    }
+
+    {
+        std::unique_lock<LFLock> lock(depot_lock_);
+        while (!cache->free.empty() && depot_.size() < kDepotMax) {
+            depot_.push_back(cache->free.back());
+            cache->free.pop_back();
+        }
+    }
+
+    for (Task *tk : cache->free)
+        delete tk;
+    delete cache;
+}
+
+Task* TaskPool::Create(TaskF && fn, eCoStackMode stack_mode)
+{
+    Task *tk = NULL;
+    LocalCache *cache = GetLocalCache();
+    if (cache) {
+        if (cache->free.empty()) {
+            std::unique_lock<LFLock> lock(depot_lock_);
+            std::size_t n = (std::min)(depot_.size(), kTransferBatch);
+            cache->free.insert(cache->free.end(), depot_.end() - n, depot_.end());
+            depot_.resize(depot_.size() - n);
+        }
+
+        if (!cache->free.empty()) {
+            tk = cache->free.back();
+            cache->free.pop_back();
+        }
+    } else {
+        std::unique_lock<LFLock> lock(depot_lock_);
+        if (!depot_.empty()) {
+            tk = depot_.back();
+            depot_.pop_back();
+        }
+    }
+
+    if (tk) {
+        tk->Reset(std::move(fn), stack_mode);
+        ++reuse_count_;
+    } else {
+        tk = new Task(std::move(fn), stack_mode);
     }
+
+    ++Task::s_task_count;
+    return tk;
+}
+
+void TaskPool::Retire(Task *tk)
+{
+    tk->retire_epoch_ = epoch_.load();
+    ++retired_count_;
+    DebugPrint(dbg_task, "task(%s) retire at epoch %llu.",
+            tk->DebugInfo(), (long long unsigned)tk->retire_epoch_);
+
+    LocalCache *cache = GetLocalCache();
+    if (cache) {
+        cache->retired.push_back(tk);
+        return ;
+    }
+
+    std::unique_lock<LFLock> lock(orphan_lock_);
+    orphans_.push_back(tk);
+    ++orphan_count_;
+}
+
+void TaskPool::AdvanceEpoch()
+{
+    ++epoch_;
+}
+
+std::size_t TaskPool::Reclaim()
+{
+    uint64_t epoch = epoch_.load();
+    LocalCache *cache = GetLocalCache();
+    std::size_t n = 0;
+    if (cache)
+        n += Reclaim(cache->retired, cache, epoch);
+
+    if (orphan_count_) {
+        // 来自多个线程, epoch不保证有序, 需要逐个检查.
+        std::deque<Task*> ready;
+        {
+            std::unique_lock<LFLock> lock(orphan_lock_);
+            std::size_t c = orphans_.size();
+            for (std::size_t i = 0; i < c; ++i) {
+                Task *tk = orphans_.front();
+                orphans_.pop_front();
+                if (tk->retire_epoch_ < epoch)
+                    ready.push_back(tk);
+                else
+                    orphans_.push_back(tk);
+            }
+            orphan_count_ -= ready.size();
+        }
+        n += Reclaim(ready, cache, epoch);
+    }
+
+    return n;
+}
+
+std::size_t TaskPool::Reclaim(std::deque<Task*> &retired, LocalCache *cache, uint64_t epoch)
+{
+    // 每次只取出一个, 回收时析构协程函数可能再次退休Task.
+    std::size_t n = 0;
+    while (!retired.empty() && retired.front()->retire_epoch_ < epoch) {
+        Task *tk = retired.front();
+        retired.pop_front();
+        Recycle(tk, cache);
+        ++n;
+    }
+    return n;
+}
+
+void TaskPool::Recycle(Task *tk, LocalCache *cache)
+{
+    DebugPrint(dbg_task, "task(%s) delete.", tk->DebugInfo());
+    --retired_count_;
+    --Task::s_task_count;
+
+#if defined(CO_USE_WINDOWS_FIBER)
+    // fiber在makecontext时创建, 不复用.
+    (void)cache;
+    delete tk;
+#else
+    tk->Release();
+    if (!cache) {
+        std::unique_lock<LFLock> lock(depot_lock_);
+        if (depot_.size() < kDepotMax) {
+            depot_.push_back(tk);
+            return ;
+        }
+        lock.unlock();
+        delete tk;
+        return ;
+    }
+
+    cache->free.push_back(tk);
+    if (cache->free.size() <= kLocalFreeMax)
+        return ;
+
+    // 本线程缓存过多, 将最冷的一批转移到全局链表.
+    std::vector<Task*> overflow(cache->free.begin(), cache->free.begin() + kTransferBatch);
+    cache->free.erase(cache->free.begin(), cache->free.begin() + kTransferBatch);
+    std::unique_lock<LFLock> lock(depot_lock_);
+    std::size_t n = (std::min)(kDepotMax - depot_.size(), overflow.size());
+    depot_.insert(depot_.end(), overflow.begin(), overflow.begin() + n);
+    lock.unlock();
+    for (std::size_t i = n; i < overflow.size(); ++i)
+        delete overflow[i];
+#endif
+}
+
+std::size_t TaskPool::GetRetiredCount()
+{
+    return retired_count_;
+}
+
+uint64_t TaskPool::GetReuseCount()
+{
+    return reuse_count_;
 }
 
 } //namespace co
@@ -1,12 +1,14 @@
 #pragma once
 #include <stddef.h>
-#include <ucontext.h>
+#include "context.h"
 #include <functional>
 #include <exception>
 #include <vector>
 #include <list>
+#include <deque>
 #include "ts_queue.h"
 #include "timer.h"
+#include "task_func.h"
 
 namespace co
 {
@@ -19,12 +21,11 @@ enum class TaskState
     sys_block,      // co_mutex, ...
     user_block,     // user switch it.
     sleep,          // sleep nanosleep poll(NULL, 0, timeout)
+    park,           // channel, 等待UnparkTask唤醒
     done,
     fatal,
 };
 
-typedef std::function<void()> TaskF;
-
 struct FdStruct;
 struct Task;
 
@@ -47,6 +48,13 @@ struct FdStruct
     }
 };
 
+// 协程栈的使用方式
+enum class eCoStackMode : uint8_t
+{
+    shared,     // 同一个P中的协程共用一个栈, 切换时拷贝栈上的数据, 节省内存
+    dedicated,  // 每个协程独立mmap一个带保护页的栈, 切换时不拷贝, 适合栈较深的协程
+};
+
 class BlockObject;
 class Processer;
 struct Task
@@ -55,12 +63,20 @@ struct Task
     uint64_t id_;
     TaskState state_ = TaskState::init;
     uint64_t yield_count_ = 0;
+#if defined(CO_USE_FCONTEXT)
+    co_fcontext_t ctx_ = NULL;          // 挂起时的上下文, 位于共享栈上, 随栈一起保存和恢复
+#else
     ucontext_t ctx_;
+    bool ctx_inited_ = false;           // ctx_已getcontext过, 复用时只需makecontext
+#endif
     TaskF fn_;
     Processer* proc_ = NULL;
     char* stack_ = NULL;
     uint32_t stack_size_ = 0;
     uint32_t stack_capacity_ = 0;
+    eCoStackMode stack_mode_ = eCoStackMode::shared;
+    char* dedicated_stack_ = NULL;      // stack_mode_为dedicated时的独立栈
+    uint32_t dedicated_stack_size_ = 0;
     std::string debug_info_;
     std::exception_ptr eptr_;           // 保存exception的指针
     std::atomic<uint32_t> ref_count_{1};// 引用计数
@@ -68,19 +84,37 @@ struct Task
     std::atomic<uint32_t> io_block_id_; // 每次io_block请求分配一个ID
     std::vector<FdStruct> wait_fds_;    // io_block等待的fd列表
     uint32_t wait_successful_ = 0;      // io_block成功等待到的fd数量(用于poll和select)
-    LFLock io_block_lock_;              // 当等待的fd多余1个时, 用此锁sync添加到epoll和从epoll删除的操作, 以防在epoll中残留fd, 导致Task无法释放.
-    int io_block_timeout_ = 0;
+    LFLock io_block_lock_{eLockSite::io_wait}; // 当等待的fd多余1个时, 用此锁sync添加到epoll和从epoll删除的操作, 以防在epoll中残留fd, 导致Task无法释放.
+    int64_t io_block_timeout_us_ = 0;   // io_block的超时时间(微秒), -1表示不超时
     CoTimerPtr io_block_timer_;
+    int io_block_fd_ = -1;              // 以边缘触发方式等待的单个fd, 为-1时表示等待wait_fds_
+    uint32_t io_block_event_ = 0;       // io_block_fd_等待的事件(EPOLLIN或EPOLLOUT)
+    uint32_t io_block_seq_ = 0;         // 调用syscall前io_block_fd_的就绪计数
 
     int64_t user_wait_type_ = 0;        // user_block等待的类型
     uint64_t user_wait_id_ = 0;         // user_block等待的id
     BlockObject* block_ = NULL;         // sys_block等待的block对象
 
-    int sleep_ms_ = 0;                  // 睡眠时间
+    int64_t sleep_ns_ = 0;              // 睡眠时间(纳秒)
+    int64_t sleep_slack_ns_ = 0;        // 睡眠时间允许的延后量(纳秒)
+
+    // ParkSwitch与UnparkTask之间的握手状态
+    static const uint32_t kParkNone = 0;
+    static const uint32_t kParkNotified = 1;    // 已被唤醒, 下次ParkSwitch直接返回
+    static const uint32_t kParkParked = 2;      // 已挂起, 等待唤醒
+    std::atomic<uint32_t> park_state_{kParkNone};
 
-    explicit Task(TaskF const& fn);
+    uint64_t retire_epoch_ = 0;         // 引用计数归0时的epoch
+
+    Task(TaskF && fn, eCoStackMode stack_mode);
     ~Task();
 
+    // 复用一个已回收的Task, 保留其栈数据块和已初始化的上下文.
+    void Reset(TaskF && fn, eCoStackMode stack_mode);
+
+    // 回收时释放协程函数等资源, 过大的栈数据块和独立栈归还给栈内存池.
+    void Release();
+
     void AddIntoProcesser(Processer *proc, char* shared_stack, uint32_t shared_stack_cap);
 
     void SetDebugInfo(std::string const& info);
@@ -93,13 +127,85 @@ struct Task
     void DecrementRef();
     static uint64_t GetTaskCount();
 
-    // Task引用计数归0时不要立即释放, 以防epoll_wait取到残余数据时访问野指针.
-    typedef std::list<Task*> DeleteList;
-    static DeleteList s_delete_list;
-    static LFLock s_delete_list_lock;
-
-    static void SwapDeleteList(DeleteList &output);
+    // 引用计数已归0, 尚未回收的Task数量
     static std::size_t GetDeletedTaskCount();
+
+    // 回收时保留的栈数据块上限, 更大的归还给栈内存池.
+    static const uint32_t kRecycleSegmentMax = 64 * 1024;
+};
+
+struct TaskCacheOwner;
+
+// Task对象池
+//   每个线程缓存一批回收的Task, 创建协程时优先复用, 省去Task的构造析构、
+//   栈数据块的分配和上下文的初始化; 线程间不平衡时经由全局的空闲链表批量转移.
+//   Task引用计数归0时不能立即回收, 以防epoll_wait取到残余数据时访问野指针:
+//   退休的Task挂在所在线程的待回收队列上, 并记下当时的epoch,
+//   epoll每处理完一轮结果推进一次epoch, epoch推进之后才可以安全回收.
+//   各线程在Run中只回收自己的队列, 不需要全局锁; 线程退出时未回收的转交给全局队列.
+class TaskPool
+{
+public:
+    static TaskPool& getInstance();
+
+    // 创建或复用一个Task
+    Task* Create(TaskF && fn, eCoStackMode stack_mode);
+
+    // Task引用计数归0时调用
+    void Retire(Task *tk);
+
+    // epoll处理完一轮结果后调用, 此前退休的Task都不会再被访问.
+    void AdvanceEpoch();
+
+    // 回收本线程和已退出线程留下的可以安全回收的Task, 返回回收的数量.
+    std::size_t Reclaim();
+
+    // 已退休尚未回收的Task数量
+    std::size_t GetRetiredCount();
+
+    // 复用Task的次数
+    uint64_t GetReuseCount();
+
+    struct LocalCache
+    {
+        std::deque<Task*> retired;  // 按退休顺序排列, epoch单调不减
+        std::vector<Task*> free;    // 末尾最热
+    };
+
+private:
+    TaskPool() = default;
+    TaskPool(TaskPool const&) = delete;
+    TaskPool& operator=(TaskPool const&) = delete;
+
+    static const std::size_t kLocalFreeMax = 256;   // 每个线程最多缓存的空闲Task
+    static const std::size_t kTransferBatch = 64;   // 线程与全局链表之间每次转移的数量
+    static const std::size_t kDepotMax = 4096;      // 全局空闲链表上限, 超出的直接释放
+
+    // 获取本线程的缓存, 线程退出后返回NULL.
+    LocalCache* GetLocalCache();
+
+    // 线程退出时交还缓存
+    void ReleaseLocalCache(LocalCache *cache);
+
+    std::size_t Reclaim(std::deque<Task*> &retired, LocalCache *cache, uint64_t epoch);
+
+    // 回收一个Task放入空闲链表
+    void Recycle(Task *tk, LocalCache *cache);
+
+    std::atomic<uint64_t> epoch_{1};
+    std::atomic<std::size_t> retired_count_{0};
+    std::atomic<uint64_t> reuse_count_{0};
+
+    // 已退出线程留下的待回收Task
+    LFLock orphan_lock_{eLockSite::task_pool};
+    std::deque<Task*> orphans_;
+    std::atomic<std::size_t> orphan_count_{0};
+
+    // 线程间转移空闲Task的全局链表
+    LFLock depot_lock_{eLockSite::task_pool};
+    std::vector<Task*> depot_;
+
+    friend struct TaskCacheOwner;
 };
 
 template <typename T = Task>
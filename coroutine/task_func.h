@@ -0,0 +1,174 @@
+#pragma once
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+namespace co
+{
+
+// 协程函数
+//   与std::function<void()>相比:
+//     1.只能移动不能拷贝, 可以捕获unique_ptr等只能移动的对象, 捕获的shared_ptr也不会被拷贝;
+//     2.内置64bytes的存储空间, 捕获不超过这个大小的函数对象直接构造在其中, 不分配内存.
+//   超过内置空间、对齐要求过高或移动构造可能抛出异常的函数对象才会在堆上分配,
+//   因此TaskF的移动不会抛出异常, 放在vector等容器中扩容时也会移动而不是拷贝.
+class TaskF
+{
+public:
+    static const std::size_t kInlineSize = 64;
+
+    TaskF() : ops_(NULL) {}
+    TaskF(std::nullptr_t) : ops_(NULL) {}
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, TaskF>::value>::type>
+    TaskF(F && f) : ops_(NULL)
+    {
+        Construct<typename std::decay<F>::type>(std::forward<F>(f));
+    }
+
+    TaskF(TaskF && other) noexcept : ops_(other.ops_)
+    {
+        if (ops_) {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = NULL;
+        }
+    }
+
+    TaskF& operator=(TaskF && other) noexcept
+    {
+        if (this != &other) {
+            Reset();
+            if (other.ops_) {
+                other.ops_->move(&storage_, &other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = NULL;
+            }
+        }
+        return *this;
+    }
+
+    TaskF& operator=(std::nullptr_t)
+    {
+        Reset();
+        return *this;
+    }
+
+    TaskF(TaskF const&) = delete;
+    TaskF& operator=(TaskF const&) = delete;
+
+    ~TaskF()
+    {
+        Reset();
+    }
+
+    void operator()()
+    {
+        ops_->invoke(&storage_);
+    }
+
+    explicit operator bool() const
+    {
+        return ops_ != NULL;
+    }
+
+    // 函数对象是否保存在内置空间中
+    bool IsInline() const
+    {
+        return ops_ && ops_->is_inline;
+    }
+
+private:
+    typedef typename std::aligned_storage<kInlineSize>::type Storage;
+
+    struct Ops
+    {
+        void (*invoke)(void *storage);
+        void (*move)(void *dst, void *src);     // 移动后销毁src中的对象
+        void (*destroy)(void *storage);
+        bool is_inline;
+    };
+
+    template <typename F>
+    struct InlineOps
+    {
+        static void invoke(void *storage)
+        {
+            (*static_cast<F*>(storage))();
+        }
+        static void move(void *dst, void *src)
+        {
+            F *f = static_cast<F*>(src);
+            ::new (dst) F(std::move(*f));
+            f->~F();
+        }
+        static void destroy(void *storage)
+        {
+            static_cast<F*>(storage)->~F();
+        }
+        static Ops const* get()
+        {
+            static const Ops ops = {&invoke, &move, &destroy, true};
+            return &ops;
+        }
+    };
+
+    // 内置空间中只保存指针
+    template <typename F>
+    struct HeapOps
+    {
+        static void invoke(void *storage)
+        {
+            (**static_cast<F**>(storage))();
+        }
+        static void move(void *dst, void *src)
+        {
+            *static_cast<F**>(dst) = *static_cast<F**>(src);
+        }
+        static void destroy(void *storage)
+        {
+            delete *static_cast<F**>(storage);
+        }
+        static Ops const* get()
+        {
+            static const Ops ops = {&invoke, &move, &destroy, false};
+            return &ops;
+        }
+    };
+
+    template <typename F>
+    struct FitsInline : std::integral_constant<bool,
+        sizeof(F) <= kInlineSize &&
+        std::alignment_of<Storage>::value % std::alignment_of<F>::value == 0 &&
+        std::is_nothrow_move_constructible<F>::value>
+    {};
+
+    template <typename F, typename Arg>
+    void Construct(Arg && f, typename std::enable_if<FitsInline<F>::value>::type* = NULL)
+    {
+        ::new (&storage_) F(std::forward<Arg>(f));
+        ops_ = InlineOps<F>::get();
+    }
+
+    template <typename F, typename Arg>
+    void Construct(Arg && f, typename std::enable_if<!FitsInline<F>::value>::type* = NULL)
+    {
+        *reinterpret_cast<F**>(&storage_) = new F(std::forward<Arg>(f));
+        ops_ = HeapOps<F>::get();
+    }
+
+    void Reset()
+    {
+        if (ops_) {
+            Ops const* ops = ops_;
+            ops_ = NULL;
+            ops->destroy(&storage_);
+        }
+    }
+
+    Ops const* ops_;
+    Storage storage_;
+};
+
+} //namespace co
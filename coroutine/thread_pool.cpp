@@ -1,6 +1,6 @@
 #include "thread_pool.h"
-#include <unistd.h>
 #include "scheduler.h"
+#include "platform_adapter.h"
 
 namespace co {
 
@@ -19,18 +19,30 @@ uint32_t ThreadPool::Run()
     while ((elem = elem_list_.pop())) {
         elem->Do();
         delete elem;
+        ++c;
     }
 
     if (!c) {
-        uint8_t sleep_ms = (std::min)(sleep_ms_++, g_Scheduler.GetOptions().max_sleep_ms);
-        usleep(sleep_ms * 1000);
-    } else {
-        sleep_ms_ = 0;
+        // 先登记再检查队列, 与Unpark中的先入队再检查登记数相对应, 避免丢失唤醒.
+        uint32_t seq = park_seq_.load();
+        ++parked_count_;
+        if (elem_list_.empty())
+            FutexWait(&park_seq_, seq, (int64_t)g_Scheduler.GetOptions().max_sleep_ms * 1000);
+        --parked_count_;
     }
 
     return c;
 }
 
+void ThreadPool::Unpark()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_count_ == 0) return ;
+
+    ++park_seq_;
+    FutexWake(&park_seq_, 1);
+}
+
 void ThreadPool::RunLoop()
 {
     for (;;)
@@ -51,7 +51,13 @@ class ThreadPool
 {
     typedef TSQueue<TPElemBase> ElemList;
     ElemList elem_list_;
-    std::atomic<uint8_t> sleep_ms_{0};
+
+    // 没有任务时线程休眠等待的futex, 每次唤醒时递增
+    std::atomic<uint32_t> park_seq_{0};
+    std::atomic<uint32_t> parked_count_{0};
+
+    // 唤醒一个休眠中的线程
+    void Unpark();
 
 public:
     ~ThreadPool();
@@ -65,6 +71,7 @@ public:
     {
         TPElemBase *elem = new TPElem<R>(ch, fn);
         this->elem_list_.push(elem);
+        this->Unpark();
     }
 };
 
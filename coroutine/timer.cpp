@@ -1,11 +1,20 @@
 #include "timer.h"
+#include "platform_adapter.h"
 #include <mutex>
+#include <algorithm>
+#include <assert.h>
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
 
 namespace co
 {
 
 std::atomic<uint64_t> CoTimer::s_id{0};
 
+// 本线程缓存的当前时间: 0表示不在调度中, -1表示本轮调度尚未读取时钟.
+static co_thread_local int64_t t_cached_now = 0;
+
 CoTimer::CoTimer(fn_t const& fn)
     : id_(++s_id), fn_(fn), active_(true)
 {}
@@ -47,21 +56,285 @@ bool CoTimer::BlockCancel()
     return true;
 }
 
+static inline int CountTrailingZeros(uint64_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+TimingWheel::TimingWheel()
+    : cur_tick_(ToTick(CoTimerMgr::Now()))
+{}
+
+uint64_t TimingWheel::ToTick(TimePoint const& tp)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+    return ns > 0 ? (uint64_t)ns >> kTickShift : 0;
+}
+
+TimingWheel::TimePoint TimingWheel::FromTick(uint64_t tick)
+{
+    return TimePoint(std::chrono::duration_cast<TimePoint::duration>(
+                std::chrono::nanoseconds(tick << kTickShift)));
+}
+
+void TimingWheel::Link(CoTimer *timer, int level, int index)
+{
+    CoTimer *&head = slots_[level][index];
+    timer->level_ = level;
+    timer->index_ = index;
+    timer->prev_ = NULL;
+    timer->next_ = head;
+    if (head) head->prev_ = timer;
+    head = timer;
+    bitmap_[level] |= (uint64_t)1 << index;
+}
+
+void TimingWheel::Unlink(CoTimer *timer)
+{
+    CoTimer *&head = slots_[timer->level_][timer->index_];
+    if (timer->prev_)
+        timer->prev_->next_ = timer->next_;
+    else
+        head = timer->next_;
+    if (timer->next_)
+        timer->next_->prev_ = timer->prev_;
+    if (!head)
+        bitmap_[timer->level_] &= ~((uint64_t)1 << timer->index_);
+    timer->prev_ = timer->next_ = NULL;
+    timer->level_ = -1;
+}
+
+void TimingWheel::Place(CoTimer *timer)
+{
+    // 已过期的放在当前tick的槽中, 下次推进时取出.
+    uint64_t tick = ToTick(timer->next_time_point_);
+    if (tick < cur_tick_) tick = cur_tick_;
+
+    // 第level层的槽覆盖64^level个tick, 选能容纳距离的最低层.
+    uint64_t delta = tick - cur_tick_;
+    int level = 0;
+    while (level < kLevels - 1 && delta >= (uint64_t)1 << (kSlotBits * (level + 1)))
+        ++level;
+
+    // 超出时间轮范围的先截断
+    const uint64_t max_delta = ((uint64_t)1 << (kSlotBits * kLevels)) - 1;
+    if (delta > max_delta)
+        tick = cur_tick_ + max_delta;
+
+    int index = (int)((tick >> (kSlotBits * level)) & (kSlots - 1));
+    Link(timer, level, index);
+}
+
+void TimingWheel::Insert(CoTimer *timer)
+{
+    assert(timer->level_ == -1);
+    Place(timer);
+    ++count_;
+}
+
+void TimingWheel::Erase(CoTimer *timer)
+{
+    assert(timer->level_ != -1);
+    Unlink(timer);
+    --count_;
+}
+
+CoTimer* TimingWheel::Detach(int level, int index)
+{
+    CoTimer *list = slots_[level][index];
+    slots_[level][index] = NULL;
+    bitmap_[level] &= ~((uint64_t)1 << index);
+    return list;
+}
+
+bool TimingWheel::NextSlot(uint64_t &tick, int &level)
+{
+    bool found = false;
+    for (int l = 0; l < kLevels; ++l) {
+        if (!bitmap_[l]) continue;
+
+        // 最低层当前的槽就是当前tick; 高层当前的槽已展开, 其中的定时器在下一圈.
+        int shift = kSlotBits * l;
+        uint64_t bucket = cur_tick_ >> shift;
+        int start = (int)(bucket & (kSlots - 1));
+        if (l > 0) start = (start + 1) & (kSlots - 1);
+        uint64_t bits = bitmap_[l];
+        if (start) bits = (bits >> start) | (bits << (kSlots - start));
+        uint64_t distance = CountTrailingZeros(bits) + (l > 0 ? 1 : 0);
+
+        // 同时展开时优先取高层, 其中可能有更早的定时器.
+        uint64_t t = (bucket + distance) << shift;
+        if (!found || t <= tick) {
+            tick = t;
+            level = l;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+CoTimer* TimingWheel::PopExpired(TimePoint const& now, uint32_t n, uint32_t &count)
+{
+    uint64_t now_tick = ToTick(now);
+    uint32_t c = 0;
+    CoTimer *head = NULL, *tail = NULL;
+    for (;;) {
+        // 取出当前tick的槽, 未到时间的(只可能在now所在的tick)和超出数量的放回.
+        int index = (int)(cur_tick_ & (kSlots - 1));
+        CoTimer *timer = Detach(0, index);
+        while (timer) {
+            CoTimer *next = timer->next_;
+            timer->prev_ = timer->next_ = NULL;
+            timer->level_ = -1;
+            if (c < n && timer->next_time_point_ <= now) {
+                --count_;
+                ++c;
+                if (tail)
+                    tail->next_ = timer;
+                else
+                    head = timer;
+                tail = timer;
+            } else {
+                Place(timer);
+            }
+            timer = next;
+        }
+
+        if (c >= n || cur_tick_ >= now_tick)
+            break;
+
+        // 跳到下一个非空的槽, 不超过now.
+        uint64_t next_tick;
+        int level;
+        if (!NextSlot(next_tick, level) || next_tick > now_tick)
+            next_tick = now_tick;
+        cur_tick_ = next_tick;
+
+        // 进入高层的一个槽时, 从高到低逐层展开到下一层.
+        for (int l = kLevels - 1; l > 0; --l) {
+            int shift = kSlotBits * l;
+            if (cur_tick_ & (((uint64_t)1 << shift) - 1))
+                continue;
+
+            CoTimer *list = Detach(l, (int)((cur_tick_ >> shift) & (kSlots - 1)));
+            while (list) {
+                CoTimer *next = list->next_;
+                list->prev_ = list->next_ = NULL;
+                list->level_ = -1;
+                Place(list);
+                list = next;
+            }
+        }
+    }
+
+    count = c;
+    return head;
+}
+
+bool TimingWheel::GetNextDeadline(TimePoint &deadline)
+{
+    uint64_t tick;
+    int level;
+    if (!NextSlot(tick, level))
+        return false;
+
+    if (level > 0) {
+        deadline = FromTick(tick);
+        return true;
+    }
+
+    // 最低层的槽只覆盖一个tick, 取其中最早的.
+    CoTimer *timer = slots_[0][tick & (kSlots - 1)];
+    deadline = timer->next_time_point_;
+    for (timer = timer->next_; timer; timer = timer->next_)
+        if (timer->next_time_point_ < deadline)
+            deadline = timer->next_time_point_;
+    return true;
+}
+
 CoTimerMgr::CoTimerMgr()
 {}
 
 CoTimerMgr::~CoTimerMgr()
 {
+    // 打断时间轮中定时器对自身的引用
+    for (uint32_t i = 0; i < kShards; ++i) {
+        uint32_t c = 0;
+        CoTimer *timer = shards_[i].wheel_.PopExpired(TimePoint::max(), (uint32_t)-1, c);
+        while (timer) {
+            CoTimer *next = timer->next_;
+            timer->next_ = NULL;
+            CoTimerPtr self;
+            self.swap(timer->self_);
+            timer = next;
+        }
+    }
+}
+
+int64_t CoTimerMgr::ToNs(TimePoint const& tp)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+}
 
+void CoTimerMgr::Shard::UpdateNext()
+{
+    TimePoint next;
+    next_ns_.store(wheel_.GetNextDeadline(next) ? ToNs(next) : kNoDeadline,
+            std::memory_order_relaxed);
 }
 
-CoTimerPtr CoTimerMgr::ExpireAt(TimePoint const& time_point, CoTimer::fn_t const& fn)
+uint32_t CoTimerMgr::LocalShard()
 {
-    std::unique_lock<LFLock> lock(lock_);
-    CoTimerPtr sptr(new CoTimer(fn));
-    sptr->next_time_point_ = time_point;
-    timers_[sptr->GetId()] = sptr;
-    deadlines_.insert(std::make_pair(time_point, sptr));
+    static std::atomic<uint32_t> s_next{0};
+    static co_thread_local uint32_t t_shard = 0;
+    if (!t_shard)
+        t_shard = s_next++ % kShards + 1;
+    return t_shard - 1;
+}
+
+CoTimerMgr::TimePoint CoTimerMgr::Coalesce(TimePoint const& time_point, Slack slack)
+{
+    // 不足一个tick的slack不对齐, 时间轮本身的精度已是一个tick.
+    int64_t s = slack.count();
+    if (s < ((int64_t)1 << TimingWheel::kTickShift))
+        return time_point;
+
+    int64_t g = 1;
+    while (g <= s / 2)
+        g <<= 1;
+
+    // 向上对齐到g, 对齐后的延后量小于g, 不超过slack.
+    int64_t ns = ToNs(time_point);
+    if (ns > (std::numeric_limits<int64_t>::max)() - g)
+        return time_point;
+
+    ns = (ns + g - 1) & ~(g - 1);
+    return TimePoint(std::chrono::duration_cast<TimePoint::duration>(
+                std::chrono::nanoseconds(ns)));
+}
+
+CoTimerPtr CoTimerMgr::ExpireAt(TimePoint const& time_point, CoTimer::fn_t const& fn,
+        Slack slack)
+{
+    CoTimerPtr sptr = std::make_shared<CoTimer>(fn);
+    sptr->next_time_point_ = Coalesce(time_point, slack);
+    sptr->self_ = sptr;
+    sptr->mgr_ = this;
+    sptr->shard_ = LocalShard();
+
+    int64_t ns = ToNs(sptr->next_time_point_);
+    Shard &shard = shards_[sptr->shard_];
+    std::unique_lock<LFLock> lock(shard.lock_);
+    shard.wheel_.Insert(sptr.get());
+    if (ns < shard.next_ns_.load(std::memory_order_relaxed))
+        shard.next_ns_.store(ns, std::memory_order_relaxed);
     return sptr;
 }
 
@@ -81,41 +354,78 @@ bool CoTimerMgr::BlockCancel(CoTimerPtr co_timer_ptr)
 
 void CoTimerMgr::__Cancel(CoTimerPtr co_timer_ptr)
 {
-    uint64_t timer_id = co_timer_ptr->GetId();
-
-    std::unique_lock<LFLock> lock(lock_);
-    Timers::iterator timers_it = timers_.find(timer_id);
-    if (timers_.end() == timers_it)
+    // 解锁后再释放自身的引用, 以免在锁内析构回调函数.
+    //   IO超时的定时器由Scheduler撤销, 不一定属于this.
+    CoTimerPtr self;
+    Shard &shard = co_timer_ptr->mgr_->shards_[co_timer_ptr->shard_];
+    std::unique_lock<LFLock> lock(shard.lock_);
+    if (co_timer_ptr->level_ == -1)
         return ;
 
-    timers_.erase(timers_it);
+    shard.wheel_.Erase(co_timer_ptr.get());
+    if (!shard.wheel_.size())
+        shard.next_ns_.store(kNoDeadline, std::memory_order_relaxed);
+    self.swap(co_timer_ptr->self_);
+}
 
-    auto range = deadlines_.equal_range(co_timer_ptr->next_time_point_);
-    for (auto it = range.first; it != range.second; ++it) {
-        if (it->second == co_timer_ptr) {
-            deadlines_.erase(it);
-            break;
+uint32_t CoTimerMgr::RunExpired(uint32_t n)
+{
+    // 先处理本线程的分片, 其他分片正被别的线程处理时跳过.
+    uint32_t c = 0;
+    uint32_t local = LocalShard();
+    TimePoint now;
+    int64_t now_ns = kNoDeadline;
+    for (uint32_t k = 0; k < kShards && c < n; ++k) {
+        Shard &shard = shards_[(local + k) % kShards];
+        int64_t next_ns = shard.next_ns_.load(std::memory_order_relaxed);
+        if (next_ns == kNoDeadline)
+            continue;
+
+        if (now_ns == kNoDeadline) {
+            now = CachedNow();
+            now_ns = ToNs(now);
+        }
+        if (next_ns > now_ns)
+            continue;
+
+        std::unique_lock<LFLock> lock(shard.lock_, std::defer_lock);
+        if (k == 0)
+            lock.lock();
+        else if (!lock.try_lock())
+            continue;
+
+        uint32_t popped = 0;
+        CoTimer *timer = shard.wheel_.PopExpired(now, n - c, popped);
+        shard.UpdateNext();
+        lock.unlock();
+        c += popped;
+
+        // 在锁外执行, 回调中可以再添加、撤销定时器.
+        while (timer) {
+            CoTimer *next = timer->next_;
+            timer->next_ = NULL;
+            CoTimerPtr sp_timer;
+            sp_timer.swap(timer->self_);
+            (*sp_timer)();
+            timer = next;
         }
     }
+
+    return c;
 }
 
-uint32_t CoTimerMgr::GetExpired(std::list<CoTimerPtr> &result, uint32_t n)
+bool CoTimerMgr::GetNextDeadline(TimePoint &deadline)
 {
-    std::unique_lock<LFLock> lock(lock_);
-    TimePoint now = Now();
-    auto it = deadlines_.begin();
-    for (; it != deadlines_.end() && n > 0; --n, ++it)
-    {
-        if (it->first > now) {
-            break;
-        }
+    int64_t next_ns = kNoDeadline;
+    for (uint32_t i = 0; i < kShards; ++i)
+        next_ns = (std::min)(next_ns, shards_[i].next_ns_.load(std::memory_order_relaxed));
 
-        result.push_back(it->second);
-        timers_.erase(it->second->GetId());
-    }
+    if (next_ns == kNoDeadline)
+        return false;
 
-    deadlines_.erase(deadlines_.begin(), it);
-    return result.size();
+    deadline = TimePoint(std::chrono::duration_cast<TimePoint::duration>(
+                std::chrono::nanoseconds(next_ns)));
+    return true;
 }
 
 CoTimerMgr::TimePoint CoTimerMgr::Now()
@@ -123,5 +433,30 @@ CoTimerMgr::TimePoint CoTimerMgr::Now()
     return TimePoint::clock::now();
 }
 
+CoTimerMgr::TimePoint CoTimerMgr::CachedNow()
+{
+    if (!t_cached_now)
+        return Now();
+
+    if (t_cached_now == -1) {
+        TimePoint now = Now();
+        t_cached_now = (int64_t)now.time_since_epoch().count();
+        return now;
+    }
+
+    return TimePoint(TimePoint::duration(t_cached_now));
+}
+
+CoTimerMgr::CachedNowScope::CachedNowScope()
+    : prev_(t_cached_now)
+{
+    t_cached_now = -1;
+}
+
+CoTimerMgr::CachedNowScope::~CachedNowScope()
+{
+    t_cached_now = prev_;
+}
+
 
 } //namespace co
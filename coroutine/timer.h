@@ -1,15 +1,15 @@
 #pragma once
-#include <map>
 #include <functional>
 #include <chrono>
 #include <memory>
-#include <vector>
-#include <list>
+#include <limits>
 #include "spinlock.h"
 
 namespace co
 {
 
+class CoTimerMgr;
+
 class CoTimer
 {
 public:
@@ -27,47 +27,170 @@ private:
     static std::atomic<uint64_t> s_id;
     fn_t fn_;
     bool active_;
-    LFLock fn_lock_;
+    LFLock fn_lock_{eLockSite::timer};
     TimePoint next_time_point_;
 
+    // 时间轮中的侵入式链表节点, 由所在分片的锁保护.
+    std::shared_ptr<CoTimer> self_;     // 在时间轮中时持有自身的引用
+    CoTimer *prev_ = NULL;
+    CoTimer *next_ = NULL;
+    int level_ = -1;                    // 所在的层, 不在时间轮中时为-1
+    int index_ = 0;                     // 所在的槽
+    CoTimerMgr *mgr_ = NULL;            // 所属的管理器
+    uint32_t shard_ = 0;                // 所在的分片
+
     friend class CoTimerMgr;
+    friend class TimingWheel;
 };
 typedef std::shared_ptr<CoTimer> CoTimerPtr;
 typedef CoTimerPtr TimerId;
 
+// 分层时间轮
+//   最低层每个tick为2^16ns(约65.5us), 每层64个槽, 共6层, 约可覆盖52天,
+//   更远的定时器先截断放在最高层, 展开时按真实的触发时间重新放入.
+//   插入、删除都是O(1); 每层用一个位图记录非空的槽, 推进时直接跳过空槽.
+//   最低层当前tick的槽中只取出已到触发时间的定时器, 因此触发时间是精确的.
+//   本身不加锁, 由CoTimerMgr的分片锁保护.
+class TimingWheel
+{
+public:
+    typedef CoTimer::TimePoint TimePoint;
+
+    static const int kTickShift = 16;
+    static const int kSlotBits = 6;
+    static const int kSlots = 1 << kSlotBits;
+    static const int kLevels = 6;
+
+    TimingWheel();
+
+    void Insert(CoTimer *timer);
+    void Erase(CoTimer *timer);
+
+    // 推进到now, 取出至多n个到期的定时器, 经next_串成链表返回, 取出的个数存入count.
+    //   链表中的定时器仍由self_持有自身的引用.
+    CoTimer* PopExpired(TimePoint const& now, uint32_t n, uint32_t &count);
+
+    // 最近一个定时器的触发时间, 没有定时器时返回false.
+    //   最近的定时器还在高层时返回它所在的槽展开的时间, 不晚于其触发时间.
+    bool GetNextDeadline(TimePoint &deadline);
+
+    std::size_t size() const { return count_; }
+
+private:
+    static uint64_t ToTick(TimePoint const& tp);
+    static TimePoint FromTick(uint64_t tick);
+
+    void Link(CoTimer *timer, int level, int index);
+    void Unlink(CoTimer *timer);
+
+    // 按触发时间放入对应的层和槽
+    void Place(CoTimer *timer);
+
+    // 取下一个槽中的所有定时器
+    CoTimer* Detach(int level, int index);
+
+    // 下一个非空槽开始的tick和所在的层
+    bool NextSlot(uint64_t &tick, int &level);
+
+private:
+    uint64_t cur_tick_;             // 此前的tick都已处理完
+    std::size_t count_ = 0;
+    uint64_t bitmap_[kLevels] = {};
+    CoTimer* slots_[kLevels][kSlots] = {};
+};
+
 // 定时器管理
+//   定时器按添加时所在的线程分散到多个分片中, 每个分片一个时间轮和一把锁,
+//   多个线程同时添加、撤销定时器时不会争用同一把锁.
+//   调度器的用户定时器、睡眠和IO超时共用一个CoTimerMgr.
 class CoTimerMgr
 {
 public:
-    typedef std::map<uint64_t, CoTimerPtr> Timers;
     typedef std::chrono::time_point<std::chrono::high_resolution_clock> TimePoint;
-    typedef std::multimap<TimePoint, CoTimerPtr> DeadLines;
+    typedef std::chrono::nanoseconds Slack;
+
+    static const uint32_t kShards = 8;
 
     CoTimerMgr();
 	~CoTimerMgr();
 
-    CoTimerPtr ExpireAt(TimePoint const& time_point, CoTimer::fn_t const& fn);
+    // 添加定时器, 不早于time_point触发.
+    //   slack: 允许延后触发的量, 触发时间在[time_point, time_point + slack]之内.
+    //   触发时间向上对齐到不超过slack的2的幂(ns), 相近的定时器对齐到同一时刻,
+    //   落入时间轮的同一个槽中一次取出, 大量超时定时器共用一次唤醒.
+    CoTimerPtr ExpireAt(TimePoint const& time_point, CoTimer::fn_t const& fn,
+            Slack slack = Slack::zero());
 
     template <typename Duration>
-    CoTimerPtr ExpireAt(Duration const& duration, CoTimer::fn_t const& fn)
+    CoTimerPtr ExpireAt(Duration const& duration, CoTimer::fn_t const& fn,
+            Slack slack = Slack::zero())
     {
-        return ExpireAt(Now() + duration, fn);
+        return ExpireAt(Now() + duration, fn, slack);
     }
 
     bool Cancel(CoTimerPtr co_timer_ptr);
     bool BlockCancel(CoTimerPtr co_timer_ptr);
 
-    uint32_t GetExpired(std::list<CoTimerPtr> &result, uint32_t n = 1);
+    // 执行至多n个到期的定时器, 返回执行的个数.
+    //   没有定时器到期时不加锁, 没有定时器时也不读时钟.
+    uint32_t RunExpired(uint32_t n = 1);
 
+    // 获取最近一个定时器的触发时间, 没有定时器时返回false.
+    //   不加锁, 只读各分片记录的值. 撤销定时器后可能返回更早的时间.
+    bool GetNextDeadline(TimePoint &deadline);
+
+    // 读取时钟
     static TimePoint Now();
 
+    // 调度器内部使用的当前时间
+    //   在Scheduler::Run中时, 每轮调度只在第一次调用时读取时钟, 之后返回缓存值;
+    //   不在Run中时同Now(). 缓存值可能偏早, 偏差不超过本轮调度已执行协程的时间,
+    //   只用于判断定时器是否到期、计算休眠时长(偏早只会推迟触发); 用户给出的相对
+    //   时长(睡眠、超时)必须以Now()计算截止时间, 否则协程执行一段时间后再睡眠会提前醒来.
+    //   定时器支持亚毫秒精度, 因此不使用CLOCK_MONOTONIC_COARSE(精度为一个jiffy).
+    static TimePoint CachedNow();
+
+    // 在作用域内开启本线程的时间缓存, 由Scheduler::Run在每轮调度中使用;
+    //   离开作用域(包括抛出异常)时恢复原先的状态.
+    class CachedNowScope
+    {
+    public:
+        CachedNowScope();
+        ~CachedNowScope();
+
+        CachedNowScope(CachedNowScope const&) = delete;
+        CachedNowScope& operator=(CachedNowScope const&) = delete;
+
+    private:
+        int64_t prev_;
+    };
+
 private:
     void __Cancel(CoTimerPtr co_timer_ptr);
 
+    // 当前线程添加定时器时使用的分片
+    static uint32_t LocalShard();
+
+    static int64_t ToNs(TimePoint const& tp);
+
+    // 按slack对齐后的触发时间
+    static TimePoint Coalesce(TimePoint const& time_point, Slack slack);
+
 private:
-    Timers timers_;
-    DeadLines deadlines_;
-    LFLock lock_;
+    static const int64_t kNoDeadline = (std::numeric_limits<int64_t>::max)();
+
+    struct Shard
+    {
+        LFLock lock_{eLockSite::timer};
+        TimingWheel wheel_;
+
+        // 最近的触发时间(ns), 没有定时器时为kNoDeadline, 可以不加锁读取.
+        //   只保证不晚于真实值: 插入时取较小值, 取出到期定时器后重新计算.
+        std::atomic<int64_t> next_ns_{kNoDeadline};
+
+        void UpdateNext();
+    };
+    Shard shards_[kShards];
 };
 
 
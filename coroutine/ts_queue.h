@@ -1,5 +1,12 @@
 #pragma once
 #include <mutex>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <iterator>
+#include <utility>
+#include <stdint.h>
+#include <thread>
 #include <assert.h>
 #include "spinlock.h"
 
@@ -67,6 +74,24 @@ public:
         -- count_;
         return it;
     }
+    // 在pos之前插入, pos为end()时插入到尾部.
+    iterator insert(iterator pos, T* element)
+    {
+        TSQueueHook *hook = static_cast<TSQueueHook*>(element);
+        hook->check_ = check_;
+        hook->next = pos.ptr;
+        if (pos.ptr) {
+            hook->prev = pos.ptr->prev;
+            pos.ptr->prev = hook;
+        } else {
+            hook->prev = tail_;
+            tail_ = hook;
+        }
+        if (hook->prev) hook->prev->next = hook;
+        else head_ = hook;
+        ++ count_;
+        return iterator(hook);
+    }
     std::size_t size() const
     {
         return count_;
@@ -89,7 +114,8 @@ class TSQueue
     std::size_t count_;
 
 public:
-    TSQueue()
+    explicit TSQueue(eLockSite site = eLockSite::ts_queue)
+        : lck(site)
     {
         head_ = tail_ = new TSQueueHook;
         count_ = 0;
@@ -208,4 +234,377 @@ public:
 };
 
 
+// 无锁的多生产者单消费者队列
+//   生产者以一次CAS将元素压入链表头, 除非与其他生产者同时入队, 否则不会重试;
+//   消费者以一次原子交换取走全部元素, 再反转为先进先出的顺序.
+//   只支持push和pop_all, pop_all和push(SList)只能由唯一的消费者调用.
+template <typename T>
+class MPSCQueue
+{
+    // 最后入队的元素, 经next指向更早入队的元素
+    std::atomic<TSQueueHook*> head_{NULL};
+
+public:
+    MPSCQueue() = default;
+    MPSCQueue(MPSCQueue const&) = delete;
+    MPSCQueue& operator=(MPSCQueue const&) = delete;
+
+    ~MPSCQueue()
+    {
+        TSQueueHook *hook = head_.exchange(NULL);
+        while (hook) {
+            TSQueueHook *next = hook->next;
+            delete (T*)hook;
+            hook = next;
+        }
+    }
+
+    bool empty()
+    {
+        return head_.load(std::memory_order_acquire) == NULL;
+    }
+
+    void push(T* element)
+    {
+        TSQueueHook *hook = static_cast<TSQueueHook*>(element);
+        hook->prev = NULL;
+        hook->check_ = this;
+        Link(hook, hook);
+    }
+
+    // 放回由pop_all取出的元素
+    void push(SList<T> elements)
+    {
+        assert(elements.check(this));
+        if (elements.empty()) return ;
+
+        // 反转为后进先出的顺序, 整体入队.
+        TSQueueHook *hook = elements.head();
+        while (hook) {
+            TSQueueHook *next = hook->next;
+            hook->next = hook->prev;
+            hook->prev = NULL;
+            hook = next;
+        }
+        Link(elements.tail(), elements.head());
+    }
+
+    SList<T> pop_all()
+    {
+        if (!head_.load(std::memory_order_relaxed)) return SList<T>();
+        TSQueueHook *hook = head_.exchange(NULL, std::memory_order_acquire);
+        if (!hook) return SList<T>();
+
+        TSQueueHook *last = hook;
+        TSQueueHook *first = NULL;
+        std::size_t c = 0;
+        while (hook) {
+            TSQueueHook *next = hook->next;
+            hook->next = first;
+            if (first) first->prev = hook;
+            first = hook;
+            hook = next;
+            ++ c;
+        }
+        first->prev = NULL;
+        return SList<T>(first, last, c, this);
+    }
+
+private:
+    // 将first->...->last(经next相连)压入链表头
+    void Link(TSQueueHook *first, TSQueueHook *last)
+    {
+        TSQueueHook *old = head_.load(std::memory_order_relaxed);
+        do {
+            last->next = old;
+        } while (!head_.compare_exchange_weak(old, first,
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+};
+
+// 有界的无锁多生产者多消费者环形队列
+//   所有槽位在构造时一次分配, 元素直接构造在槽位中, 入队和出队各只需一次CAS,
+//   批量入队(出队)时一次CAS占用多个连续的槽位.
+//   每个槽位带有一个序号, 生产者和消费者据此判断槽位是否已写入(已读出), 不需要加锁:
+//   第pos次入队前为2*pos, 写入后为2*pos+1, 读出后为2*(pos+容量), 即下一轮的入队位置.
+//   入队和出队的位置各独占一个cache line, 以免生产者和消费者互相干扰.
+//   槽位已被占用但尚未完成写入(读出)时等待其完成, 因此只在真正满(空)时才返回false;
+//   位置的修改与读取都是seq_cst的, 调用者可以据此与自己的计数构成Dekker式的同步.
+//   容量不必是2的幂.
+//   异常安全: 槽位一经占用就必须写入(读出)并更新序号, 否则后续的出队(入队)会一直等待它.
+//     T的移动构造必须是noexcept的; 构造可能抛出异常的元素先在临时对象中构造再入队,
+//     出队的回调可能抛出异常时逐个出队, 抛出异常时该元素被丢弃, 但槽位仍会释放.
+template <typename T>
+class MPMCRing
+{
+    static_assert(std::is_nothrow_destructible<T>::value, "MPMCRing element must be nothrow destructible");
+
+    struct Cell
+    {
+        std::atomic<std::size_t> seq;
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+
+        T* get() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    static const std::size_t kCacheLine = 64;
+
+public:
+    explicit MPMCRing(std::size_t capacity)
+        : capacity_(capacity ? capacity : 1),
+        mask_((capacity_ & (capacity_ - 1)) == 0 ? capacity_ - 1 : 0),
+        cells_(new Cell[capacity_])
+    {
+        static_assert(std::is_nothrow_move_constructible<T>::value,
+                "MPMCRing element must be nothrow move constructible");
+        for (std::size_t i = 0; i < capacity_; ++i)
+            cells_[i].seq.store(2 * i, std::memory_order_relaxed);
+    }
+
+    MPMCRing(MPMCRing const&) = delete;
+    MPMCRing& operator=(MPMCRing const&) = delete;
+
+    ~MPMCRing()
+    {
+        while (TryPop(nullptr)) ;
+        delete[] cells_;
+    }
+
+    std::size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    // 队列已满时返回false, 此时不会移动t.
+    //   由t构造T可能抛出异常时, 先从t拷贝(不能拷贝时移动)出临时对象, 异常在占用槽位之前抛出.
+    template <typename U>
+    bool TryPush(U && t)
+    {
+        return PushOne(std::forward<U>(t), std::is_nothrow_constructible<T, U&&>());
+    }
+
+    // 批量入队[first, first + n)中的元素, 连续的空槽位一次CAS占用, 返回入队的数量.
+    //   first前进到第一个未入队的元素; 构造可能抛出异常时逐个经临时对象入队.
+    template <typename InputIt>
+    std::size_t TryPushN(InputIt &first, std::size_t n)
+    {
+        return PushN(first, n, std::is_nothrow_constructible<T,
+                    typename std::iterator_traits<InputIt>::reference>());
+    }
+
+    template <typename U>
+    bool TryPop(U & t)
+    {
+        return TryPopN([&](T && v){ t = std::move(v); }, 1) != 0;
+    }
+
+    // 取出并丢弃
+    bool TryPop(std::nullptr_t)
+    {
+        return TryPopN([](T &&){}, 1) != 0;
+    }
+
+    // 批量出队至多n个元素, 连续的已写入槽位一次CAS取走, 依次交给f(T&&), 返回出队的数量.
+    //   f可能抛出异常时逐个取走, 抛出异常时该元素被销毁, 槽位照常释放.
+    template <typename F>
+    std::size_t TryPopN(F && f, std::size_t n)
+    {
+        return PopN(f, n, std::integral_constant<bool, noexcept(f(std::declval<T>()))>());
+    }
+
+    bool empty()
+    {
+        return enqueue_pos_.load(std::memory_order_seq_cst) ==
+            dequeue_pos_.load(std::memory_order_seq_cst);
+    }
+
+    bool full()
+    {
+        return enqueue_pos_.load(std::memory_order_seq_cst) -
+            dequeue_pos_.load(std::memory_order_seq_cst) >= capacity_;
+    }
+
+private:
+    // 销毁槽位中的元素并释放槽位, 回调抛出异常时也会执行.
+    struct PopGuard
+    {
+        MPMCRing *ring;
+        std::size_t pos;
+        Cell *cell;
+
+        PopGuard(MPMCRing *r, std::size_t p) : ring(r), pos(p), cell(&r->cells_[r->Index(p)]) {}
+        ~PopGuard()
+        {
+            cell->get()->~T();
+            cell->seq.store(2 * (pos + ring->capacity_), std::memory_order_release);
+        }
+    };
+
+    template <typename F>
+    std::size_t PopN(F & f, std::size_t n, std::true_type)
+    {
+        std::size_t pos;
+        std::size_t k = ClaimPop(pos, n);
+        for (std::size_t i = 0; i < k; ++i) {
+            PopGuard guard(this, pos + i);
+            f(std::move(*guard.cell->get()));
+        }
+        return k;
+    }
+
+    template <typename F>
+    std::size_t PopN(F & f, std::size_t n, std::false_type)
+    {
+        std::size_t k = 0, pos;
+        for (; k < n && ClaimPop(pos, 1); ++k) {
+            PopGuard guard(this, pos);
+            f(std::move(*guard.cell->get()));
+        }
+        return k;
+    }
+
+    template <typename U>
+    bool PushOne(U && t, std::true_type)
+    {
+        std::size_t pos;
+        if (!ClaimPush(pos, 1))
+            return false;
+
+        Publish(pos, std::forward<U>(t));
+        return true;
+    }
+
+    template <typename U>
+    bool PushOne(U && t, std::false_type)
+    {
+        if (full())
+            return false;
+
+        T tmp(CopyIfPossible(t, std::is_constructible<T, U&>()));
+        return PushOne(std::move(tmp), std::true_type());
+    }
+
+    template <typename U>
+    static U & CopyIfPossible(U & t, std::true_type) { return t; }
+    template <typename U>
+    static U && CopyIfPossible(U & t, std::false_type) { return std::move(t); }
+
+    template <typename InputIt>
+    std::size_t PushN(InputIt &first, std::size_t n, std::true_type)
+    {
+        std::size_t pos;
+        std::size_t k = ClaimPush(pos, n);
+        for (std::size_t i = 0; i < k; ++i, ++first)
+            Publish(pos + i, *first);
+        return k;
+    }
+
+    template <typename InputIt>
+    std::size_t PushN(InputIt &first, std::size_t n, std::false_type)
+    {
+        std::size_t k = 0;
+        for (; k < n && !full(); ++k, ++first) {
+            T tmp(*first);
+            if (!PushOne(std::move(tmp), std::true_type()))
+                break;
+        }
+        return k;
+    }
+
+    template <typename U>
+    void Publish(std::size_t pos, U && t)
+    {
+        Cell *cell = &cells_[Index(pos)];
+        ::new (cell->get()) T(std::forward<U>(t));
+        cell->seq.store(2 * pos + 1, std::memory_order_release);
+    }
+
+    inline std::size_t Index(std::size_t pos) const
+    {
+        return mask_ || capacity_ == 1 ? (pos & mask_) : (pos % capacity_);
+    }
+
+    // 从pos开始连续有多少个(不超过n个)槽位的序号符合期望, 第一个已确认符合.
+    std::size_t CountReady(std::size_t pos, std::size_t n, std::size_t offset)
+    {
+        std::size_t k = 1;
+        std::size_t limit = n < capacity_ ? n : capacity_;
+        while (k < limit && cells_[Index(pos + k)].seq.load(std::memory_order_acquire)
+                == 2 * (pos + k) + offset)
+            ++k;
+        return k;
+    }
+
+    // 占用至多n个连续的空槽位, 返回占用的数量, 已满时返回0.
+    std::size_t ClaimPush(std::size_t &pos, std::size_t n)
+    {
+        if (!n) return 0;
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (uint32_t spin = 0;; ) {
+            Cell *cell = &cells_[Index(pos)];
+            std::size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(2 * pos);
+            if (diff == 0) {
+                std::size_t k = CountReady(pos, n, 0);
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + k,
+                            std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return k;
+            } else if (diff < 0) {
+                // 上一轮的元素尚未读出, 没有消费者占用它时才是满的.
+                if (dequeue_pos_.load(std::memory_order_seq_cst) + capacity_ <= pos)
+                    return 0;
+                Backoff(spin);
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 占用至多n个连续的已写入槽位, 返回占用的数量, 已空时返回0.
+    std::size_t ClaimPop(std::size_t &pos, std::size_t n)
+    {
+        if (!n) return 0;
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (uint32_t spin = 0;; ) {
+            Cell *cell = &cells_[Index(pos)];
+            std::size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(2 * pos + 1);
+            if (diff == 0) {
+                std::size_t k = CountReady(pos, n, 1);
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + k,
+                            std::memory_order_seq_cst, std::memory_order_relaxed))
+                    return k;
+            } else if (diff < 0) {
+                // 尚未写入, 没有生产者占用它时才是空的.
+                if (enqueue_pos_.load(std::memory_order_seq_cst) <= pos)
+                    return 0;
+                Backoff(spin);
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 等待其他线程完成写入(读出), 通常只有几条指令, 被抢占时让出CPU.
+    static void Backoff(uint32_t &spin)
+    {
+        if (++spin < 64)
+            CpuRelax();
+        else
+            std::this_thread::yield();
+    }
+
+    char pad0_[kCacheLine];
+    const std::size_t capacity_;
+    const std::size_t mask_;    // 容量为2的幂时用位与代替取模
+    Cell* const cells_;
+    char pad1_[kCacheLine];
+    std::atomic<std::size_t> enqueue_pos_{0};
+    char pad2_[kCacheLine - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> dequeue_pos_{0};
+    char pad3_[kCacheLine - sizeof(std::atomic<std::size_t>)];
+};
+
 } //namespace co
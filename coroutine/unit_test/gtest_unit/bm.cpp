@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 #include "coroutine.h"
 #include <chrono>
+#include <mutex>
 #include <boost/thread.hpp>
 using namespace std;
 using namespace co;
@@ -119,6 +120,24 @@ TEST_P(Times, testBm)
         g_Scheduler.RunUntilNoTask();
     }
 
+    {
+        co_mutex m;
+        stdtimer st(tc_, "Mutex lock and unlock");
+        for (int i = 0; i < tc_; ++i) {
+            m.lock();
+            m.unlock();
+        }
+    }
+
+    {
+        std::mutex m;
+        stdtimer st(tc_, "std::mutex lock and unlock");
+        for (int i = 0; i < tc_; ++i) {
+            m.lock();
+            m.unlock();
+        }
+    }
+
     {
         stdtimer st(tc_, "Create Timer");
         for (int i = 0; i < tc_; ++i)
@@ -4,6 +4,7 @@
 #include <vector>
 #include <list>
 #include <atomic>
+#include <stdexcept>
 #include "coroutine.h"
 using namespace std::chrono;
 using namespace co;
@@ -15,26 +16,27 @@ TEST(Channel, capacity0)
     co_chan<int> ch;
     int i = 0;
     {
+        // 写者先到, 挂起等待; 读者直接取走数据, 不需要切换.
         go [&]{ ch << 1; EXPECT_YIELD(1);};
-        go [&]{ ch >> i; EXPECT_YIELD(1);};
+        go [&]{ ch >> i; EXPECT_YIELD(0);};
         g_Scheduler.RunUntilNoTask();
         EXPECT_EQ(i, 1);
 
         go [=]{ ch << 2; EXPECT_YIELD(1);};
-        go [=, &i]{ ch >> i; EXPECT_YIELD(1);};
+        go [=, &i]{ ch >> i; EXPECT_YIELD(0);};
         g_Scheduler.RunUntilNoTask();
         EXPECT_EQ(i, 2);
 
         std::atomic<int> step{0};
         int before_push = 0, after_push = 0, before_pop = 0, after_pop = 0;
         go [&]{ before_push = ++step; ch << 3; after_push = ++step; EXPECT_YIELD(1);};
-        go [&]{ before_pop = ++step; ch >> i; after_pop = ++step; EXPECT_YIELD(1);};
+        go [&]{ before_pop = ++step; ch >> i; after_pop = ++step; EXPECT_YIELD(0);};
         g_Scheduler.RunUntilNoTask();
         EXPECT_EQ(i, 3);
         EXPECT_EQ(before_push, 1);
         EXPECT_EQ(before_pop, 2);
-        EXPECT_EQ(after_push, 3);
-        EXPECT_EQ(after_pop, 4);
+        EXPECT_EQ(after_pop, 3);
+        EXPECT_EQ(after_push, 4);
     }
 
     // ignore
@@ -42,12 +44,12 @@ TEST(Channel, capacity0)
         std::atomic<int> step{0};
         int before_push = 0, after_push = 0, before_pop = 0, after_pop = 0;
         go [&]{ before_push = ++step; ch << 3; after_push = ++step; EXPECT_YIELD(1);};
-        go [&]{ before_pop = ++step; ch >> nullptr; after_pop = ++step; EXPECT_YIELD(1);};
+        go [&]{ before_pop = ++step; ch >> nullptr; after_pop = ++step; EXPECT_YIELD(0);};
         g_Scheduler.RunUntilNoTask();
         EXPECT_EQ(before_push, 1);
         EXPECT_EQ(before_pop, 2);
-        EXPECT_EQ(after_push, 3);
-        EXPECT_EQ(after_pop, 4);
+        EXPECT_EQ(after_pop, 3);
+        EXPECT_EQ(after_push, 4);
     }
 
     // multi thread
@@ -190,26 +192,26 @@ TEST(Channel, capacity0Try)
     int i = 0;
     // try pop
     {
-        go [&]{ EXPECT_FALSE(ch.TryPop(i)); EXPECT_YIELD(0); co_yield; EXPECT_TRUE(ch.TryPop(i)); EXPECT_YIELD(2); };
+        go [&]{ EXPECT_FALSE(ch.TryPop(i)); EXPECT_YIELD(0); co_yield; EXPECT_TRUE(ch.TryPop(i)); EXPECT_YIELD(1); };
         go [&]{ ch << 1; EXPECT_YIELD(1);};
         g_Scheduler.RunUntilNoTask();
         EXPECT_EQ(i, 1);
 
         go [=]{ ch << 2; EXPECT_YIELD(1);};
-        go [&]{ EXPECT_TRUE(ch.TryPop(i)); EXPECT_YIELD(1); };
+        go [&]{ EXPECT_TRUE(ch.TryPop(i)); EXPECT_YIELD(0); };
         g_Scheduler.RunUntilNoTask();
         EXPECT_EQ(i, 2);
 
         std::atomic<int> step{0};
         int before_push = 0, after_push = 0, before_pop = 0, after_pop = 0;
         go [&]{ before_push = ++step; ch << 3; after_push = ++step; EXPECT_YIELD(1);};
-        go [&]{ before_pop = ++step; EXPECT_TRUE(ch.TryPop(i)); after_pop = ++step; EXPECT_YIELD(1);};
+        go [&]{ before_pop = ++step; EXPECT_TRUE(ch.TryPop(i)); after_pop = ++step; EXPECT_YIELD(0);};
         g_Scheduler.RunUntilNoTask();
         EXPECT_EQ(i, 3);
         EXPECT_EQ(before_push, 1);
         EXPECT_EQ(before_pop, 2);
-        EXPECT_EQ(after_push, 3);
-        EXPECT_EQ(after_pop, 4);
+        EXPECT_EQ(after_pop, 3);
+        EXPECT_EQ(after_push, 4);
     }
 
     // try push
@@ -414,3 +416,429 @@ TEST(Channel, capacity0BlockTry)
         g_Scheduler.RunUntilNoTask();
     }
 }
+
+TEST(Channel, BlockTryWakeup)
+{
+    // 限时等待在数据到达时立即被唤醒, 不受超时时间和轮询间隔影响.
+    std::size_t caps[] = {0, 1};
+    for (std::size_t cap : caps) {
+        co_chan<int> ch(cap);
+        go [=] {
+            auto s = system_clock::now();
+            int i = 0;
+            bool ok = ch.BlockTryPop(i, seconds(10));
+            auto c = duration_cast<milliseconds>(system_clock::now() - s).count();
+            EXPECT_TRUE(ok);
+            EXPECT_EQ(i, 1);
+            EXPECT_GT(c, 39);
+            EXPECT_LT(c, 55);
+        };
+        go [=] {
+            co_sleep(40);
+            ch << 1;
+        };
+        g_Scheduler.RunUntilNoTask();
+
+        go [=] {
+            if (cap) ch << 0;
+            auto s = system_clock::now();
+            bool ok = ch.BlockTryPush(2, seconds(10));
+            auto c = duration_cast<milliseconds>(system_clock::now() - s).count();
+            EXPECT_TRUE(ok);
+            EXPECT_GT(c, 39);
+            EXPECT_LT(c, 55);
+        };
+        go [=] {
+            co_sleep(40);
+            int i;
+            ch >> i;
+            if (cap) {
+                EXPECT_EQ(i, 0);
+                ch >> i;
+            }
+            EXPECT_EQ(i, 2);
+        };
+        g_Scheduler.RunUntilNoTask();
+    }
+
+    // 超时后右值参数不会被移走, 也不会留在channel中.
+    {
+        co_chan<std::unique_ptr<int>> ch;
+        go [=] {
+            std::unique_ptr<int> p(new int(1));
+            EXPECT_FALSE(ch.BlockTryPush(std::move(p), milliseconds(10)));
+            EXPECT_TRUE(!!p);
+            EXPECT_FALSE(ch.TryPop(nullptr));
+        };
+        g_Scheduler.RunUntilNoTask();
+    }
+
+    // 协程外的线程限时等待
+    {
+        co_chan<int> ch(1);
+        int i = 0;
+        auto s = system_clock::now();
+        EXPECT_FALSE(ch.BlockTryPop(i, milliseconds(20)));
+        auto c = duration_cast<milliseconds>(system_clock::now() - s).count();
+        EXPECT_GT(c, 19);
+        EXPECT_LT(c, 40);
+
+        go [=] { co_sleep(10); ch << 3; };
+        boost::thread th([]{ g_Scheduler.RunUntilNoTask(); });
+        EXPECT_TRUE(ch.BlockTryPop(i, seconds(10)));
+        EXPECT_EQ(i, 3);
+        th.join();
+    }
+}
+
+TEST(Channel, MultiProducerConsumer)
+{
+    // 多个协程在多个线程中同时读写, 元素不丢失也不重复.
+    std::size_t caps[] = {0, 1, 7, 64, (std::size_t)-1};
+    for (std::size_t cap : caps) {
+        co_chan<long> ch(cap);
+        const int producers = 8, consumers = 8, n = 2000;
+        std::atomic<long> sum{0}, count{0};
+        for (int p = 0; p < producers; ++p)
+            go [=]{
+                for (int i = 0; i < n; ++i)
+                    ch << (long)p * n + i;
+            };
+        for (int c = 0; c < consumers; ++c)
+            go [=, &sum, &count]{
+                for (int i = 0; i < producers * n / consumers; ++i) {
+                    long v;
+                    ch >> v;
+                    sum += v;
+                    ++count;
+                }
+            };
+
+        boost::thread_group tg;
+        for (int t = 0; t < 4; ++t)
+            tg.create_thread([]{g_Scheduler.RunUntilNoTask();});
+        tg.join_all();
+
+        long total = producers * n;
+        EXPECT_EQ(count, total) << "capacity " << cap;
+        EXPECT_EQ(sum, total * (total - 1) / 2) << "capacity " << cap;
+        EXPECT_FALSE(ch.TryPop(nullptr));
+    }
+}
+
+TEST(Channel, LargeCapacity)
+{
+    // 容量超过环形队列上限时改用deque, 但仍是有界的: 满了之后TryPush失败, 写入阻塞.
+    const int n = 100000;
+    co_chan<int> ch(n);
+    std::vector<int> vi(n + 10);
+    for (int i = 0; i < n + 10; ++i)
+        vi[i] = i;
+    EXPECT_EQ(ch.TryPushN(vi.begin(), vi.end()), (std::size_t)n);
+    EXPECT_FALSE(ch.TryPush(n));
+
+    int i = -1;
+    go [&]{ ch << n; EXPECT_YIELD(1);};
+    go [&]{ ch >> i; EXPECT_YIELD(0);};
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(i, 0);
+    EXPECT_FALSE(ch.TryPush(n + 1));
+
+    for (int k = 1; k <= n; ++k) {
+        EXPECT_TRUE(ch.TryPop(i));
+        EXPECT_EQ(i, k);
+    }
+    EXPECT_FALSE(ch.TryPop(i));
+}
+
+// 拷贝构造可能抛出异常, 移动构造不会.
+struct ThrowOnCopy
+{
+    int v;
+    explicit ThrowOnCopy(int i = 0) : v(i) {}
+    ThrowOnCopy(ThrowOnCopy const& other) : v(other.v)
+    {
+        if (v < 0) throw std::runtime_error("copy");
+    }
+    ThrowOnCopy(ThrowOnCopy && other) noexcept : v(other.v) {}
+    ThrowOnCopy& operator=(ThrowOnCopy && other)
+    {
+        if (other.v < -1) throw std::runtime_error("assign");
+        v = other.v;
+        return *this;
+    }
+};
+
+TEST(Channel, Exception)
+{
+    // 写入时拷贝抛出异常, 读出时赋值抛出异常, channel仍可继续使用.
+    co_chan<ThrowOnCopy> ch(2);
+    ThrowOnCopy bad(-1), out;
+    EXPECT_THROW(ch << bad, std::runtime_error);
+    ch << ThrowOnCopy(1);
+    EXPECT_TRUE(ch.TryPush(std::move(bad)));    // 移动不会抛出异常
+    ch >> out;
+    EXPECT_EQ(out.v, 1);
+    ch >> out;
+    EXPECT_EQ(out.v, -1);
+    EXPECT_FALSE(ch.TryPop(out));
+
+    // 赋值抛出异常的元素被丢弃, 空出的位置唤醒等待的写者.
+    ch << ThrowOnCopy(-2);
+    ch << ThrowOnCopy(2);
+    bool pushed = false;
+    go [&]{ ch << ThrowOnCopy(3); pushed = true; };
+    g_Scheduler.Run();
+    EXPECT_FALSE(pushed);
+    EXPECT_THROW(ch >> out, std::runtime_error);
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_TRUE(pushed);
+    ch >> out;
+    EXPECT_EQ(out.v, 2);
+    ch >> out;
+    EXPECT_EQ(out.v, 3);
+    EXPECT_FALSE(ch.TryPop(out));
+}
+
+TEST(Channel, Unbounded)
+{
+    // 容量为-1时不预先分配缓冲区, 写入不会阻塞.
+    co_chan<std::unique_ptr<int>> ch(-1);
+    go [=]{
+        for (int i = 0; i < 10000; ++i)
+            ch << std::unique_ptr<int>(new int(i));
+        EXPECT_YIELD(0);
+    };
+    g_Scheduler.RunUntilNoTask();
+
+    go [=]{
+        std::unique_ptr<int> p;
+        for (int i = 0; i < 10000; ++i) {
+            EXPECT_TRUE(ch.TryPop(p));
+            EXPECT_EQ(*p, i);
+        }
+        EXPECT_FALSE(ch.TryPop(p));
+        ch >> p;
+        EXPECT_EQ(*p, -1);
+        EXPECT_YIELD(1);
+    };
+    go [=]{ ch << std::unique_ptr<int>(new int(-1)); };
+    g_Scheduler.RunUntilNoTask();
+}
+
+TEST(Channel, Thread)
+{
+    // 协程外的线程阻塞读写, 与协程交替.
+    co_chan<int> ch(1);
+    int sum = 0;
+    go [&]{
+        for (int i = 0; i < 10; ++i) {
+            int v;
+            ch >> v;
+            sum += v;
+        }
+    };
+    boost::thread th([]{ g_Scheduler.RunUntilNoTask(); });
+    for (int i = 0; i < 10; ++i)
+        ch << i;
+    th.join();
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(sum, 45);
+}
+
+TEST(Channel, ThreadWakeup)
+{
+    // 协程外的线程休眠在futex上, 由协程直接唤醒, 不再轮询.
+    co_chan<int> req, rsp;
+    const int n = 200;
+    go [=] {
+        for (int i = 0; i < n; ++i) {
+            int v;
+            req >> v;
+            rsp << v + 1;
+        }
+    };
+    boost::thread th([]{ g_Scheduler.RunUntilNoTask(); });
+    auto start = steady_clock::now();
+    for (int i = 0; i < n; ++i) {
+        int v = 0;
+        req << i;
+        rsp >> v;
+        EXPECT_EQ(v, i + 1);
+    }
+    auto cost = steady_clock::now() - start;
+    th.join();
+    EXPECT_LT(duration_cast<milliseconds>(cost).count(), 500);
+}
+
+TEST(Channel, Batch)
+{
+    // 批量读写保持顺序, PopN没有元素时阻塞.
+    std::size_t caps[] = {0, 1, 5, (std::size_t)-1};
+    for (std::size_t cap : caps) {
+        co_chan<int> ch(cap);
+        std::vector<int> in, out;
+        for (int i = 0; i < 20; ++i)
+            in.push_back(i);
+
+        go [&]{
+            while (out.size() < in.size())
+                EXPECT_GE(ch.PopN(std::back_inserter(out), 4), 1u);
+        };
+        go [&]{
+            ch.PushN(in.begin(), in.begin() + 10);
+            ch.PushN(in.begin() + 10, in.end());
+        };
+        g_Scheduler.RunUntilNoTask();
+        EXPECT_EQ(out, in);
+        EXPECT_EQ(ch.TryPopAll(std::back_inserter(out)), 0u);
+    }
+
+    // 无缓冲区时TryPopAll一次取走所有等待的写者的数据并全部唤醒.
+    {
+        co_chan<int> ch;
+        for (int i = 0; i < 3; ++i)
+            go [=]{ ch << i; };
+
+        std::vector<int> out;
+        go [&]{
+            co_yield;   // 等三个写者都阻塞
+            EXPECT_EQ(ch.TryPopAll(std::back_inserter(out)), 3u);
+            EXPECT_EQ(ch.TryPushN(out.begin(), out.end()), 0u);
+        };
+        g_Scheduler.RunUntilNoTask();
+        EXPECT_EQ(out, std::vector<int>({0, 1, 2}));
+    }
+
+    // 有缓冲区时TryPushN只写入空位数量的元素.
+    {
+        co_chan<int> ch(3);
+        std::vector<int> in = {1, 2, 3, 4, 5}, out;
+        EXPECT_EQ(ch.TryPushN(in.begin(), in.end()), 3u);
+        EXPECT_EQ(ch.TryPopN(std::back_inserter(out), 2), 2u);
+        EXPECT_EQ(ch.TryPushN(in.begin() + 3, in.end()), 2u);
+        EXPECT_EQ(ch.TryPopAll(std::back_inserter(out)), 3u);
+        EXPECT_EQ(out, in);
+    }
+}
+
+TEST(Channel, Select)
+{
+    // 不阻塞
+    {
+        co_chan<int> ch1, ch2(1);
+        int a = 0, b = 0;
+        co_select sel;
+        EXPECT_EQ(sel.Recv(ch1, a), 0);
+        EXPECT_EQ(sel.Recv(ch2, b), 1);
+        EXPECT_EQ(sel.TryWait(), -1);
+        ch2 << 2;
+        EXPECT_EQ(sel.TryWait(), 1);
+        EXPECT_EQ(b, 2);
+    }
+
+    // 读分支: 只完成一个分支, 其他channel不受影响.
+    {
+        co_chan<int> ch1, ch2(1);
+        go [=] {
+            int a = 0, b = 0;
+            co_select sel;
+            sel.Recv(ch1, a);
+            sel.Recv(ch2, b);
+            EXPECT_EQ(sel.Wait(), 0);
+            EXPECT_EQ(a, 1);
+            EXPECT_EQ(b, 0);
+        };
+        go [=] {
+            co_sleep(10);
+            ch1 << 1;
+            EXPECT_TRUE(ch2.TryPush(2));
+            EXPECT_FALSE(ch2.TryPush(3));
+        };
+        g_Scheduler.RunUntilNoTask();
+    }
+
+    // 写分支
+    {
+        co_chan<std::unique_ptr<int>> ch1;
+        co_chan<void> ch2;
+        go [=] {
+            co_select sel;
+            sel.Send(ch1, std::unique_ptr<int>(new int(5)));
+            sel.Recv(ch2, nullptr);
+            EXPECT_EQ(sel.Wait(), 0);
+        };
+        go [=] {
+            std::unique_ptr<int> p;
+            ch1 >> p;
+            EXPECT_EQ(*p, 5);
+            EXPECT_FALSE(ch2.TryPush(nullptr));
+        };
+        g_Scheduler.RunUntilNoTask();
+    }
+
+    // 超时后撤销所有登记
+    {
+        co_chan<int> ch1, ch2(1);
+        go [=] {
+            int a = 0;
+            co_select sel;
+            sel.Recv(ch1, a);
+            sel.Send(ch2, 1);
+            sel.Send(ch2, 2);
+            EXPECT_EQ(sel.TryWait(), 1);
+
+            co_select sel2;
+            sel2.Recv(ch1, a);
+            sel2.Send(ch2, 3);
+            auto s = system_clock::now();
+            EXPECT_EQ(sel2.Wait(milliseconds(50)), -1);
+            auto c = duration_cast<milliseconds>(system_clock::now() - s).count();
+            EXPECT_GT(c, 49);
+            EXPECT_LT(c, 80);
+            EXPECT_FALSE(ch1.TryPush(1));
+        };
+        g_Scheduler.RunUntilNoTask();
+    }
+}
+
+TEST(Channel, SelectFanIn)
+{
+    // 多个写者分别写入有缓冲和无缓冲的channel, 一个读者用select汇总.
+    co_chan<int> cha, chb(3);
+    co_chan<void> quit;
+    std::atomic<long> sum{0};
+    const int n = 2000;
+    for (int w = 0; w < 4; ++w)
+        go [=] {
+            for (int i = 1; i <= n; ++i)
+                (w % 2 ? cha : chb) << i;
+        };
+    go [=, &sum] {
+        for (int i = 0; i < 4 * n; ++i) {
+            int v = 0;
+            co_select sel;
+            sel.Recv(cha, v);
+            sel.Recv(chb, v);
+            sel.Recv(quit, nullptr);
+            EXPECT_NE(sel.Wait(), 2);
+            sum += v;
+        }
+    };
+    boost::thread_group tg;
+    for (int i = 0; i < 4; ++i)
+        tg.create_thread([]{ g_Scheduler.RunUntilNoTask(); });
+    tg.join_all();
+    EXPECT_EQ(sum, 4L * n * (n + 1) / 2);
+
+    // 协程外的线程select
+    go [=] { co_sleep(10); cha << 7; };
+    boost::thread th([]{ g_Scheduler.RunUntilNoTask(); });
+    int v = 0;
+    co_select sel;
+    sel.Recv(cha, v);
+    sel.Recv(chb, v);
+    EXPECT_EQ(sel.Wait(seconds(5)), 0);
+    EXPECT_EQ(v, 7);
+    th.join();
+}
@@ -0,0 +1,237 @@
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <gtest/gtest.h>
+#include "coroutine.h"
+#include "tcp_pair.h"
+using namespace std;
+using namespace co;
+
+///fd context test points:
+// 1.hooked socket looks blocking to user, fcntl/ioctl(FIONBIO) change it.
+// 2.blocking read with SO_RCVTIMEO, in and not in coroutine.
+// 3.dup fd keeps the options.
+// 4.fd closed without hook (raw syscall) then reused by a new fd.
+// 5.socketpair is not managed, stdio on it blocks as the user asked.
+
+TEST(FdCtx, NonBlockFlag)
+{
+    int fds[2];
+    ASSERT_EQ(tcp_socketpair(fds), 0);
+    EXPECT_EQ(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+
+    char c;
+    EXPECT_EQ(fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK), 0);
+    EXPECT_NE(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+    EXPECT_EQ(read(fds[0], &c, 1), -1);
+    EXPECT_EQ(errno, EAGAIN);
+
+    int on = 0;
+    EXPECT_EQ(ioctl(fds[0], FIONBIO, &on), 0);
+    EXPECT_EQ(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+
+    on = 1;
+    EXPECT_EQ(ioctl(fds[0], FIONBIO, &on), 0);
+    EXPECT_EQ(read(fds[0], &c, 1), -1);
+    EXPECT_EQ(errno, EAGAIN);
+
+    int nb = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    ASSERT_GE(nb, 0);
+    EXPECT_NE(fcntl(nb, F_GETFL) & O_NONBLOCK, 0);
+
+    close(fds[0]);
+    close(fds[1]);
+    close(nb);
+}
+
+static void read_timeout(int fd)
+{
+    char c;
+    auto start = std::chrono::high_resolution_clock::now();
+    ssize_t n = read(fd, &c, 1);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto milli = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    EXPECT_EQ(n, -1);
+    EXPECT_EQ(errno, EAGAIN);
+    EXPECT_GT(milli, 99);
+    EXPECT_LT(milli, 300);
+}
+
+TEST(FdCtx, RecvTimeout)
+{
+    int fds[2];
+    ASSERT_EQ(tcp_socketpair(fds), 0);
+
+    struct timeval rcvtimeout = {0, 100 * 1000};
+    ASSERT_EQ(setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &rcvtimeout, sizeof(rcvtimeout)), 0);
+
+    // not in coroutine.
+    read_timeout(fds[0]);
+
+    // in coroutine.
+    go [=]{ read_timeout(fds[0]); };
+    g_Scheduler.RunUntilNoTask();
+
+    // blocking read not in coroutine, wakeup by write.
+    std::thread t([=]{
+        usleep(20 * 1000);
+        char c = 'x';
+        EXPECT_EQ(write(fds[1], &c, 1), 1);
+    });
+    char c = 0;
+    EXPECT_EQ(read(fds[0], &c, 1), 1);
+    EXPECT_EQ(c, 'x');
+    t.join();
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(FdCtx, Dup)
+{
+    int fds[2];
+    ASSERT_EQ(tcp_socketpair(fds), 0);
+
+    struct timeval rcvtimeout = {0, 100 * 1000};
+    ASSERT_EQ(setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &rcvtimeout, sizeof(rcvtimeout)), 0);
+
+    int fd = dup(fds[0]);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(fcntl(fd, F_GETFL) & O_NONBLOCK, 0);
+    go [=]{ read_timeout(fd); };
+    g_Scheduler.RunUntilNoTask();
+
+    close(fd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// 先以协程读一次托管socket, 使fd加入epoll, 然后不经hook直接关闭.
+static int register_and_raw_close()
+{
+    int fds[2];
+    EXPECT_EQ(tcp_socketpair(fds), 0);
+    go [=]{
+        char c = 0;
+        EXPECT_EQ(read(fds[0], &c, 1), 1);
+    };
+    go [=]{
+        co_sleep(10);
+        char c = 'x';
+        EXPECT_EQ(write(fds[1], &c, 1), 1);
+    };
+    g_Scheduler.RunUntilNoTask();
+
+    syscall(SYS_close, fds[0]);
+    close(fds[1]);
+    return fds[0];
+}
+
+// 读写复用了fd号的新fd, 另一个协程稍后写入.
+static void wait_read(int rfd, int wfd)
+{
+    int c = 0;
+    go [&]{
+        char ch = 0;
+        EXPECT_EQ(read(rfd, &ch, 1), 1);
+        EXPECT_EQ(ch, 'y');
+        ++c;
+    };
+    go [&]{
+        co_sleep(10);
+        char ch = 'y';
+        EXPECT_EQ(write(wfd, &ch, 1), 1);
+        ++c;
+    };
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(c, 2);
+}
+
+TEST(FdCtx, RawCloseReuse)
+{
+    // socketpair复用了fd号, 需重新加入epoll, 否则读等待不到事件直到超时.
+    int old_fd = register_and_raw_close();
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    EXPECT_EQ(fds[0], old_fd);
+    struct timeval rcvtimeout = {1, 0};
+    ASSERT_EQ(setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &rcvtimeout, sizeof(rcvtimeout)), 0);
+    wait_read(fds[0], fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+
+    // pipe复用了托管socket的fd号, 不能再沿用托管socket的非阻塞标志.
+    old_fd = register_and_raw_close();
+    int p[2];
+    ASSERT_EQ(pipe2(p, O_NONBLOCK), 0);
+    EXPECT_EQ(p[0], old_fd);
+    EXPECT_NE(fcntl(p[0], F_GETFL) & O_NONBLOCK, 0);
+    go [=]{
+        char c;
+        EXPECT_EQ(read(p[0], &c, 1), -1);
+        EXPECT_EQ(errno, EAGAIN);
+    };
+    g_Scheduler.RunUntilNoTask();
+    close(p[0]);
+    close(p[1]);
+}
+
+static void on_sigusr1(int) {}
+
+TEST(FdCtx, RecvTimeoutRetry)
+{
+    // 等待被信号打断后重试时, 只等待剩余的超时时间.
+    int fds[2];
+    ASSERT_EQ(tcp_socketpair(fds), 0);
+    struct timeval rcvtimeout = {0, 300 * 1000};
+    ASSERT_EQ(setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &rcvtimeout, sizeof(rcvtimeout)), 0);
+
+    struct sigaction sa = {}, old_sa;
+    sa.sa_handler = &on_sigusr1;
+    ASSERT_EQ(sigaction(SIGUSR1, &sa, &old_sa), 0);
+
+    std::thread t([&]{
+        char c;
+        auto start = std::chrono::high_resolution_clock::now();
+        EXPECT_EQ(read(fds[0], &c, 1), -1);
+        EXPECT_EQ(errno, EAGAIN);
+        auto milli = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - start).count();
+        EXPECT_GT(milli, 299);
+        EXPECT_LT(milli, 420);
+    });
+    usleep(200 * 1000);
+    pthread_kill(t.native_handle(), SIGUSR1);
+    t.join();
+    sigaction(SIGUSR1, &old_sa, NULL);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(FdCtx, SocketPairStdio)
+{
+    // 阻塞的socketpair交给stdio读写, glibc内部的读取不经过hook, 不能被改成非阻塞.
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    EXPECT_EQ(syscall(SYS_fcntl, fds[0], F_GETFL) & O_NONBLOCK, 0);
+    FILE *fp = fdopen(fds[0], "r");
+    ASSERT_TRUE(fp != NULL);
+
+    std::thread t([=]{
+        usleep(20 * 1000);
+        EXPECT_EQ(write(fds[1], "hello\n", 6), 6);
+    });
+    char line[16] = {};
+    EXPECT_TRUE(fgets(line, sizeof(line), fp) != NULL);
+    EXPECT_STREQ(line, "hello\n");
+    t.join();
+
+    fclose(fp);
+    close(fds[1]);
+}
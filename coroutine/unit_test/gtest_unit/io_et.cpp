@@ -0,0 +1,93 @@
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+#include "coroutine.h"
+#include "tcp_pair.h"
+using namespace std;
+using namespace co;
+
+///edge-triggered io test points:
+// 1.ping-pong on a pair of hooked tcp sockets, wakeup not lost.
+// 2.multi readers on one fd.
+// 3.close() wakeup the blocked reader.
+
+static const int ping_pong_count = 10000;
+
+TEST(IOEdgeTriggered, PingPong)
+{
+    int fds[2];
+    ASSERT_EQ(tcp_socketpair(fds), 0);
+
+    go [=]{
+        char c = 0;
+        for (int i = 0; i < ping_pong_count; ++i) {
+            EXPECT_EQ(write(fds[0], &c, 1), 1);
+            EXPECT_EQ(read(fds[0], &c, 1), 1);
+            EXPECT_EQ(c, (char)(i + 1));
+        }
+    };
+    go [=]{
+        char c = 0;
+        for (int i = 0; i < ping_pong_count; ++i) {
+            EXPECT_EQ(read(fds[1], &c, 1), 1);
+            ++c;
+            EXPECT_EQ(write(fds[1], &c, 1), 1);
+        }
+    };
+    g_Scheduler.RunUntilNoTask();
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(IOEdgeTriggered, MultiReader)
+{
+    int fds[2];
+    ASSERT_EQ(tcp_socketpair(fds), 0);
+
+    std::atomic<int> total{0};
+    for (int i = 0; i < 10; ++i)
+        go [&, fds]{
+            char buf[10];
+            ssize_t n = read(fds[1], buf, sizeof(buf));
+            EXPECT_EQ(n, (ssize_t)sizeof(buf));
+            total += n;
+        };
+    go [=]{
+        char buf[10] = {};
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_EQ(write(fds[0], buf, sizeof(buf)), (ssize_t)sizeof(buf));
+            co_sleep(1);
+        }
+    };
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(total, 100);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(IOEdgeTriggered, CloseWakeup)
+{
+    int fds[2];
+    ASSERT_EQ(tcp_socketpair(fds), 0);
+
+    go [=]{
+        char c;
+        auto start = std::chrono::high_resolution_clock::now();
+        ssize_t n = read(fds[1], &c, 1);
+        auto end = std::chrono::high_resolution_clock::now();
+        auto milli = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        EXPECT_EQ(n, -1);
+        EXPECT_EQ(errno, EBADF);
+        EXPECT_LT(milli, 1000);
+    };
+    go [=]{
+        co_sleep(50);
+        close(fds[1]);
+    };
+    g_Scheduler.RunUntilNoTask();
+
+    close(fds[0]);
+}
@@ -134,3 +134,92 @@ TEST(Mutex, test_rwmutex)
     EXPECT_EQ(*v1, 10000);
     EXPECT_EQ(*v2, 10000);
 }
+
+TEST(Mutex, rwmutex_queue)
+{
+    co_rwmutex m;
+
+    // 写者解锁时一次唤醒所有排队的读者, 读者同时持有读锁.
+    std::atomic<int> in{0};
+    go [=, &in]()mutable {
+        m.writer().lock();
+        for (int i = 0; i < 10; ++i) co_yield;
+        EXPECT_EQ(in, 0);
+        m.writer().unlock();
+    };
+    for (int i = 0; i < 5; ++i)
+        go [=, &in]()mutable {
+            std::unique_lock<co_rmutex> lock(m.reader());
+            ++in;
+            while (in < 5) co_yield;
+        };
+    co_sched.RunUntilNoTask();
+    EXPECT_EQ(in, 5);
+
+    // 读者持续加锁时, 写者排队后新来的读者也要排队, 写者不会饿死.
+    std::atomic<bool> stop{false};
+    std::atomic<int> writes{0};
+    for (int i = 0; i < 10; ++i)
+        go [=, &stop]()mutable {
+            while (!stop) {
+                std::unique_lock<co_rmutex> lock(m.reader());
+                co_yield;
+            }
+        };
+    go [=, &stop, &writes]()mutable {
+        for (int i = 0; i < 100; ++i) {
+            std::unique_lock<co_wmutex> lock(m.writer());
+            ++writes;
+        }
+        stop = true;
+    };
+
+    // 协程外的线程也可以排队
+    boost::thread th([=, &writes]()mutable {
+        for (int i = 0; i < 100; ++i) {
+            std::unique_lock<co_wmutex> lock(m.writer());
+            ++writes;
+        }
+    });
+    boost::thread_group tg;
+    for (int i = 0; i < 4; ++i)
+        tg.create_thread([]{co_sched.RunUntilNoTask();});
+    tg.join_all();
+    th.join();
+    EXPECT_EQ(writes, 200);
+    EXPECT_FALSE(m.writer().is_lock());
+}
+
+TEST(Mutex, barging)
+{
+    // 抢占策略: 解锁后被唤醒者与新来者重新竞争, 仍然互斥且不丢失唤醒.
+    BasicCoMutex<CoMutexBarging> m;
+    int *pv = new int(0);
+    for (int i = 0; i < 100; ++i)
+        go [=]()mutable {
+            for (int i = 0; i < 100; ++i)
+            {
+                std::unique_lock<BasicCoMutex<CoMutexBarging>> lock(m);
+                int v = *pv;
+                if (i % 10 == 0) co_yield;
+                *pv = v + 1;
+            }
+        };
+
+    // 协程外的线程也可以排队
+    boost::thread th([=]()mutable {
+        for (int i = 0; i < 100; ++i)
+        {
+            std::unique_lock<BasicCoMutex<CoMutexBarging>> lock(m);
+            ++*pv;
+        }
+    });
+    boost::thread_group tg;
+    for (int i = 0; i < 4; ++i)
+        tg.create_thread([]{co_sched.RunUntilNoTask();});
+    tg.join_all();
+    th.join();
+    EXPECT_EQ(*pv, 101 * 100);
+    EXPECT_FALSE(m.is_lock());
+    delete pv;
+}
@@ -0,0 +1,69 @@
+#include "gtest/gtest.h"
+#include <vector>
+#include "coroutine.h"
+using namespace co;
+
+// 本文件的用例只使用一个P, 协程的执行顺序是确定的.
+static void SingleProc()
+{
+    g_Scheduler.GetOptions().processer_count = 1;
+}
+
+TEST(RunNext, WakeeRunsAfterWaker)
+{
+    SingleProc();
+    co_chan<int> ch;
+    std::vector<int> order;
+
+    // 读者先挂起
+    go [&]{
+        int x;
+        ch >> x;
+        order.push_back(x);
+    };
+    g_Scheduler.Run();
+    EXPECT_TRUE(order.empty());
+
+    // 写者唤醒读者后继续执行到结束; 读者插在写者之后, 先于更早入队的2, 3执行.
+    go [&]{
+        order.push_back(0);
+        ch << 1;
+        order.push_back(0);
+    };
+    go [&]{ order.push_back(2); };
+    go [&]{ order.push_back(3); };
+    g_Scheduler.RunUntilNoTask();
+
+    std::vector<int> expected{0, 0, 1, 2, 3};
+    EXPECT_EQ(order, expected);
+}
+
+TEST(RunNext, Limit)
+{
+    // 两个协程通过无缓冲channel互相唤醒, 连续执行runnext达到上限后, 同一P上的其他协程也能得到执行.
+    SingleProc();
+    const int n = 1000;
+    co_chan<int> ping, pong;
+    int rounds = 0, rounds_seen = -1;
+    go [&]{
+        for (int i = 0; i < n; ++i) {
+            int x;
+            ping << i;
+            pong >> x;
+            ++rounds;
+        }
+    };
+    go [&]{
+        for (int i = 0; i < n; ++i) {
+            int x;
+            ping >> x;
+            pong << x;
+        }
+    };
+    go [&]{ rounds_seen = rounds; };
+    g_Scheduler.RunUntilNoTask();
+
+    EXPECT_EQ(rounds, n);
+    EXPECT_GT(rounds_seen, 0);
+    EXPECT_LT(rounds_seen, n);
+}
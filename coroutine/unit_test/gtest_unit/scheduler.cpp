@@ -0,0 +1,329 @@
+#include "gtest/gtest.h"
+#include <vector>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "coroutine.h"
+using namespace co;
+
+///scheduler test points:
+// 1.idle threads steal processers and new tasks from a stalled thread.
+// 2.no task is lost or run twice while stealing races with wakeups.
+// 3.a parked thread is woken at once by a cross-thread go, channel push, timer or thread pool job.
+// 4.the polling thread sleeps until the next timer deadline, and is interrupted by an earlier timer or a new task.
+
+// 在后台线程中执行调度, 析构时停止并等待线程退出.
+struct RunThreads
+{
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> runs{0};  // 执行Run的次数
+    std::vector<std::thread> threads;
+
+    explicit RunThreads(int n)
+    {
+        for (int i = 0; i < n; ++i)
+            threads.emplace_back([this]{
+                while (!stop) {
+                    g_Scheduler.Run();
+                    ++runs;
+                }
+            });
+    }
+
+    ~RunThreads()
+    {
+        stop = true;
+        for (auto &t : threads)
+            t.join();
+    }
+};
+
+// 等待cond成立, 超时返回false.
+template <typename Cond>
+static bool WaitFor(Cond cond, std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!cond()) {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t MicrosecondsSince(Clock::time_point t0)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count();
+}
+
+static int64_t Median(std::vector<int64_t> v)
+{
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+// 休眠上限调到最大, 没有被及时唤醒的线程要等到休眠超时才能执行新任务, 延迟可达255ms.
+struct MaxSleepScope
+{
+    uint8_t prev_;
+    MaxSleepScope() : prev_(g_Scheduler.GetOptions().max_sleep_ms) {
+        g_Scheduler.GetOptions().max_sleep_ms = 255;
+    }
+    ~MaxSleepScope() {
+        g_Scheduler.GetOptions().max_sleep_ms = prev_;
+    }
+};
+
+static void BusyWait(std::chrono::microseconds d)
+{
+    auto end = std::chrono::steady_clock::now() + d;
+    while (std::chrono::steady_clock::now() < end) ;
+}
+
+TEST(Scheduler, StealFromStalledThread)
+{
+    // 主线程执行一次Run, 创建的P全部在主线程的队列中, 之后主线程不再执行Run.
+    g_Scheduler.GetOptions().processer_count = 4;
+    g_Scheduler.Run();
+
+    const int n = 16;
+    std::atomic<int> done{0};
+    std::mutex mtx;
+    std::set<std::thread::id> ids;
+    for (int i = 0; i < n; ++i)
+        go [&]{
+            BusyWait(std::chrono::milliseconds(2));
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                ids.insert(std::this_thread::get_id());
+            }
+            ++done;
+        };
+
+    {
+        RunThreads rt(2);
+        EXPECT_TRUE(WaitFor([&]{ return done == n; }, std::chrono::seconds(10)));
+    }
+
+    // 新协程都在主线程的队列中, 全部由窃取了它们的空闲线程执行.
+    EXPECT_EQ(done, n);
+    EXPECT_EQ(ids.count(std::this_thread::get_id()), 0u);
+    EXPECT_EQ(ids.size(), 2u);
+}
+
+TEST(Scheduler, StealStress)
+{
+    // 多个线程互相窃取, 同时有协程被其他线程唤醒、在协程中创建协程、线程偶尔停滞,
+    // 每个协程恰好执行一次.
+    const int n = 20000;
+    std::vector<std::atomic<int>> runs(n);
+    for (auto &r : runs)
+        r = 0;
+    std::atomic<int> done{0};
+    co_chan<int> wake(64);
+
+    auto body = [&](int i){
+        if (i % 3 == 0)
+            co_yield;
+        if (i % 7 == 0) {
+            int v;
+            wake >> v;      // 由协程外的线程唤醒
+        }
+        if (i % 1000 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));  // 停滞, 其他线程窃取它的P
+        ++runs[i];
+        ++done;
+    };
+
+    {
+        RunThreads rt(4);
+        std::thread feeder([&]{
+            for (int i = 0; i < n; i += 7)
+                wake << i;
+        });
+
+        std::thread producer([&]{
+            for (int i = 0; i < n; i += 2)
+                go [&, i]{ body(i); };
+        });
+        go [&]{
+            for (int i = 1; i < n; i += 2) {
+                go [&, i]{ body(i); };
+                if (i % 64 == 1)
+                    co_yield;
+            }
+        };
+
+        producer.join();
+        EXPECT_TRUE(WaitFor([&]{ return done == n; }, std::chrono::seconds(60)));
+        feeder.join();
+    }
+
+    int bad = 0;
+    for (auto &r : runs)
+        if (r != 1) ++bad;
+    EXPECT_EQ(bad, 0);
+    EXPECT_EQ(done, n);
+}
+
+TEST(Scheduler, WakeLatency)
+{
+    MaxSleepScope max_sleep;
+    RunThreads rt(2);
+    const int samples = 30;
+    const int64_t limit_us = 500;
+    std::atomic<bool> done{false};
+    std::vector<int64_t> go_us, chan_us, timer_us, pool_us;
+
+    // 1.协程外的线程创建协程
+    for (int i = 0; i < samples; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));    // 等待调度线程休眠
+        done = false;
+        int64_t us = 0;
+        auto t0 = Clock::now();
+        go [&]{ us = MicrosecondsSince(t0); done = true; };
+        EXPECT_TRUE(WaitFor([&]{ return done.load(); }, std::chrono::seconds(1)));
+        go_us.push_back(us);
+    }
+
+    // 2.协程外的线程写channel, 唤醒挂起在channel上的协程
+    {
+        co_chan<Clock::time_point> ch;
+        std::atomic<int> received{0};
+        go [&]{
+            for (int i = 0; i < samples; ++i) {
+                Clock::time_point t0;
+                ch >> t0;
+                chan_us.push_back(MicrosecondsSince(t0));
+                ++received;
+            }
+        };
+        for (int i = 0; i < samples; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            ch << Clock::now();
+            EXPECT_TRUE(WaitFor([&]{ return received == i + 1; }, std::chrono::seconds(1)));
+        }
+    }
+
+    // 3.协程外的线程添加定时器, 调度线程按新的截止时间醒来
+    for (int i = 0; i < samples; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        done = false;
+        int64_t us = 0;
+        auto t0 = Clock::now();
+        co_timer_add(std::chrono::milliseconds(2), [&]{ us = MicrosecondsSince(t0) - 2000; done = true; });
+        EXPECT_TRUE(WaitFor([&]{ return done.load(); }, std::chrono::seconds(1)));
+        timer_us.push_back(us);
+    }
+
+    // 4.线程池
+    {
+        std::atomic<bool> stop{false};
+        std::thread tp([&]{
+            while (!stop)
+                g_Scheduler.GetThreadPool().Run();
+        });
+        for (int i = 0; i < samples; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            co_chan<void> ch(1);
+            auto t0 = Clock::now();
+            int64_t us = 0;
+            g_Scheduler.GetThreadPool().AsyncWait<void>(ch, [&]{ us = MicrosecondsSince(t0); });
+            ch >> nullptr;
+            pool_us.push_back(us);
+        }
+        stop = true;
+        tp.join();
+    }
+
+    EXPECT_LT(Median(go_us), limit_us);
+    EXPECT_LT(Median(chan_us), limit_us);
+    EXPECT_LT(Median(timer_us), limit_us);
+    EXPECT_LT(Median(pool_us), limit_us);
+}
+
+TEST(Scheduler, NoLostWakeup)
+{
+    // 反复在调度线程准备休眠的各个时刻从外部添加协程, 丢失的唤醒会让协程等到休眠超时.
+    MaxSleepScope max_sleep;
+    RunThreads rt(2);
+    const int n = 3000;
+    std::atomic<bool> done{false};
+    for (int i = 0; i < n; ++i) {
+        if (i % 4)
+            std::this_thread::sleep_for(std::chrono::microseconds(i % 4 * 50));
+        done = false;
+        auto t0 = Clock::now();
+        go [&]{ done = true; };
+        EXPECT_TRUE(WaitFor([&]{ return done.load(); }, std::chrono::seconds(1)));
+        ASSERT_LT(MicrosecondsSince(t0), 100 * 1000) << "iteration " << i;
+    }
+}
+
+TEST(Scheduler, PollUntilDeadline)
+{
+    // 只有一个调度线程, 它在epoll_wait中等待下一个定时器到期, 而不是空转或睡满max_sleep_ms.
+    MaxSleepScope max_sleep;
+    RunThreads rt(1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    for (int i = 0; i < 5; ++i) {
+        std::atomic<bool> done{false};
+        int64_t us = 0;
+        auto t0 = Clock::now();
+        go [&]{
+            co_timer_add(std::chrono::milliseconds(50), [&]{ us = MicrosecondsSince(t0); done = true; });
+        };
+        uint64_t runs = rt.runs;
+        EXPECT_TRUE(WaitFor([&]{ return done.load(); }, std::chrono::seconds(1)));
+        EXPECT_GE(us, 50 * 1000);
+        EXPECT_LT(us, 55 * 1000);
+        EXPECT_LT(rt.runs - runs, 20u);
+    }
+}
+
+TEST(Scheduler, PollInterrupt)
+{
+    // 调度线程在等待一个较远的定时器时, 新加入的更早的定时器或新协程要打断epoll_wait.
+    MaxSleepScope max_sleep;
+    RunThreads rt(1);
+    std::atomic<int> far_fired{0};
+    auto far_t0 = Clock::now();
+    int64_t far_us = 0;
+    co_timer_add(std::chrono::milliseconds(200), [&]{ far_us = MicrosecondsSince(far_t0); ++far_fired; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // 1.更早的定时器
+    for (int i = 0; i < 5; ++i) {
+        std::atomic<bool> done{false};
+        int64_t us = 0;
+        auto t0 = Clock::now();
+        co_timer_add(std::chrono::milliseconds(5), [&]{ us = MicrosecondsSince(t0); done = true; });
+        EXPECT_TRUE(WaitFor([&]{ return done.load(); }, std::chrono::seconds(1)));
+        EXPECT_GE(us, 5 * 1000);
+        EXPECT_LT(us, 7 * 1000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    // 2.新协程
+    for (int i = 0; i < 5; ++i) {
+        std::atomic<bool> done{false};
+        int64_t us = 0;
+        auto t0 = Clock::now();
+        go [&]{ us = MicrosecondsSince(t0); done = true; };
+        EXPECT_TRUE(WaitFor([&]{ return done.load(); }, std::chrono::seconds(1)));
+        EXPECT_LT(us, 1000);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    // 被打断后仍按原来的截止时间等待较远的定时器
+    EXPECT_EQ(far_fired, 0);
+    EXPECT_TRUE(WaitFor([&]{ return far_fired == 1; }, std::chrono::seconds(1)));
+    EXPECT_GE(far_us, 200 * 1000);
+    EXPECT_LT(far_us, 205 * 1000);
+}
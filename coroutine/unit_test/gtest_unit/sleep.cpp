@@ -91,6 +91,47 @@ TEST_P(Sleep, sleep1)
     EXPECT_GT(dc, 999);
 }
 
+TEST(Sleep, SubMillisecond)
+{
+    // 不足1ms的nanosleep、select超时和co_sleep也要真正挂起, 且不早于要求的时间.
+    int c = 0, n = 50;
+    std::chrono::nanoseconds min_elapsed[3];
+    for (auto &e : min_elapsed)
+        e = std::chrono::hours(1);
+
+    go [&]{
+        for (int i = 0; i < n; ++i) {
+            auto s = chrono::high_resolution_clock::now();
+            timespec ts{0, 200 * 1000};
+            nanosleep(&ts, NULL);
+            min_elapsed[0] = std::min(min_elapsed[0], chrono::high_resolution_clock::now() - s);
+
+            s = chrono::high_resolution_clock::now();
+            timeval tv{0, 300};
+            select(0, NULL, NULL, NULL, &tv);
+            min_elapsed[1] = std::min(min_elapsed[1], chrono::high_resolution_clock::now() - s);
+
+            s = chrono::high_resolution_clock::now();
+            g_Scheduler.SleepSwitch(chrono::microseconds(100));
+            min_elapsed[2] = std::min(min_elapsed[2], chrono::high_resolution_clock::now() - s);
+            ++c;
+        }
+    };
+
+    auto s = chrono::system_clock::now();
+    g_Scheduler.RunUntilNoTask();
+    auto e = chrono::system_clock::now();
+    auto dc = chrono::duration_cast<chrono::milliseconds>(e - s).count();
+    EXPECT_EQ(c, n);
+    EXPECT_GE(min_elapsed[0], chrono::microseconds(200));
+    EXPECT_GE(min_elapsed[1], chrono::microseconds(300));
+    EXPECT_GE(min_elapsed[2], chrono::microseconds(100));
+
+    // 不应退化为按毫秒等待: 每轮600us, 按毫秒取整则至少150ms.
+    EXPECT_GE(dc, 30);
+    EXPECT_LT(dc, 150);
+}
+
 INSTANTIATE_TEST_CASE_P(
         SleepTypeTest,
         Sleep,
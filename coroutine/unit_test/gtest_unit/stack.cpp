@@ -0,0 +1,130 @@
+#include <iostream>
+#include <string.h>
+#include <gtest/gtest.h>
+#include "coroutine.h"
+using namespace std;
+using namespace co;
+
+///coroutine stack test points:
+// 1.dedicated stack, deep stack use, switch without copy.
+// 2.mix shared and dedicated stack coroutines.
+// 3.global stack_mode option.
+// 4.stack overflow hit the guard page.
+// 5.stack pool recycle stacks of finished coroutines.
+
+static int deep_call(int depth)
+{
+    volatile char buf[1024];
+    memset((char*)buf, depth, sizeof(buf));
+    if (depth == 0) {
+        co_yield;
+        return buf[0];
+    }
+    return deep_call(depth - 1) + buf[1];
+}
+
+TEST(Stack, Dedicated)
+{
+    int results[10] = {};
+    for (int i = 0; i < 10; ++i)
+        go_stack(eCoStackMode::dedicated) [&results, i]{
+            for (int j = 0; j < 10; ++j) {
+                results[i] += deep_call(100);
+                co_yield;
+            }
+        };
+    g_Scheduler.RunUntilNoTask();
+
+    int expect = 0;
+    for (int d = 1; d <= 100; ++d)
+        expect += d;
+    for (int i = 0; i < 10; ++i)
+        EXPECT_EQ(results[i], expect * 10);
+}
+
+TEST(Stack, Mixed)
+{
+    std::atomic<int> count{0};
+    for (int i = 0; i < 100; ++i) {
+        auto fn = [&count]{
+            int local = 0;
+            for (int j = 0; j < 10; ++j) {
+                ++local;
+                co_yield;
+            }
+            count += local;
+        };
+        if (i % 2)
+            go_stack(eCoStackMode::dedicated) fn;
+        else
+            go fn;
+    }
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(count, 1000);
+}
+
+TEST(Stack, Option)
+{
+    g_Scheduler.GetOptions().stack_mode = eCoStackMode::dedicated;
+    int result = 0;
+    go [&]{ result = deep_call(50); };
+    g_Scheduler.RunUntilNoTask();
+    g_Scheduler.GetOptions().stack_mode = eCoStackMode::shared;
+    EXPECT_EQ(result, 50 * 51 / 2);
+}
+
+TEST(Stack, Pool)
+{
+    auto batch = []{
+        for (int i = 0; i < 100; ++i) {
+            go []{ deep_call(10); };
+            go_stack(eCoStackMode::dedicated) []{ deep_call(10); };
+        }
+        g_Scheduler.RunUntilNoTask();
+    };
+
+    batch();
+    batch();
+    StackPoolStats before = StackPool::getInstance().GetStats();
+    for (int i = 0; i < 10; ++i)
+        batch();
+    StackPoolStats after = StackPool::getInstance().GetStats();
+
+    // 每批100次分配(独立栈), 稳定后全部复用.
+    // 共享栈协程的栈数据块随Task一起被对象池复用, 不再经过栈内存池.
+    EXPECT_EQ(after.alloc_count - before.alloc_count, 1000u);
+    EXPECT_LT(after.os_alloc_count - before.os_alloc_count, 100u);
+    EXPECT_GT(after.reuse_count - before.reuse_count, 900u);
+    EXPECT_LT(after.advise_count - before.advise_count, 300u);
+    EXPECT_GT(after.cached_bytes, 0u);
+
+    // 空闲的块经过两次回收后交还物理页, 之后仍可复用.
+    StackPool::getInstance().Scavenge();
+    StackPool::getInstance().Scavenge();
+    StackPoolStats scavenged = StackPool::getInstance().GetStats();
+    EXPECT_GT(scavenged.advise_count, after.advise_count);
+    batch();
+    EXPECT_EQ(StackPool::getInstance().GetStats().os_alloc_count, scavenged.os_alloc_count);
+}
+
+// 递归直到栈溢出; 编译器无法证明limit之前不会返回, 因此不会报告无限递归.
+static volatile int overflow_limit = -1;
+
+static int overflow_call(int depth)
+{
+    volatile char buf[4096];
+    buf[0] = depth;
+    if (depth == overflow_limit)
+        return 0;
+    return overflow_call(depth + 1) + buf[0];
+}
+
+TEST(StackDeathTest, GuardPage)
+{
+    ::testing::FLAGS_gtest_death_test_style = "threadsafe";
+    EXPECT_EXIT({
+        g_Scheduler.GetOptions().dedicated_stack_size = 64 * 1024;
+        go_stack(eCoStackMode::dedicated) []{ overflow_call(0); };
+        g_Scheduler.RunUntilNoTask();
+    }, ::testing::KilledBySignal(SIGSEGV), "");
+}
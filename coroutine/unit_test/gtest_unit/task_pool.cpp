@@ -0,0 +1,174 @@
+#include <iostream>
+#include <memory>
+#include <set>
+#include <vector>
+#include <type_traits>
+#include <gtest/gtest.h>
+#include <boost/thread.hpp>
+#include "coroutine.h"
+using namespace std;
+using namespace co;
+
+///task pool test points:
+// 1.finished tasks are recycled and reused by new coroutines.
+// 2.captures of the coroutine function are released when the task is recycled.
+// 3.tasks retired on exited threads are reclaimed by other threads.
+// 4.task function is moved into the task, move-only captures are supported.
+// 5.small captures are stored inline, large captures fall back to heap.
+
+TEST(TaskPool, Reuse)
+{
+    auto batch = []{
+        for (int i = 0; i < 100; ++i)
+            go []{ co_yield; };
+        g_Scheduler.RunUntilNoTask();
+    };
+
+    batch();
+    uint64_t reuse = TaskPool::getInstance().GetReuseCount();
+    for (int i = 0; i < 10; ++i)
+        batch();
+    EXPECT_EQ(TaskPool::getInstance().GetReuseCount() - reuse, 1000u);
+    EXPECT_EQ(Task::GetTaskCount(), 0u);
+    EXPECT_EQ(Task::GetDeletedTaskCount(), 0u);
+
+    // 复用的Task分配新的ID, 共享栈和独立栈交替使用.
+    std::set<uint64_t> ids;
+    for (int i = 0; i < 100; ++i) {
+        auto fn = [&ids]{
+            ids.insert(g_Scheduler.GetCurrentTaskID());
+            co_yield;
+            ids.insert(g_Scheduler.GetCurrentTaskID());
+        };
+        if (i % 2)
+            go_stack(eCoStackMode::dedicated) fn;
+        else
+            go fn;
+    }
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(ids.size(), 100u);
+}
+
+TEST(TaskPool, ReleaseCapture)
+{
+    std::shared_ptr<int> sp(new int(0));
+    for (int i = 0; i < 10; ++i)
+        go [sp]{ ++*sp; co_yield; };
+    EXPECT_EQ(sp.use_count(), 11);
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(*sp, 10);
+    EXPECT_EQ(sp.use_count(), 1);
+}
+
+TEST(TaskPool, MultiThreads)
+{
+    std::atomic<int> count{0};
+    for (int i = 0; i < 1000; ++i)
+        go [&count]{ co_yield; ++count; };
+
+    boost::thread_group tg;
+    for (int i = 0; i < 4; ++i)
+        tg.create_thread([] {
+                g_Scheduler.RunUntilNoTask();
+                });
+    tg.join_all();
+    EXPECT_EQ(count, 1000);
+    EXPECT_EQ(Task::GetTaskCount(), Task::GetDeletedTaskCount());
+
+    // 退出的线程留下的Task由其他线程回收.
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(Task::GetTaskCount(), 0u);
+    EXPECT_EQ(Task::GetDeletedTaskCount(), 0u);
+}
+
+struct CopyCounter
+{
+    int *copies;
+    explicit CopyCounter(int *c) : copies(c) {}
+    CopyCounter(CopyCounter const& other) : copies(other.copies) { ++*copies; }
+    CopyCounter(CopyCounter && other) noexcept : copies(other.copies) {}
+};
+
+struct MoveOnlyFn
+{
+    std::unique_ptr<int> p;
+    int *out;
+    void operator()() { *out = *p; }
+};
+
+TEST(TaskF, MoveThrough)
+{
+    int copies = 0;
+    int called = 0;
+    std::shared_ptr<int> sp(new int(1));
+    CopyCounter cc(&copies);
+    go [cc, sp, &called]{ called += *sp; };
+    EXPECT_EQ(copies, 1);   // 只有lambda捕获时的一次拷贝
+    EXPECT_EQ(sp.use_count(), 2);
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(called, 1);
+    EXPECT_EQ(sp.use_count(), 1);
+
+    int result = 0;
+    go MoveOnlyFn{std::unique_ptr<int>(new int(7)), &result};
+    g_Scheduler.RunUntilNoTask();
+    EXPECT_EQ(result, 7);
+}
+
+static void plain_func() {}
+
+TEST(TaskF, Storage)
+{
+    std::shared_ptr<int> sp(new int(0));
+    int a = 0, b = 0;
+    TaskF small([sp, &a, &b]{ ++a; });
+    EXPECT_TRUE(small.IsInline());
+    EXPECT_TRUE(TaskF(&plain_func).IsInline());
+    EXPECT_TRUE(TaskF(std::function<void()>(plain_func)).IsInline());
+
+    char big[128] = {};
+    TaskF large([big, &b]{ b += big[0] + 1; });
+    EXPECT_FALSE(large.IsInline());
+
+    // 移动后原对象为空, 捕获的对象随最后一个TaskF析构.
+    TaskF moved(std::move(small));
+    EXPECT_FALSE(small);
+    EXPECT_TRUE(moved);
+    moved();
+    large = std::move(moved);
+    large();
+    EXPECT_EQ(a, 2);
+    EXPECT_EQ(b, 0);
+    EXPECT_EQ(sp.use_count(), 2);
+    large = nullptr;
+    EXPECT_EQ(sp.use_count(), 1);
+}
+
+// 移动构造可能抛出异常的函数对象
+struct ThrowingMoveFn
+{
+    int *out;
+    ThrowingMoveFn(int *o) : out(o) {}
+    ThrowingMoveFn(ThrowingMoveFn && other) noexcept(false) : out(other.out) {}
+    void operator()() { ++*out; }
+};
+
+TEST(TaskF, NothrowMove)
+{
+    static_assert(std::is_nothrow_move_constructible<TaskF>::value, "TaskF move ctor may throw");
+    static_assert(std::is_nothrow_move_assignable<TaskF>::value, "TaskF move assign may throw");
+
+    // 移动可能抛出异常的函数对象放在堆上, TaskF的移动只交换指针.
+    int c = 0;
+    TaskF f(ThrowingMoveFn{&c});
+    EXPECT_FALSE(f.IsInline());
+
+    // vector扩容时逐个移动, 函数对象不会丢失.
+    std::vector<TaskF> v;
+    v.push_back(std::move(f));
+    for (int i = 0; i < 100; ++i)
+        v.push_back(TaskF([&c]{ ++c; }));
+    for (auto &fn : v)
+        fn();
+    EXPECT_EQ(c, 101);
+}
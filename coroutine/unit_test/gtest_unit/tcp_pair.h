@@ -0,0 +1,50 @@
+#pragma once
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+// 建立一对经loopback相连的tcp socket, 都由hook的socket/accept创建(托管socket).
+//   hook的socketpair不托管, 测试托管socket的行为时用它代替socketpair.
+inline int tcp_socketpair(int sv[2])
+{
+    sv[0] = sv[1] = -1;
+    int lfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0) return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    int cfd = -1;
+    if (-1 == ::bind(lfd, (struct sockaddr*)&addr, len) || -1 == ::listen(lfd, 1) ||
+            -1 == ::getsockname(lfd, (struct sockaddr*)&addr, &len) ||
+            -1 == (cfd = ::socket(AF_INET, SOCK_STREAM, 0)) ||
+            -1 == ::connect(cfd, (struct sockaddr*)&addr, len)) {
+        if (cfd != -1) ::close(cfd);
+        ::close(lfd);
+        return -1;
+    }
+
+    // 已连接的socket占用监听socket的fd号, 不留下空洞, 关闭后新建的fd会复用这两个fd号.
+    int afd = ::accept(lfd, NULL, NULL);
+    if (afd < 0 || -1 == ::dup2(afd, lfd)) {
+        if (afd >= 0) ::close(afd);
+        ::close(cfd);
+        ::close(lfd);
+        return -1;
+    }
+    ::close(afd);
+    afd = lfd;
+
+    // 小包来回收发, 关闭Nagle以免延迟确认拖慢测试.
+    int on = 1;
+    ::setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    ::setsockopt(afd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    sv[0] = afd;
+    sv[1] = cfd;
+    return 0;
+}
@@ -2,8 +2,8 @@
 #include <boost/thread.hpp>
 #include "coroutine.h"
 #include <vector>
-#include <list>
 #include <atomic>
+#include <thread>
 #include <boost/timer.hpp>
 using namespace co;
 
@@ -114,3 +114,156 @@ TEST(ThreadsTimer, Cancel)
     EXPECT_TRUE(executed);
 }
 
+
+TEST(Timer, Wheel)
+{
+    // 跨越时间轮多个层的定时器: 不早于触发时间, 撤销的不触发.
+    CoTimerMgr mgr;
+    auto start = CoTimerMgr::Now();
+    int c = 0, early = 0, late = 0;
+    std::vector<CoTimerPtr> cancels;
+    for (int i = 0; i < 3000; ++i) {
+        auto deadline = start + std::chrono::microseconds(i * 97 % 300000);
+        auto id = mgr.ExpireAt(deadline, [&, deadline]{
+                    auto now = CoTimerMgr::Now();
+                    ++c;
+                    if (now < deadline) ++early;
+                    if (now - deadline > std::chrono::milliseconds(50)) ++late;
+                });
+        if (i % 3 == 0)
+            cancels.push_back(id);
+    }
+    for (auto &id : cancels)
+        EXPECT_TRUE(mgr.Cancel(id));
+
+    // 超出时间轮范围的定时器
+    auto far = mgr.ExpireAt(std::chrono::hours(24 * 100), [&]{ ++c; });
+
+    while (c < 2000)
+        mgr.RunExpired(128);
+    EXPECT_EQ(c, 2000);
+    EXPECT_EQ(early, 0);
+    EXPECT_EQ(late, 0);
+
+    CoTimerMgr::TimePoint next;
+    EXPECT_TRUE(mgr.GetNextDeadline(next));
+    EXPECT_GT(next, CoTimerMgr::Now() + std::chrono::hours(24));
+    EXPECT_TRUE(mgr.Cancel(far));
+    EXPECT_FALSE(mgr.GetNextDeadline(next));
+}
+
+TEST(Timer, CachedNow)
+{
+    // 调度之外每次都读取时钟
+    auto t1 = CoTimerMgr::CachedNow();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    EXPECT_GT(CoTimerMgr::CachedNow(), t1);
+
+    // 一轮调度中只读取一次时钟
+    CoTimerMgr::TimePoint t2;
+    {
+        CoTimerMgr::CachedNowScope scope;
+        t2 = CoTimerMgr::CachedNow();
+        EXPECT_GT(t2, t1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        EXPECT_EQ(CoTimerMgr::CachedNow(), t2);
+    }
+    EXPECT_GT(CoTimerMgr::CachedNow(), t2);
+
+    // 抛出异常离开作用域时也会关闭缓存
+    try {
+        CoTimerMgr::CachedNowScope scope;
+        t2 = CoTimerMgr::CachedNow();
+        throw 1;
+    } catch (int) {}
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    EXPECT_GT(CoTimerMgr::CachedNow(), t2);
+
+    // 协程中的睡眠、定时器不早于调度开始时的时间
+    int c = 0;
+    auto start = CoTimerMgr::Now();
+    go [&]{
+        co_sleep(20);
+        EXPECT_GE(CoTimerMgr::Now() - start, std::chrono::milliseconds(20));
+        ++c;
+    };
+    co_timer_add(std::chrono::milliseconds(10), [&]{
+        EXPECT_GE(CoTimerMgr::Now() - start, std::chrono::milliseconds(10));
+        ++c;
+    });
+    while (c < 2)
+        g_Scheduler.Run();
+}
+
+TEST(Timer, DeadlineAfterBusyWork)
+{
+    // 协程先执行一段时间再睡眠、等待, 截止时间从调用时算起, 不受本轮调度缓存的时间影响.
+    auto busy = []{
+        CoTimerMgr::CachedNow();    // 本轮调度中更早的读取, 例如前一个协程的睡眠
+        auto t = CoTimerMgr::Now();
+        while (CoTimerMgr::Now() - t < std::chrono::milliseconds(15)) ;
+        return CoTimerMgr::Now();
+    };
+
+    std::atomic<int> c{0};
+    go [&]{
+        auto start = busy();
+        co_sleep(20);
+        EXPECT_GE(CoTimerMgr::Now() - start, std::chrono::milliseconds(20));
+        ++c;
+    };
+    go [&]{
+        auto start = busy();
+        co_timer_add(std::chrono::milliseconds(20), [&, start]{
+            EXPECT_GE(CoTimerMgr::Now() - start, std::chrono::milliseconds(20));
+            ++c;
+        });
+    };
+    go [&]{
+        co_chan<int> ch(1);
+        int i;
+        auto start = busy();
+        EXPECT_FALSE(ch.BlockTryPop(i, std::chrono::milliseconds(20)));
+        EXPECT_GE(CoTimerMgr::Now() - start, std::chrono::milliseconds(20));
+        ++c;
+    };
+    while (c < 3)
+        g_Scheduler.Run();
+}
+
+TEST(Timer, Slack)
+{
+    // 触发时间相近、允许延后的定时器合并为很少几批触发, 且不早于要求的时间.
+    CoTimerMgr mgr;
+    auto start = CoTimerMgr::Now() + std::chrono::milliseconds(10);
+    auto slack = std::chrono::milliseconds(4);
+    int c = 0, early = 0, late = 0;
+    for (int i = 0; i < 1000; ++i) {
+        auto deadline = start + std::chrono::microseconds(i);
+        mgr.ExpireAt(deadline, [&, deadline]{
+                    auto now = CoTimerMgr::Now();
+                    ++c;
+                    if (now < deadline) ++early;
+                    if (now - deadline > slack + std::chrono::milliseconds(50)) ++late;
+                }, slack);
+    }
+
+    int batches = 0;
+    while (c < 1000)
+        if (mgr.RunExpired(10000))
+            ++batches;
+    EXPECT_EQ(early, 0);
+    EXPECT_EQ(late, 0);
+    EXPECT_LE(batches, 2);
+
+    // 不带slack时精确触发
+    bool fired = false;
+    auto deadline = CoTimerMgr::Now() + std::chrono::milliseconds(5);
+    mgr.ExpireAt(deadline, [&]{ fired = true; });
+    CoTimerMgr::TimePoint next;
+    EXPECT_TRUE(mgr.GetNextDeadline(next));
+    EXPECT_LE(next, deadline);
+    while (!fired)
+        mgr.RunExpired();
+    EXPECT_GE(CoTimerMgr::Now(), deadline);
+}
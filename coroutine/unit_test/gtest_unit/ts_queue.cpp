@@ -3,6 +3,11 @@
 #include <vector>
 #include <list>
 #include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
 using namespace co;
 
 struct QueueElem : public TSQueueHook
@@ -172,3 +177,281 @@ TEST(TSQueue, Erase) {
 TEST(TSQueue, LFLock) {
 }
 
+
+TEST(MPSCQueue, PushPopAll) {
+    MPSCQueue<QueueElem> q;
+    EXPECT_TRUE(q.empty());
+    EXPECT_TRUE(q.pop_all().empty());
+
+    QueueElem::s_id = 0;
+    for (int i = 0; i < 10; ++i)
+        q.push(new QueueElem);
+    EXPECT_FALSE(q.empty());
+
+    SList<QueueElem> slist = q.pop_all();
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(slist.size(), 10);
+    uint32_t id = 0;
+    for (auto& elem : slist)
+        EXPECT_EQ(elem.id_, ++id);
+
+    // 取出一部分后放回, 之后入队的元素排在放回的元素之前.
+    for (int i = 0; i < 3; ++i) {
+        QueueElem* e = &*slist.begin();
+        slist.erase(slist.begin());
+        delete e;
+    }
+    QueueElem* e = new QueueElem;
+    q.push(e);
+    q.push(slist);
+    slist = q.pop_all();
+    EXPECT_EQ(slist.size(), 8);
+    std::vector<uint32_t> ids;
+    for (auto it = slist.begin(); it != slist.end(); )
+    {
+        ids.push_back(it->id_);
+        QueueElem* elem = &*it;
+        it = slist.erase(it);
+        delete elem;
+    }
+    std::vector<uint32_t> expect{11, 4, 5, 6, 7, 8, 9, 10};
+    EXPECT_EQ(ids, expect);
+    EXPECT_TRUE(q.empty());
+}
+
+TEST(MPSCQueue, MultiProducer) {
+    MPSCQueue<QueueElem> q;
+    const int producers = 4;
+    const int n = 100000;
+    std::atomic<int> done{0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+        threads.emplace_back([&, p]{
+            for (int i = 0; i < n; ++i) {
+                QueueElem* e = new QueueElem;
+                e->id_ = p * n + i;
+                q.push(e);
+            }
+            ++done;
+        });
+
+    // 每个生产者的元素保持入队顺序.
+    std::vector<int> last(producers, -1);
+    int count = 0;
+    bool ordered = true;
+    for (;;) {
+        bool finished = done == producers;
+        SList<QueueElem> slist = q.pop_all();
+        for (auto it = slist.begin(); it != slist.end(); ) {
+            QueueElem* elem = &*it;
+            it = slist.erase(it);
+            int p = elem->id_ / n;
+            int i = elem->id_ % n;
+            if (i <= last[p]) ordered = false;
+            last[p] = i;
+            ++count;
+            delete elem;
+        }
+        if (finished) break;
+    }
+
+    for (auto &t : threads)
+        t.join();
+    EXPECT_TRUE(ordered);
+    EXPECT_EQ(count, producers * n);
+    EXPECT_TRUE(q.empty());
+}
+
+TEST(LFLock, Contention) {
+    EnableLockStats(true);
+    LockStats before = GetLockStats(eLockSite::other);
+
+    LFLock lock;
+    const int threads = 4;
+    const int n = 100000;
+    long long counter = 0;
+    std::vector<std::thread> tg;
+    for (int i = 0; i < threads; ++i)
+        tg.emplace_back([&]{
+            for (int j = 0; j < n; ++j) {
+                std::lock_guard<LFLock> guard(lock);
+                ++counter;
+            }
+        });
+    for (auto &t : tg)
+        t.join();
+    EXPECT_EQ(counter, threads * n);
+
+    LockStats after = GetLockStats(eLockSite::other);
+    EXPECT_GE(after.acquire_count - before.acquire_count, (uint64_t)threads * n);
+    EXPECT_LE(after.contended_count - before.contended_count,
+            after.acquire_count - before.acquire_count);
+    EnableLockStats(false);
+}
+
+TEST(LFLock, Park) {
+    LFLock lock(eLockSite::task_pool);
+    LockStats before = GetLockStats(eLockSite::task_pool);
+
+    // 持有者长时间不释放, 等待者自旋后休眠在futex上.
+    lock.lock();
+    std::thread waiter([&]{
+        std::lock_guard<LFLock> guard(lock);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(lock.try_lock());
+    lock.unlock();
+    waiter.join();
+
+    LockStats after = GetLockStats(eLockSite::task_pool);
+    EXPECT_EQ(after.contended_count - before.contended_count, 1u);
+    EXPECT_GT(after.spin_count, before.spin_count);
+    EXPECT_GE(after.park_count - before.park_count, 1u);
+    EXPECT_STREQ(GetLockSiteName(eLockSite::task_pool), "task_pool");
+    EXPECT_TRUE(lock.try_lock());
+    lock.unlock();
+}
+
+TEST(MPMCRing, Capacity) {
+    // 容量不必是2的幂, 满时拒绝写入且不移动参数.
+    for (std::size_t cap : {1, 3, 4}) {
+        MPMCRing<std::unique_ptr<int>> ring(cap);
+        EXPECT_TRUE(ring.empty());
+        for (std::size_t round = 0; round < 3; ++round) {
+            for (std::size_t i = 0; i < cap; ++i)
+                EXPECT_TRUE(ring.TryPush(std::unique_ptr<int>(new int(i))));
+            std::unique_ptr<int> extra(new int(-1));
+            EXPECT_FALSE(ring.TryPush(std::move(extra)));
+            EXPECT_TRUE(!!extra);
+            EXPECT_FALSE(ring.empty());
+
+            for (std::size_t i = 0; i < cap; ++i) {
+                std::unique_ptr<int> p;
+                EXPECT_TRUE(ring.TryPop(p));
+                EXPECT_EQ(*p, (int)i);
+            }
+            std::unique_ptr<int> p;
+            EXPECT_FALSE(ring.TryPop(p));
+            EXPECT_TRUE(ring.empty());
+        }
+    }
+
+    // 析构时销毁剩余的元素
+    std::shared_ptr<int> sp(new int(0));
+    {
+        MPMCRing<std::shared_ptr<int>> ring(4);
+        ring.TryPush(sp);
+        ring.TryPush(sp);
+        EXPECT_TRUE(ring.TryPop(nullptr));
+        EXPECT_EQ(sp.use_count(), 2);
+    }
+    EXPECT_EQ(sp.use_count(), 1);
+}
+
+TEST(MPMCRing, Batch) {
+    // 批量读写跨越环尾, 数量受空位(已写入的元素)限制.
+    MPMCRing<int> ring(5);
+    std::vector<int> in = {0, 1, 2, 3, 4, 5, 6};
+    std::vector<int> out;
+    auto sink = [&](int && v){ out.push_back(v); };
+    for (int round = 0; round < 3; ++round) {
+        auto first = in.begin();
+        EXPECT_EQ(ring.TryPushN(first, 3), 3u);
+        EXPECT_EQ(*first, 3);
+        EXPECT_EQ(ring.TryPushN(first, 4), 2u);
+        EXPECT_EQ(*first, 5);
+        EXPECT_EQ(ring.TryPushN(first, 2), 0u);
+
+        out.clear();
+        EXPECT_EQ(ring.TryPopN(sink, 2), 2u);
+        EXPECT_EQ(ring.TryPopN(sink, 0), 0u);
+        EXPECT_EQ(ring.TryPopN(sink, 10), 3u);
+        EXPECT_EQ(ring.TryPopN(sink, 10), 0u);
+        EXPECT_EQ(out, std::vector<int>({0, 1, 2, 3, 4}));
+        EXPECT_TRUE(ring.empty());
+    }
+}
+
+// 拷贝构造可能抛出异常, 移动构造不会.
+struct ThrowOnCopy
+{
+    int v;
+    explicit ThrowOnCopy(int i) : v(i) {}
+    ThrowOnCopy(ThrowOnCopy const& other) : v(other.v)
+    {
+        if (v < 0) throw std::runtime_error("copy");
+    }
+    ThrowOnCopy(ThrowOnCopy && other) noexcept : v(other.v) {}
+    ThrowOnCopy& operator=(ThrowOnCopy && other) noexcept { v = other.v; return *this; }
+};
+
+TEST(MPMCRing, Exception) {
+    // 构造或出队回调抛出异常后, 槽位照常释放, 后续读写不受影响.
+    MPMCRing<ThrowOnCopy> ring(3);
+    ThrowOnCopy bad(-1), good(1);
+    EXPECT_THROW(ring.TryPush(bad), std::runtime_error);
+    EXPECT_TRUE(ring.empty());
+    EXPECT_TRUE(ring.TryPush(good));
+
+    std::vector<ThrowOnCopy> in;
+    for (int v : {2, -1, 3})
+        in.emplace_back(v);
+    auto first = in.begin();
+    EXPECT_THROW(ring.TryPushN(first, 3), std::runtime_error);
+    EXPECT_EQ(first->v, -1);
+    ++first;
+    EXPECT_EQ(ring.TryPushN(first, 1), 1u);
+
+    std::vector<int> out;
+    auto sink = [&](ThrowOnCopy && e){
+        if (e.v == 2) throw std::runtime_error("sink");
+        out.push_back(e.v);
+    };
+    EXPECT_THROW(ring.TryPopN(sink, 3), std::runtime_error);
+    EXPECT_EQ(ring.TryPopN(sink, 3), 1u);
+    EXPECT_EQ(out, std::vector<int>({1, 3}));
+    EXPECT_TRUE(ring.empty());
+
+    // 一轮之后所有槽位仍可用
+    for (int i = 0; i < 3; ++i)
+        EXPECT_TRUE(ring.TryPush(ThrowOnCopy(i)));
+    EXPECT_FALSE(ring.TryPush(good));
+    ThrowOnCopy e(0);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(ring.TryPop(e));
+        EXPECT_EQ(e.v, i);
+    }
+}
+
+TEST(MPMCRing, MultiThreads) {
+    MPMCRing<uint64_t> ring(10);
+    const int threads = 4;
+    const uint64_t n = 100000;
+    std::atomic<uint64_t> sum{0}, count{0};
+
+    std::vector<std::thread> tg;
+    for (int t = 0; t < threads; ++t) {
+        tg.emplace_back([&, t]{
+            for (uint64_t i = 0; i < n; ++i)
+                while (!ring.TryPush(t * n + i))
+                    std::this_thread::yield();
+        });
+        tg.emplace_back([&]{
+            uint64_t v;
+            while (count < threads * n) {
+                if (ring.TryPop(v)) {
+                    sum += v;
+                    ++count;
+                } else
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (auto &th : tg)
+        th.join();
+
+    uint64_t total = threads * n;
+    EXPECT_EQ(count, total);
+    EXPECT_EQ(sum, total * (total - 1) / 2);
+    EXPECT_TRUE(ring.empty());
+}
@@ -8,25 +8,50 @@ IoWait::IoWait()
 
 }
 
-void IoWait::CoSwitch(std::vector<FdStruct> && fdsts, int timeout_ms)
+void IoWait::CoSwitch(std::vector<FdStruct> && fdsts, int64_t timeout_us)
 {
 
 }
 
+void IoWait::CoSwitch(int fd, uint32_t event, uint32_t ready_seq, int64_t timeout_us)
+{
+
+}
+
+uint32_t IoWait::GetReadySeq(int fd, uint32_t event)
+{
+    return 0;
+}
+
+void IoWait::CloseFd(int fd)
+{
+}
+
 void IoWait::SchedulerSwitch(Task* tk)
 {
 
 }
 
-int IoWait::WaitLoop()
+int IoWait::WaitLoop(int64_t wait_us)
 {
-	Task::DeleteList delete_list;
-	Task::SwapDeleteList(delete_list);
-	for (auto tk : delete_list)
-		delete tk;
+	TaskPool::getInstance().AdvanceEpoch();
     return 0;
 }
 
+// 暂不支持阻塞等待IO事件, 调度线程统一休眠在futex上.
+bool IoWait::BeginPoll()
+{
+    return false;
+}
+
+void IoWait::EndPoll()
+{
+}
+
+void IoWait::Interrupt()
+{
+}
+
 void IoWait::Cancel(Task *tk, uint32_t id)
 {
 
@@ -14,12 +14,20 @@ namespace co
         IoWait();
 
         // Эеõswitch, ݴ״̬yield
-        void CoSwitch(std::vector<FdStruct> && fdsts, int timeout_ms);
+        void CoSwitch(std::vector<FdStruct> && fdsts, int64_t timeout_us);
+        void CoSwitch(int fd, uint32_t event, uint32_t ready_seq, int64_t timeout_us);
+
+        uint32_t GetReadySeq(int fd, uint32_t event);
+        void CloseFd(int fd);
 
         // ڵеõswitch, ɹȴУʧ¼ӻrunnable
         void SchedulerSwitch(Task* tk);
 
-        int WaitLoop();
+        int WaitLoop(int64_t wait_us = 0);
+
+        bool BeginPoll();
+        void EndPoll();
+        void Interrupt();
 
     private:
         void Cancel(Task *tk, uint32_t id);
@@ -15,4 +15,53 @@ namespace co {
 		info_->scheduler.native = NULL;
 	}
 
+	bool FutexWait(std::atomic<uint32_t> *addr, uint32_t val, int64_t timeout_us)
+	{
+		return !!WaitOnAddress((volatile VOID*)addr, &val, sizeof(val),
+				timeout_us < 0 ? INFINITE : (DWORD)((timeout_us + 999) / 1000));
+	}
+
+	void FutexWake(std::atomic<uint32_t> *addr, int n)
+	{
+		if (n == 1)
+			WakeByAddressSingle((PVOID)addr);
+		else
+			WakeByAddressAll((PVOID)addr);
+	}
+
+	uint32_t GetPageSize()
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+	}
+
+	char* StackAlloc(uint32_t &size, bool guard_page, bool huge_page)
+	{
+		uint32_t page_size = GetPageSize();
+		uint32_t guard_size = guard_page ? page_size : 0;
+		size = (size + page_size - 1) / page_size * page_size;
+		char *p = (char*)VirtualAlloc(NULL, size + guard_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!p)
+			return NULL;
+
+		DWORD old_protect;
+		if (guard_page && !VirtualProtect(p, guard_size, PAGE_NOACCESS, &old_protect)) {
+			VirtualFree(p, 0, MEM_RELEASE);
+			return NULL;
+		}
+
+		return p + guard_size;
+	}
+
+	void StackFree(char *stack, uint32_t size, bool guard_page)
+	{
+		VirtualFree(stack - (guard_page ? GetPageSize() : 0), 0, MEM_RELEASE);
+	}
+
+	void StackAdviseFree(char *stack, uint32_t size)
+	{
+		VirtualAlloc(stack, size, MEM_RESET, PAGE_READWRITE);
+	}
+
 } //namespace co
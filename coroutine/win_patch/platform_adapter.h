@@ -1,4 +1,6 @@
 #pragma once
+#include <stdint.h>
+#include <atomic>
 
 // VS2013不支持thread_local
 #if defined(_MSC_VER) && _MSC_VER < 1900
@@ -17,4 +19,22 @@ namespace co {
 		~ProcesserRunGuard();
 	};
 
+	// 当*addr等于val时阻塞当前线程, 直到被FutexWake唤醒或超时.
+	//   timeout_us(微秒)为-1时不超时, 向上取整到毫秒. 返回false表示超时或值已改变.
+	bool FutexWait(std::atomic<uint32_t> *addr, uint32_t val, int64_t timeout_us);
+
+	// 唤醒最多n个阻塞在addr上的线程
+	void FutexWake(std::atomic<uint32_t> *addr, int n);
+
+	uint32_t GetPageSize();
+
+	// 分配协程栈, size向上取整到页大小并返回实际大小.
+	//   guard_page为true时栈底(低地址)多分配一个不可访问的保护页.
+	//   返回可用栈空间的起始地址, 失败时返回NULL.
+	char* StackAlloc(uint32_t &size, bool guard_page = true, bool huge_page = false);
+	void StackFree(char *stack, uint32_t size, bool guard_page = true);
+
+	// 栈内存暂不使用, 物理页可由系统回收.
+	void StackAdviseFree(char *stack, uint32_t size);
+
 } //namespace co
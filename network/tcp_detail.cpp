@@ -1,5 +1,6 @@
 #include "tcp_detail.h"
 #include <chrono>
+#include <iterator>
 #include <boost/bind.hpp>
 
 namespace network {
@@ -118,10 +119,11 @@ namespace tcp_detail {
 
                 static const int c_multi = 1024;
 
-                for (int i = 0; i < c_multi; ++i)
+                // 一次取出一批消息, 并一次唤醒相应数量的发送者.
+                MsgList batch;
+                msg_chan_.TryPopN(std::back_inserter(batch), c_multi);
+                for (auto &msg : batch)
                 {
-                    boost::shared_ptr<Msg> msg;
-                    if (!msg_chan_.TryPop(msg)) break;
                     if (msg->timeout) {
                         if (msg->cb)
                             msg->cb(MakeNetworkErrorCode(eNetworkErrorCode::ec_timeout));
@@ -211,13 +213,7 @@ namespace tcp_detail {
         boost_ec ignore_ec;
         socket_->close(ignore_ec);
 
-        for (;;) {
-            boost::shared_ptr<Msg> msg;
-            if (!msg_chan_.TryPop(msg)) break;
-            if (msg->cb)
-                msg->cb(MakeNetworkErrorCode(eNetworkErrorCode::ec_shutdown));
-        }
-
+        msg_chan_.TryPopAll(std::back_inserter(msg_send_list_));
         for (auto &msg : msg_send_list_)
             if (msg->cb)
                 msg->cb(MakeNetworkErrorCode(eNetworkErrorCode::ec_shutdown));
@@ -245,10 +241,11 @@ namespace tcp_detail {
         msg->buf.swap(buf);
         if (opt_.sndtimeo_) {
             auto this_ptr = this->shared_from_this();
+            // 发送超时不需要精确, 允许延后1/8, 大量消息的定时器合并触发.
             msg->tid = co_timer_add(std::chrono::milliseconds(opt_.sndtimeo_),
                     [=]{
                         msg->timeout = true;
-                    });
+                    }, std::chrono::milliseconds(opt_.sndtimeo_ / 8));
         }
 
         if (!msg_chan_.TryPush(msg)) {